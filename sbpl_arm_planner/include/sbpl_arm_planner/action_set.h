@@ -8,7 +8,9 @@
 #include <ros/ros.h>
 #include <angles/angles.h>
 #include <sstream>
+#include <stdint.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/unordered_map.hpp>
 #include <sbpl_manipulation_components/motion_primitive.h>
 
 namespace sbpl_arm_planner {
@@ -21,6 +23,7 @@ enum {
   SHORT_DISTANCE,
   SNAP_TO_RPY,
   SNAP_TO_XYZ_RPY,
+  SNAP_TO_GOAL_CONFIG,
   NUMBER_OF_MPRIM_TYPES
 };
 }
@@ -34,10 +37,46 @@ class ActionSet
 
     bool init(EnvironmentROBARM3D *env);
 
+    /** @brief write the actions of parent into the buffer. It's cleared first
+     *  and doesn't allocate once it's large enough. Actions that would leave
+     *  the joint limits are never added */
+    bool getActionSet(const RobotState &parent, ActionBuffer &actions);
+
     bool getActionSet(const RobotState &parent, std::vector<Action> &actions);
 
+    /** @brief if deferred isn't NULL, the primitives that rarely lead
+     *  anywhere from the parent's region are skipped and their ids are
+     *  appended to it. false if there are no actions */
+    bool getActionSet(const RobotState &parent, ActionBuffer &actions, std::vector<int> *deferred);
+
+    /** @brief write the actions of just the primitives that were deferred */
+    bool getDeferredActionSet(const RobotState &parent, const std::vector<int> &mprim_ids, ActionBuffer &actions);
+
+    /** @brief region of the parent of the last getActionSet() call */
+    int getLastRegion() const { return last_region_; };
+
+    /** @brief record whether an action of a primitive passed the collision
+     *  checks from a parent in region */
+    void updatePrimitiveStats(int region, int mprim_id, bool accepted);
+
+    /** @brief record that a state made by a primitive was expanded */
+    void updatePrimitiveExpansion(int region, int mprim_id);
+
+    /** @brief forget the primitive statistics, they are kept per query */
+    void clearPrimitiveStats();
+
+    /** @brief on the coarse lattice the primitives are scaled and the
+     *  successor is snapped to multiples of bin_size (radians per joint) */
+    void setCoarseLattice(double mprim_scale, const std::vector<double> &bin_size);
+
+    /** @brief expand the following parents on the coarse or fine lattice */
+    void useCoarseLattice(bool coarse) { use_coarse_lattice_ = coarse && !coarse_bin_size_.empty(); };
+
     void print();
 
+    /** @brief forget the IK results, they are only valid for one goal */
+    void clearIKCache();
+
   private:
 
     bool use_multires_mprims_;
@@ -56,13 +95,109 @@ class ActionSet
 
     std::vector<std::string> motion_primitive_type_names_;
 
+    /* waypoints of all of the motion primitives back to back, the ones of
+     * primitive i start at mp_delta_offsets_[i] (-1 for the snap motions) */
+    int mp_num_joints_;
+    std::vector<double> mp_deltas_;
+    std::vector<int> mp_delta_offsets_;
+
+    /* reused by every expansion */
+    std::vector<double> pose_;
+    RobotState ik_seed_;
+    RobotState ik_solution_;
+    std::vector<int> ik_cache_key_;
+    ActionBuffer action_buffer_;
+
+    /* joint limits of the planning joints, a joint is unlimited if it's
+     * continuous or its range covers a whole turn */
+    bool use_limit_tables_;
+    std::vector<double> min_limits_;
+    std::vector<double> max_limits_;
+    std::vector<char> limited_;
+
+    /* range of deltas over the waypoints of a primitive for each limited
+     * joint it moves, the ones of primitive i are
+     * [mp_joint_motion_offsets_[i], mp_joint_motion_offsets_[i+1]) */
+    struct JointMotion
+    {
+      int joint;
+      double min_delta;
+      double max_delta;
+    };
+    std::vector<JointMotion> mp_joint_motions_;
+    std::vector<int> mp_joint_motion_offsets_;
+
+    /* coarse lattice */
+    bool use_coarse_lattice_;
+    double coarse_mprim_scale_;
+    std::vector<double> coarse_bin_size_;
+
+    /* the parent's angles moved into the limits, set in getActionSet() */
+    bool parent_in_limits_;
+    std::vector<double> parent_limit_angles_;
+    RobotState limit_check_state_;
+
+    struct IKCacheEntry
+    {
+      bool success;
+      RobotState solution;
+    };
+
+    /* IK results of the snap motions for ik_cache_goal_, keyed by the IK
+     * option followed by the seed discretized to ik_cache_resolution_ */
+    bool use_ik_cache_;
+    double ik_cache_resolution_;
+    std::vector<double> ik_cache_goal_;
+    boost::unordered_map<std::vector<int>, IKCacheEntry> ik_cache_;
+    int ik_cache_hits_;
+    int ik_cache_misses_;
+
+    struct PrimitiveStats
+    {
+      int attempts;
+      int accepted;
+      int expanded;
+    };
+
+    /* outcomes of each primitive in cubes of the planning link position, the
+     * stats of primitive i in region r are at r * mp_.size() + i. A
+     * primitive is deferred once it was tried min_stats_samples_ times and
+     * too few of its actions pass or too few of its successors get expanded */
+    double stats_region_size_m_;
+    int min_stats_samples_;
+    double min_acceptance_rate_;
+    double min_expansion_rate_;
+    int last_region_;
+    boost::unordered_map<int64_t, int> regions_;
+    std::vector<PrimitiveStats> mp_stats_;
+
     bool getMotionPrimitivesFromFile(FILE* fCfg);
 
     void addMotionPrim(const std::vector<double> &mprim, bool add_converse, bool short_dist_mprim);
 
-    bool applyMotionPrimitive(const RobotState &state, MotionPrimitive &mp, Action &action);
+    void buildPrimitiveDeltas();
+
+    void buildJointLimitTables();
+
+    inline bool isAngleInLimits(int joint, double angle) const;
+
+    bool isStateInLimits(const double *angles, int num_joints);
+
+    bool applyMotionPrimitive(const RobotState &state, const MotionPrimitive &mp, ActionBuffer &actions);
+
+    bool applyCoarseMotionPrimitive(const RobotState &state, const MotionPrimitive &mp, ActionBuffer &actions);
+
+    bool getAction(const RobotState &parent, double dist_to_goal, const MotionPrimitive &mp, ActionBuffer &actions);
+
+    bool setParent(const RobotState &parent, ActionBuffer &actions, double &dist_to_goal);
+
+    bool isPrimitiveInRange(const MotionPrimitive &mp, double dist_to_goal) const;
+
+    bool isPrimitiveDeferred(int region, const MotionPrimitive &mp) const;
+
+    int getRegion(double x, double y, double z);
 
-    bool getAction(const RobotState &parent, double dist_to_goal, MotionPrimitive &mp, Action &action);
+    bool computeIK(const std::vector<double> &goal, const RobotState &seed, int option, RobotState &solution);
 };
 
 }
@@ -48,6 +48,8 @@
 #include <sbpl_arm_planner/action_set.h>
 #include <sbpl_arm_planner/planning_params.h>
 #include <trajectory_msgs/JointTrajectory.h>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
 
 namespace sbpl_arm_planner {
 
@@ -97,6 +99,10 @@ typedef struct
   double dist;
   std::vector<int> coord;
   RobotState state;
+  int mprim_id;            // primitive that created the state, -1 once expanded
+  int mprim_region;        // region of the parent it was created from
+  int deferred_stateID;    // copy that expands the deferred primitives, -1 if none
+  std::vector<int> deferred_mprims; // only set on the copies
 } EnvROBARM3DHashEntry_t;
 
 /** main structure that stores environment data used in planning */
@@ -109,7 +115,33 @@ typedef struct EnvironmentPlanningData
 
   EnvROBARM3DHashEntry_t* goal_entry;
   EnvROBARM3DHashEntry_t* start_entry;
-  std::vector<std::vector<std::vector<KDL::Frame> > > frames;
+
+  // flat buffers for batch collision checking the successors
+  std::vector<double> batch_configs;
+  std::vector<int> batch_group_ends;
+  std::vector<unsigned char> batch_valid;
+  std::vector<double> batch_dist;
+
+  // the actions that passed the collision checks, the distance of their
+  // last check, and joint-major angles and poses for their batch FK
+  std::vector<int> batch_survivors;
+  std::vector<double> batch_survivor_dist;
+  std::vector<double> batch_fk_angles;
+  std::vector<double> batch_poses;
+
+  // actions of the state being expanded and their scratch waypoints
+  ActionBuffer actions;
+  RobotState waypoint;
+  RobotState prev_waypoint;
+  std::vector<int> deferred_mprims;
+
+  // coarse bins are coarse_lattice_factor_ fine bins, so a coarse state
+  // has the same coords on both levels
+  bool use_coarse_lattice;
+
+  // joint-space goals found with IK over the free angle, filled in by a
+  // worker thread that's started when the goal is set
+  std::vector<RobotState> goal_candidates;
 
   // maps from coords to stateID
   int HashTableSize;
@@ -124,6 +156,7 @@ typedef struct EnvironmentPlanningData
   EnvironmentPlanningData()
   {
     near_goal = false;
+    use_coarse_lattice = false;
     start_entry = NULL;
     goal_entry = NULL;
     Coord2StateIDHashTable = NULL;
@@ -172,10 +205,17 @@ class EnvironmentROBARM3D: public DiscreteSpaceInformation
     
     RobotModel* getRobotModel(){ return rmodel_; };
     CollisionChecker* getCollisionChecker(){ return cc_; };
-    std::vector<double> getGoal();
+    const std::vector<double>& getGoal();
     bool getGoalFA(double &fa);
     double getDistanceToGoal(double x, double y, double z);
 
+    /** @brief the goal candidate closest to from, false if none were found yet */
+    bool getNearestGoalCandidate(const RobotState &from, RobotState &goal_config);
+
+    /** @brief stop looking for goal candidates, the world mustn't change
+     *  while the worker is still checking them */
+    void stopGoalCandidates();
+
     visualization_msgs::MarkerArray getVisualization(std::string type);
 
   protected:
@@ -218,6 +258,17 @@ class EnvironmentROBARM3D: public DiscreteSpaceInformation
     /** distance */
     int getBFSCostToGoal(int x, int y, int z) const;
     virtual int getXYZHeuristic(int FromStateID, int ToStateID);
+
+    /** multi-resolution lattice */
+    void initCoarseLattice();
+    bool isCoarseState(EnvROBARM3DHashEntry_t* entry);
+
+    /** goal candidates */
+    boost::thread goal_ik_thread_;
+    boost::mutex goal_candidates_mutex_;
+    void startGoalCandidates();
+    void computeGoalCandidates(std::vector<double> pose, RobotState seed, int free_angle, std::vector<double> free_angles, boost::shared_ptr<RobotModelContext> rctx, boost::shared_ptr<CollisionCheckerContext> cctx);
+    bool addGoalCandidate(const RobotState &solution);
     double getEuclideanDistance(double x1, double y1, double z1, double x2, double y2, double z2) const;
 };
 
@@ -75,6 +75,20 @@ class PlanningParams
     double epsilon_;
     double planning_link_sphere_radius_;
 
+    /* Goal IK candidates */
+    bool use_goal_ik_candidates_;
+    double goal_ik_free_angle_step_;
+
+    /* Deferred motion primitives */
+    bool use_deferred_mprims_;
+    int deferred_mprim_cost_;
+
+    /* Multi-resolution lattice */
+    bool use_multires_lattice_;
+    int coarse_lattice_factor_;
+    double coarse_mprim_scale_;
+    double coarse_lattice_dist_m_;
+
     /* Discretization */
     std::vector<int> coord_vals_;
     std::vector<double> coord_delta_;
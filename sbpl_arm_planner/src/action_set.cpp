@@ -30,19 +30,48 @@
 
 #include <sbpl_arm_planner/action_set.h>
 #include <sbpl_arm_planner/environment_robarm3d.h>
+#include <algorithm>
 
 #define VERIFY_KINEMATICS false
 
 namespace sbpl_arm_planner {
 
+/* normalize_angle() for a normalized angle plus a primitive, one step is
+ * almost always enough */
+static inline double wrapAngle(double a)
+{
+  if(a >= M_PI)
+    a -= 2.0*M_PI;
+  else if(a < -M_PI)
+    a += 2.0*M_PI;
+
+  if(a >= M_PI || a < -M_PI)
+    return angles::normalize_angle(a);
+  return a;
+}
+
 ActionSet::ActionSet(std::string action_file)
 {
   env_ = NULL;
+  mp_num_joints_ = 0;
+  use_limit_tables_ = false;
+  parent_in_limits_ = false;
   use_multires_mprims_ = true;
   use_ik_ = true;
   short_dist_mprims_thresh_m_ = 0.2;
   ik_amp_dist_thresh_m_= 0.20;
   action_file_ = action_file;
+  use_ik_cache_ = true;
+  ik_cache_resolution_ = 0.05;
+  ik_cache_hits_ = 0;
+  ik_cache_misses_ = 0;
+  stats_region_size_m_ = 0.2;
+  min_stats_samples_ = 20;
+  min_acceptance_rate_ = 0.1;
+  min_expansion_rate_ = 0.02;
+  last_region_ = -1;
+  use_coarse_lattice_ = false;
+  coarse_mprim_scale_ = 1.0;
 
   motion_primitive_type_names_.push_back("long_distance");
   motion_primitive_type_names_.push_back("short_distance");
@@ -67,7 +96,11 @@ bool ActionSet::init(EnvironmentROBARM3D *env)
     return false;
   }
 
-  return getMotionPrimitivesFromFile(file);
+  if(!getMotionPrimitivesFromFile(file))
+    return false;
+
+  buildJointLimitTables();
+  return true;
 }
 
 bool ActionSet::getMotionPrimitivesFromFile(FILE* fCfg)
@@ -156,6 +189,129 @@ bool ActionSet::getMotionPrimitivesFromFile(FILE* fCfg)
   m.action.push_back(mprim);
   mp_.push_back(m);
 
+  m.type = sbpl_arm_planner::MotionPrimitiveType::SNAP_TO_GOAL_CONFIG;
+  m.group = 2;
+  m.id =  mp_.size();
+  m.action.push_back(mprim);
+  mp_.push_back(m);
+
+  buildPrimitiveDeltas();
+  return true;
+}
+
+void ActionSet::buildPrimitiveDeltas()
+{
+  mp_deltas_.clear();
+  mp_delta_offsets_.assign(mp_.size(), -1);
+  mp_num_joints_ = 0;
+  for(size_t i = 0; i < mp_.size(); ++i)
+  {
+    if(mp_[i].type != sbpl_arm_planner::MotionPrimitiveType::LONG_DISTANCE && mp_[i].type != sbpl_arm_planner::MotionPrimitiveType::SHORT_DISTANCE)
+      continue;
+
+    if(mp_num_joints_ == 0 && !mp_[i].action.empty())
+      mp_num_joints_ = mp_[i].action[0].size();
+
+    bool valid = true;
+    for(size_t j = 0; j < mp_[i].action.size(); ++j)
+    {
+      if(int(mp_[i].action[j].size()) != mp_num_joints_)
+        valid = false;
+    }
+    if(!valid)
+    {
+      ROS_WARN("Motion primitive %d doesn't have %d joints. It won't be used.", int(i), mp_num_joints_);
+      continue;
+    }
+
+    mp_delta_offsets_[i] = mp_deltas_.size();
+    for(size_t j = 0; j < mp_[i].action.size(); ++j)
+      mp_deltas_.insert(mp_deltas_.end(), mp_[i].action[j].begin(), mp_[i].action[j].end());
+  }
+}
+
+void ActionSet::buildJointLimitTables()
+{
+  use_limit_tables_ = false;
+  mp_joint_motions_.clear();
+  mp_joint_motion_offsets_.assign(mp_.size() + 1, 0);
+
+  std::vector<std::string> joints = env_->getRobotModel()->getPlanningJoints();
+  if(int(joints.size()) != mp_num_joints_)
+  {
+    ROS_WARN("The motion primitives have %d joints but there are %d planning joints. Joint limits will be checked the slow way.", mp_num_joints_, int(joints.size()));
+    return;
+  }
+
+  min_limits_.resize(joints.size());
+  max_limits_.resize(joints.size());
+  limited_.resize(joints.size());
+  parent_limit_angles_.resize(joints.size());
+  for(size_t j = 0; j < joints.size(); ++j)
+  {
+    bool continuous;
+    if(!env_->getRobotModel()->getPlanningJointLimits(joints[j], min_limits_[j], max_limits_[j], continuous))
+    {
+      ROS_WARN("Failed to get the limits of '%s'. Joint limits will be checked the slow way.", joints[j].c_str());
+      return;
+    }
+    limited_[j] = !continuous && (max_limits_[j] - min_limits_[j] < 2.0*M_PI);
+  }
+
+  for(size_t i = 0; i < mp_.size(); ++i)
+  {
+    mp_joint_motion_offsets_[i] = mp_joint_motions_.size();
+    if(mp_delta_offsets_[i] < 0)
+      continue;
+
+    const double *delta = &mp_deltas_[mp_delta_offsets_[i]];
+    for(int j = 0; j < mp_num_joints_; ++j)
+    {
+      if(!limited_[j])
+        continue;
+
+      JointMotion m;
+      m.joint = j;
+      m.min_delta = 0;
+      m.max_delta = 0;
+      for(size_t w = 0; w < mp_[i].action.size(); ++w)
+      {
+        m.min_delta = std::min(m.min_delta, delta[w*mp_num_joints_ + j]);
+        m.max_delta = std::max(m.max_delta, delta[w*mp_num_joints_ + j]);
+      }
+      if(m.min_delta != 0 || m.max_delta != 0)
+        mp_joint_motions_.push_back(m);
+    }
+  }
+  mp_joint_motion_offsets_[mp_.size()] = mp_joint_motions_.size();
+  use_limit_tables_ = true;
+}
+
+/* true if the angle is within the limits after adding some number of turns,
+ * like NormalizeAnglesIntoRange() does */
+inline bool ActionSet::isAngleInLimits(int joint, double angle) const
+{
+  if(angle >= min_limits_[joint] && angle <= max_limits_[joint])
+    return true;
+
+  double a = angle - min_limits_[joint];
+  a -= 2.0*M_PI*floor(a / (2.0*M_PI));
+  return min_limits_[joint] + a <= max_limits_[joint];
+}
+
+bool ActionSet::isStateInLimits(const double *angles, int num_joints)
+{
+  if(!use_limit_tables_ || num_joints != mp_num_joints_)
+  {
+    limit_check_state_.assign(angles, angles + num_joints);
+    return env_->getRobotModel()->checkJointLimits(limit_check_state_);
+  }
+
+  for(int j = 0; j < num_joints; ++j)
+  {
+    if(limited_[j] && !isAngleInLimits(j, angles[j]))
+      return false;
+  }
   return true;
 }
 
@@ -200,45 +356,105 @@ void ActionSet::print()
    mp_[i].print(); 
 }
 
-bool ActionSet::getActionSet(const RobotState &parent, std::vector<Action> &actions)
+bool ActionSet::getActionSet(const RobotState &parent, ActionBuffer &actions)
 {
-  std::vector<double> pose;
-  if(!env_->getRobotModel()->computePlanningLinkFK(parent, pose))
-    return false;
+  return getActionSet(parent, actions, NULL);
+}
 
-  // get distance to the goal pose
-  double d = env_->getDistanceToGoal(pose[0], pose[1], pose[2]);
+bool ActionSet::getActionSet(const RobotState &parent, ActionBuffer &actions, std::vector<int> *deferred)
+{
+  double d;
+  if(!setParent(parent, actions, d))
+    return false;
 
-  Action a;
   for(size_t i = 0; i < mp_.size(); ++i)
   {
-    if(getAction(parent, d, mp_[i], a))
-      actions.push_back(a);
+    if(deferred != NULL && isPrimitiveInRange(mp_[i], d) && isPrimitiveDeferred(last_region_, mp_[i]))
+    {
+      deferred->push_back(mp_[i].id);
+      continue;
+    }
+    getAction(parent, d, mp_[i], actions);
   }
 
-  if(actions.empty())
+  if(actions.getNumActions() == 0)
     return false;
 
   return true;
 }
 
-bool ActionSet::getAction(const RobotState &parent, double dist_to_goal, MotionPrimitive &mp, Action &action)
+bool ActionSet::getDeferredActionSet(const RobotState &parent, const std::vector<int> &mprim_ids, ActionBuffer &actions)
 {
-  std::vector<double> goal = env_->getGoal();
+  double d;
+  if(!setParent(parent, actions, d))
+    return false;
 
-  if(mp.type == sbpl_arm_planner::MotionPrimitiveType::LONG_DISTANCE)
+  for(size_t i = 0; i < mprim_ids.size(); ++i)
   {
-    if(dist_to_goal <= short_dist_mprims_thresh_m_ && use_multires_mprims_)
-      return false;
+    if(mprim_ids[i] >= 0 && mprim_ids[i] < int(mp_.size()))
+      getAction(parent, d, mp_[mprim_ids[i]], actions);
+  }
+
+  if(actions.getNumActions() == 0)
+    return false;
+
+  return true;
+}
+
+bool ActionSet::setParent(const RobotState &parent, ActionBuffer &actions, double &dist_to_goal)
+{
+  actions.clear(parent.size());
+  last_region_ = -1;
+  if(!env_->getRobotModel()->computePlanningLinkFK(parent, pose_))
+    return false;
+
+  // get distance to the goal pose
+  dist_to_goal = env_->getDistanceToGoal(pose_[0], pose_[1], pose_[2]);
+  last_region_ = getRegion(pose_[0], pose_[1], pose_[2]);
+
+  // margins of the parent to its joint limits for the primitive prefilter
+  parent_in_limits_ = use_limit_tables_ && int(parent.size()) == mp_num_joints_;
+  for(int j = 0; parent_in_limits_ && j < mp_num_joints_; ++j)
+  {
+    if(!limited_[j])
+      continue;
 
-    return applyMotionPrimitive(parent, mp, action);
+    double a = parent[j];
+    if(a < min_limits_[j] || a > max_limits_[j])
+    {
+      a -= min_limits_[j];
+      a = min_limits_[j] + a - 2.0*M_PI*floor(a / (2.0*M_PI));
+    }
+    parent_limit_angles_[j] = a;
+    if(a > max_limits_[j])
+      parent_in_limits_ = false;
   }
-  else if(mp.type == sbpl_arm_planner::MotionPrimitiveType::SHORT_DISTANCE)
+  return true;
+}
+
+bool ActionSet::getActionSet(const RobotState &parent, std::vector<Action> &actions)
+{
+  if(!getActionSet(parent, action_buffer_))
+    return false;
+
+  size_t n = actions.size();
+  actions.resize(n + action_buffer_.getNumActions());
+  for(int a = 0; a < action_buffer_.getNumActions(); ++a)
+    action_buffer_.getAction(a, actions[n + a]);
+  return true;
+}
+
+bool ActionSet::getAction(const RobotState &parent, double dist_to_goal, const MotionPrimitive &mp, ActionBuffer &actions)
+{
+  const std::vector<double> &goal = env_->getGoal();
+
+  if(mp.type == sbpl_arm_planner::MotionPrimitiveType::LONG_DISTANCE ||
+     mp.type == sbpl_arm_planner::MotionPrimitiveType::SHORT_DISTANCE)
   {
-    if(dist_to_goal > short_dist_mprims_thresh_m_ && use_multires_mprims_)
+    if(!isPrimitiveInRange(mp, dist_to_goal))
       return false;
-    
-    return applyMotionPrimitive(parent, mp, action);
+
+    return applyMotionPrimitive(parent, mp, actions);
   }
   else if(mp.type == sbpl_arm_planner::MotionPrimitiveType::SNAP_TO_XYZ_RPY)
   {
@@ -247,12 +463,11 @@ bool ActionSet::getAction(const RobotState &parent, double dist_to_goal, MotionP
 
     // set desired FA
     double fa;
-    RobotState desired_fa = parent;
+    ik_seed_ = parent;
     if(env_->getGoalFA(fa))
-      desired_fa[2] = fa;
+      ik_seed_[2] = fa;
 
-    action.resize(1);
-    if(!env_->getRobotModel()->computeIK(goal, desired_fa, action[0]))
+    if(!computeIK(goal, ik_seed_, sbpl_arm_planner::ik_option::UNRESTRICTED, ik_solution_))
     {
       ROS_DEBUG("IK failed. (dist_to_goal: %0.3f)  (goal: xyz: %0.3f %0.3f %0.3f rpy: %0.3f %0.3f %0.3f)", dist_to_goal, goal[0], goal[1], goal[2], goal[3], goal[4], goal[5]);
       return false;
@@ -265,17 +480,25 @@ bool ActionSet::getAction(const RobotState &parent, double dist_to_goal, MotionP
 
     // set desired FA 
     double fa;
-    RobotState desired_fa = parent;
+    ik_seed_ = parent;
     if(env_->getGoalFA(fa))
-      desired_fa[2] = fa;
+      ik_seed_[2] = fa;
 
-    action.resize(1);
-    if(!env_->getRobotModel()->computeIK(goal, desired_fa, action[0], sbpl_arm_planner::ik_option::RESTRICT_XYZ_JOINTS))
+    if(!computeIK(goal, ik_seed_, sbpl_arm_planner::ik_option::RESTRICT_XYZ_JOINTS, ik_solution_))
     {
       ROS_DEBUG("RPY-solver failed. (dist_to_goal: %0.3f)  (goal: xyz: %0.3f %0.3f %0.3f rpy: %0.3f %0.3f %0.3f)", dist_to_goal, goal[0], goal[1], goal[2], goal[3], goal[4], goal[5]);
       return false;
     }
   }
+  else if(mp.type == sbpl_arm_planner::MotionPrimitiveType::SNAP_TO_GOAL_CONFIG)
+  {
+    if(dist_to_goal > ik_amp_dist_thresh_m_)
+      return false;
+
+    // straight to the nearest joint-space goal found so far
+    if(!env_->getNearestGoalCandidate(parent, ik_solution_))
+      return false;
+  }
   else
   {
     ROS_ERROR("Motion Primitives of type '%d' are not supported.", mp.type);
@@ -284,7 +507,7 @@ bool ActionSet::getAction(const RobotState &parent, double dist_to_goal, MotionP
 
 #if VERIFY_KINEMATICS
   std::vector<double> p(6,0);
-  env_->getRobotModel()->computeFK(action[0], env_->getRobotModel()->getPlanningLink(), p);
+  env_->getRobotModel()->computeFK(ik_solution_, env_->getRobotModel()->getPlanningLink(), p);
   for(size_t i = 0; i < p.size(); ++i)
   {
     if(fabs(goal[i]-p[i]) > 0.0001)
@@ -297,22 +520,234 @@ bool ActionSet::getAction(const RobotState &parent, double dist_to_goal, MotionP
   }
 #endif
 
+  if(ik_solution_.size() != parent.size())
+    return false;
+
+  if(!isStateInLimits(&ik_solution_[0], ik_solution_.size()))
+    return false;
+
+  std::copy(ik_solution_.begin(), ik_solution_.end(), actions.addAction(mp.id, 1));
   return true;
 }
 
-bool ActionSet::applyMotionPrimitive(const RobotState &state, MotionPrimitive &mp, Action &action)
+bool ActionSet::isPrimitiveInRange(const MotionPrimitive &mp, double dist_to_goal) const
 {
-  action = mp.action;
-  for(size_t i = 0; i < action.size(); ++i)
+  if(!use_multires_mprims_)
+    return true;
+
+  if(mp.type == sbpl_arm_planner::MotionPrimitiveType::LONG_DISTANCE)
+    return dist_to_goal > short_dist_mprims_thresh_m_;
+  else if(mp.type == sbpl_arm_planner::MotionPrimitiveType::SHORT_DISTANCE)
+    return dist_to_goal <= short_dist_mprims_thresh_m_;
+  return true;
+}
+
+bool ActionSet::isPrimitiveDeferred(int region, const MotionPrimitive &mp) const
+{
+  // the snap motions go straight to the goal, they are always tried
+  if(region < 0 || (mp.type != sbpl_arm_planner::MotionPrimitiveType::LONG_DISTANCE &&
+                    mp.type != sbpl_arm_planner::MotionPrimitiveType::SHORT_DISTANCE))
+    return false;
+
+  const PrimitiveStats &s = mp_stats_[region * mp_.size() + mp.id];
+  if(s.attempts >= min_stats_samples_ && s.accepted < min_acceptance_rate_ * s.attempts)
+    return true;
+  if(s.accepted >= min_stats_samples_ && s.expanded < min_expansion_rate_ * s.accepted)
+    return true;
+  return false;
+}
+
+int ActionSet::getRegion(double x, double y, double z)
+{
+  int64_t rx = int64_t(floor(x / stats_region_size_m_)) & 0x1FFFFF;
+  int64_t ry = int64_t(floor(y / stats_region_size_m_)) & 0x1FFFFF;
+  int64_t rz = int64_t(floor(z / stats_region_size_m_)) & 0x1FFFFF;
+
+  std::pair<boost::unordered_map<int64_t, int>::iterator, bool> r = regions_.insert(std::make_pair((rx << 42) | (ry << 21) | rz, int(regions_.size())));
+  if(r.second)
   {
-    if(action[i].size() != state.size())
-      return false;
+    PrimitiveStats s = {0, 0, 0};
+    mp_stats_.resize(regions_.size() * mp_.size(), s);
+  }
+  return r.first->second;
+}
+
+void ActionSet::updatePrimitiveStats(int region, int mprim_id, bool accepted)
+{
+  if(region < 0 || region >= int(regions_.size()) || mprim_id < 0 || mprim_id >= int(mp_.size()))
+    return;
+
+  PrimitiveStats &s = mp_stats_[region * mp_.size() + mprim_id];
+  s.attempts++;
+  if(accepted)
+    s.accepted++;
+}
+
+void ActionSet::updatePrimitiveExpansion(int region, int mprim_id)
+{
+  if(region < 0 || region >= int(regions_.size()) || mprim_id < 0 || mprim_id >= int(mp_.size()))
+    return;
+
+  mp_stats_[region * mp_.size() + mprim_id].expanded++;
+}
+
+void ActionSet::clearPrimitiveStats()
+{
+  if(!regions_.empty())
+    ROS_DEBUG("Motion primitive stats: %d regions.", int(regions_.size()));
 
-    for(size_t j = 0; j < action[i].size(); ++j)
-      action[i][j] =  angles::normalize_angle(action[i][j] + state[j]);
+  regions_.clear();
+  mp_stats_.clear();
+  last_region_ = -1;
+}
+
+void ActionSet::setCoarseLattice(double mprim_scale, const std::vector<double> &bin_size)
+{
+  coarse_mprim_scale_ = mprim_scale;
+  coarse_bin_size_ = bin_size;
+  use_coarse_lattice_ = false;
+}
+
+void ActionSet::clearIKCache()
+{
+  if(ik_cache_hits_ + ik_cache_misses_ > 0)
+    ROS_DEBUG("IK cache: %d hits, %d misses, %d entries.", ik_cache_hits_, ik_cache_misses_, int(ik_cache_.size()));
+
+  ik_cache_.clear();
+  ik_cache_goal_.clear();
+  ik_cache_hits_ = 0;
+  ik_cache_misses_ = 0;
+}
+
+bool ActionSet::computeIK(const std::vector<double> &goal, const RobotState &seed, int option, RobotState &solution)
+{
+  if(!use_ik_cache_)
+    return env_->getRobotModel()->computeIK(goal, seed, solution, option);
+
+  // the entries are only good for the goal they were computed for
+  if(goal != ik_cache_goal_)
+  {
+    clearIKCache();
+    ik_cache_goal_ = goal;
+  }
+
+  std::vector<int> &key = ik_cache_key_;
+  key.resize(seed.size() + 1);
+  key[0] = option;
+  for(size_t i = 0; i < seed.size(); ++i)
+    key[i+1] = int(floor(angles::normalize_angle(seed[i]) / ik_cache_resolution_ + 0.5));
+
+  boost::unordered_map<std::vector<int>, IKCacheEntry>::const_iterator it = ik_cache_.find(key);
+  if(it != ik_cache_.end())
+  {
+    ik_cache_hits_++;
+    solution = it->second.solution;
+    return it->second.success;
+  }
+
+  ik_cache_misses_++;
+  IKCacheEntry &entry = ik_cache_[key];
+  entry.success = env_->getRobotModel()->computeIK(goal, seed, solution, option);
+  if(entry.success)
+    entry.solution = solution;
+  return entry.success;
+}
+
+bool ActionSet::applyMotionPrimitive(const RobotState &state, const MotionPrimitive &mp, ActionBuffer &actions)
+{
+  if(mp_delta_offsets_[mp.id] < 0 || int(state.size()) != mp_num_joints_)
+    return false;
+
+  if(use_coarse_lattice_)
+    return applyCoarseMotionPrimitive(state, mp, actions);
+
+  int num_values = mp.action.size() * mp_num_joints_;
+  const double *delta = &mp_deltas_[mp_delta_offsets_[mp.id]];
+
+  if(use_limit_tables_)
+  {
+    // if every joint the primitive moves stays inside its limits from the
+    // parent, all of the waypoints are fine. otherwise check the joints that
+    // get close before the action is written
+    bool within_margins = parent_in_limits_;
+    for(int k = mp_joint_motion_offsets_[mp.id]; within_margins && k < mp_joint_motion_offsets_[mp.id+1]; ++k)
+    {
+      const JointMotion &m = mp_joint_motions_[k];
+      if(parent_limit_angles_[m.joint] + m.max_delta > max_limits_[m.joint] ||
+         parent_limit_angles_[m.joint] + m.min_delta < min_limits_[m.joint])
+        within_margins = false;
+    }
+
+    if(!within_margins)
+    {
+      for(int k = mp_joint_motion_offsets_[mp.id]; k < mp_joint_motion_offsets_[mp.id+1]; ++k)
+      {
+        int j = mp_joint_motions_[k].joint;
+        for(int i = 0; i < num_values; i += mp_num_joints_)
+        {
+          if(!isAngleInLimits(j, state[j] + delta[i + j]))
+            return false;
+        }
+      }
+      // limited joints the primitive doesn't move keep the parent's angle
+      for(int j = 0; !parent_in_limits_ && j < mp_num_joints_; ++j)
+      {
+        if(limited_[j] && !isAngleInLimits(j, state[j]))
+          return false;
+      }
+    }
+  }
+
+  double *waypoints = actions.addAction(mp.id, mp.action.size());
+  for(int i = 0; i < num_values; i += mp_num_joints_)
+  {
+    for(int j = 0; j < mp_num_joints_; ++j)
+      waypoints[i + j] = wrapAngle(state[j] + delta[i + j]);
+  }
+
+  if(!use_limit_tables_)
+  {
+    for(int i = 0; i < num_values; i += mp_num_joints_)
+    {
+      if(!isStateInLimits(waypoints + i, mp_num_joints_))
+      {
+        actions.removeLastAction();
+        return false;
+      }
+    }
   }
   return true;
 }
 
+bool ActionSet::applyCoarseMotionPrimitive(const RobotState &state, const MotionPrimitive &mp, ActionBuffer &actions)
+{
+  if(int(coarse_bin_size_.size()) != mp_num_joints_)
+    return false;
+
+  int num_values = mp.action.size() * mp_num_joints_;
+  const double *delta = &mp_deltas_[mp_delta_offsets_[mp.id]];
+  double *waypoints = actions.addAction(mp.id, mp.action.size());
+  for(int i = 0; i < num_values; i += mp_num_joints_)
+  {
+    for(int j = 0; j < mp_num_joints_; ++j)
+      waypoints[i + j] = wrapAngle(state[j] + coarse_mprim_scale_ * delta[i + j]);
+  }
+
+  // the successor lands on a coarse bin
+  double *last = waypoints + num_values - mp_num_joints_;
+  for(int j = 0; j < mp_num_joints_; ++j)
+    last[j] = wrapAngle(coarse_bin_size_[j] * floor(last[j] / coarse_bin_size_[j] + 0.5));
+
+  // snapping can move a joint past its limit, so there are no margins to use
+  for(int i = 0; i < num_values; i += mp_num_joints_)
+  {
+    if(!isStateInLimits(waypoints + i, mp_num_joints_))
+    {
+      actions.removeLastAction();
+      return false;
+    }
+  }
+  return true;
+}
 
 }
@@ -597,7 +597,6 @@ bool EnvironmentCARTROBARM3D::setGoalPosition(const std::vector<std::vector<doub
 
   // push obstacles into bfs grid
   ros::WallTime start = ros::WallTime::now();
-  distance_field::PropagationDistanceField* df = grid_->getDistanceFieldPtr();
   int dimX, dimY, dimZ;
   grid_->getGridSize(dimX, dimY, dimZ);
 
@@ -605,7 +604,7 @@ bool EnvironmentCARTROBARM3D::setGoalPosition(const std::vector<std::vector<doub
   for (int z = 0; z < dimZ - 2; z++)
     for (int y = 0; y < dimY - 2; y++)
       for (int x = 0; x < dimX - 2; x++)
-        if (df->getDistanceFromCell(x,y,z) <= heuristic_sphere_)
+        if (grid_->getDistance(x,y,z) <= heuristic_sphere_)
         {
           bfs_->setWall(x + 1, y + 1, z + 1);
           walls++;
@@ -1197,7 +1196,7 @@ void EnvironmentCARTROBARM3D::getAdaptiveMotionPrim(int type, EnvROBARM3DHashEnt
   {
     int x,y,z;
     std::vector<int> icoord(ndof_,0);
-    if(!getDistanceGradient(x,y,z))
+    if(!getDistanceGradient(parent,x,y,z))
       ROS_ERROR("I shouldn't be here...");
 
     // get xyz for retracted pose
@@ -1250,7 +1249,7 @@ void EnvironmentCARTROBARM3D::getAdaptiveMotionPrim(int type, EnvROBARM3DHashEnt
   {
     int x,y,z;
     std::vector<int> icoord(ndof_,0);
-    if(!getDistanceGradient(x,y,z))
+    if(!getDistanceGradient(parent,x,y,z))
       ROS_ERROR("I shouldn't be here...");
 
     // get xyz for retracted pose
@@ -1284,7 +1283,7 @@ void EnvironmentCARTROBARM3D::getAdaptiveMotionPrim(int type, EnvROBARM3DHashEnt
     /*
     int x,y,z;
     std::vector<int> icoord(ndof_,0);
-    if(!getDistanceGradient(x,y,z))
+    if(!getDistanceGradient(parent,x,y,z))
       ROS_ERROR("I shouldn't be here...");
 
     // get xyz for retracted pose
@@ -1461,7 +1460,7 @@ bool EnvironmentCARTROBARM3D::getMotionPrimitive(EnvROBARM3DHashEntry_t* parent,
     if(parent->heur > prms_.cost_per_cell_ * 20)
       return false;
     int x, y, z;
-    if(!getDistanceGradient(x,y,z))
+    if(!getDistanceGradient(parent,x,y,z))
       return false;
     getAdaptiveMotionPrim(RETRACT_THEN_SNAP_TO_RPY_THEN_TO_XYZ, parent, mp);
   }
@@ -1476,7 +1475,7 @@ bool EnvironmentCARTROBARM3D::getMotionPrimitive(EnvROBARM3DHashEntry_t* parent,
     }
 
     int x,y,z;
-    if(!getDistanceGradient(x,y,z))
+    if(!getDistanceGradient(parent,x,y,z))
     {
       ROS_ERROR("Zero GRadient");
       return false;
@@ -1487,7 +1486,7 @@ bool EnvironmentCARTROBARM3D::getMotionPrimitive(EnvROBARM3DHashEntry_t* parent,
     if(parent->heur > prms_.cost_per_cell_ * 40)
       return false;
     int x, y, z;
-    if(!getDistanceGradient(x,y,z))
+    if(!getDistanceGradient(parent,x,y,z))
       return false;
     if(parent->heur > prms_.cost_per_cell_ * 5)
       getAdaptiveMotionPrim(RETRACT_THEN_TOWARDS_RPY_THEN_TOWARDS_XYZ, parent, mp);
@@ -1566,8 +1565,10 @@ void EnvironmentCARTROBARM3D::getVector(int x1, int y1, int z1, int x2, int y2,
   ROS_DEBUG("dx: %1.2f dy: %1.2f dz: %1.2f length: %1.2f multiplier: %d unit_double{%1.2f %1.2f %1.2f}  unit_int{%d %d %d}", dx, dy, dz, length, multiplier, dx/length, dy/length, dz/length, xout, yout, zout);
 }
 
-bool EnvironmentCARTROBARM3D::getDistanceGradient(int &x, int &y, int &z)
+bool EnvironmentCARTROBARM3D::getDistanceGradient(EnvROBARM3DHashEntry_t* state, int &x, int &y, int &z)
 {
+  // difference the distances after the xyz motion primitives. these decide
+  // whether there is anything to retract from
   mp_gradient_[0] = mp_dist_[0] - mp_dist_[1];
   mp_gradient_[1] = mp_dist_[2] - mp_dist_[3];
   mp_gradient_[2] = mp_dist_[4] - mp_dist_[5];
@@ -1594,6 +1595,40 @@ bool EnvironmentCARTROBARM3D::getDistanceGradient(int &x, int &y, int &z)
   if(mp_gradient_[0] == 0 && mp_gradient_[1] == 0 && mp_gradient_[2] == 0)
     return false;
 
+  // retract along the distance field gradient at the sphere of the arm
+  // that is closest to an obstacle, when there is one there
+  std::vector<std::vector<double> > spheres;
+  if(cc_->getCollisionSpheres(state->angles, spheres) && !spheres.empty())
+  {
+    std::vector<Eigen::Vector3d> centers(spheres.size());
+    std::vector<double> distances;
+    std::vector<Eigen::Vector3d> gradients;
+    for(size_t i = 0; i < spheres.size(); ++i)
+      centers[i] = Eigen::Vector3d(spheres[i][0], spheres[i][1], spheres[i][2]);
+    grid_->getDistancesAndGradients(centers, distances, gradients);
+
+    size_t closest = 0;
+    for(size_t i = 1; i < spheres.size(); ++i)
+    {
+      if(distances[i] - spheres[i][3] < distances[closest] - spheres[closest][3])
+        closest = i;
+    }
+
+    Eigen::Vector3d gradient = gradients[closest];
+    if(gradient.norm() > 1e-3)
+    {
+      gradient.normalize();
+      mp_gradient_[0] = gradient(0);
+      mp_gradient_[1] = gradient(1);
+      mp_gradient_[2] = gradient(2);
+      x = int(floor(gradient(0) * 100 + 0.5));
+      y = int(floor(gradient(1) * 100 + 0.5));
+      z = int(floor(gradient(2) * 100 + 0.5));
+      ROS_DEBUG_NAMED(prms_.expands_log_, "[env] distance field gradient at sphere %d: %0.2f %0.2f %0.2f", int(closest), gradient(0), gradient(1), gradient(2));
+      return true;
+    }
+  }
+
   //ROS_INFO("[env] dist:  %2.2f %2.2f %2.2f %2.2f %2.2f %2.2f  (%s)", mp_dist_[0], mp_dist_[1], mp_dist_[2], mp_dist_[3], mp_dist_[4], mp_dist_[5], cspace_->collision_name_.c_str());      
   double norm = sqrt(mp_gradient_[0]*mp_gradient_[0] + mp_gradient_[1]*mp_gradient_[1] + mp_gradient_[2]*mp_gradient_[2]);
   ROS_INFO("[env] gradient_x: %2.2f   gradient_y: %2.2f   gradient_z: %2.2f  norm: %2.2f", mp_gradient_[0], mp_gradient_[1], mp_gradient_[2], norm);
@@ -31,6 +31,7 @@
 #include <sbpl_arm_planner/environment_robarm3d.h>
 //#include <bfs3d/BFS_Util.hpp>
 #include <leatherman/viz.h>
+#include <boost/bind.hpp>
 
 #define DEG2RAD(d) ((d)*(M_PI/180.0))
 #define RAD2DEG(r) ((r)*(180.0/M_PI))
@@ -52,6 +53,8 @@ EnvironmentROBARM3D::EnvironmentROBARM3D(OccupancyGrid *grid, RobotModel *rmodel
 
 EnvironmentROBARM3D::~EnvironmentROBARM3D()
 {
+  stopGoalCandidates();
+
   if(bfs_ != NULL)
     delete bfs_;
 
@@ -176,56 +179,94 @@ void EnvironmentROBARM3D::GetSuccs(int SourceStateID, vector<int>* SuccIDV, vect
 
   ROS_DEBUG_NAMED(prm_->expands_log_, "\nstate %d: %.2f %.2f %.2f %.2f %.2f %.2f %.2f  endeff: %3d %3d %3d",SourceStateID, source_angles[0],source_angles[1],source_angles[2],source_angles[3],source_angles[4],source_angles[5],source_angles[6], parent_entry->xyz[0],parent_entry->xyz[1],parent_entry->xyz[2]);
  
+  // far from the goal, expand onto the coarse lattice
+  bool coarse = isCoarseState(parent_entry);
+  as_->useCoarseLattice(coarse);
+
   int valid = 1;
-  std::vector<Action> actions;
-  if(!as_->getActionSet(source_angles, actions))
+  bool got_actions;
+  ActionBuffer &actions = pdata_.actions;
+  std::vector<int> &deferred = pdata_.deferred_mprims;
+  deferred.clear();
+  if(!parent_entry->deferred_mprims.empty())
+    got_actions = as_->getDeferredActionSet(source_angles, parent_entry->deferred_mprims, actions);
+  else
+    got_actions = as_->getActionSet(source_angles, actions, prm_->use_deferred_mprims_ ? &deferred : NULL);
+
+  if(!got_actions && deferred.empty())
   {
     ROS_WARN("Failed to get successors.");
     return;
   }
+  int region = as_->getLastRegion();
 
-  ROS_DEBUG_NAMED(prm_->expands_log_, "[parent: %d] angles: %0.3f %0.3f %0.3f %0.3f %0.3f %0.3f %0.3f  xyz: %3d %3d %3d  #_actions: %d  heur: %d dist: %0.3f", SourceStateID, source_angles[0],source_angles[1],source_angles[2],source_angles[3],source_angles[4],source_angles[5],source_angles[6], parent_entry->xyz[0],parent_entry->xyz[1],parent_entry->xyz[2], int(actions.size()), getXYZHeuristic(SourceStateID, 1), double(bfs_->getDistance(parent_entry->xyz[0],parent_entry->xyz[1], parent_entry->xyz[2])) * grid_->getResolution());
+  // the primitive that made this state led somewhere useful
+  if(parent_entry->mprim_id >= 0)
+  {
+    as_->updatePrimitiveExpansion(parent_entry->mprim_region, parent_entry->mprim_id);
+    parent_entry->mprim_id = -1;
+  }
 
-  // check actions for validity
-  for (int i = 0; i < int(actions.size()); ++i)
+  int num_actions = actions.getNumActions();
+  ROS_DEBUG_NAMED(prm_->expands_log_, "[parent: %d] angles: %0.3f %0.3f %0.3f %0.3f %0.3f %0.3f %0.3f  xyz: %3d %3d %3d  #_actions: %d  heur: %d dist: %0.3f", SourceStateID, source_angles[0],source_angles[1],source_angles[2],source_angles[3],source_angles[4],source_angles[5],source_angles[6], parent_entry->xyz[0],parent_entry->xyz[1],parent_entry->xyz[2], num_actions, getXYZHeuristic(SourceStateID, 1), double(bfs_->getDistance(parent_entry->xyz[0],parent_entry->xyz[1], parent_entry->xyz[2])) * grid_->getResolution());
+
+  // the action set only returns actions within the joint limits, gather
+  // their waypoints so they can be collision checked in one batch. The
+  // waypoints of an action are a group, so the check stops at the first
+  // one in collision
+  RobotState &waypoint = pdata_.waypoint, &prev_waypoint = pdata_.prev_waypoint;
+  std::vector<int> &group_ends = pdata_.batch_group_ends;
+  group_ends.resize(num_actions);
+  pdata_.batch_configs.clear();
+  for (int i = 0; i < num_actions; ++i)
+  {
+    pdata_.batch_configs.insert(pdata_.batch_configs.end(), actions.getWaypoint(i, 0), actions.getLastWaypoint(i) + prm_->num_joints_);
+    group_ends[i] = pdata_.batch_configs.size() / prm_->num_joints_;
+  }
+
+  size_t num_configs = pdata_.batch_configs.size() / prm_->num_joints_;
+  pdata_.batch_valid.resize(num_configs);
+  pdata_.batch_dist.resize(num_configs);
+  if(num_configs > 0)
+    cc_->isStatesValid(&pdata_.batch_configs[0], prm_->num_joints_, &group_ends[0], num_actions, prm_->verbose_collisions_, &pdata_.batch_valid[0], &pdata_.batch_dist[0]);
+
+  // check actions for validity, the ones that pass are kept with the
+  // distance of their last check
+  std::vector<int> &survivors = pdata_.batch_survivors;
+  std::vector<double> &survivor_dist = pdata_.batch_survivor_dist;
+  survivors.clear();
+  survivor_dist.clear();
+  size_t config = 0;
+  for (int i = 0; i < num_actions; ++i)
   {
     valid = 1;
-    for(size_t j = 0; j < actions[i].size(); ++j)
+    for(int j = 0; j < actions.getNumWaypoints(i); ++j, ++config)
     {
-      ROS_DEBUG_NAMED(prm_->expands_log_, "[ succ: %d] angles: %0.3f %0.3f %0.3f %0.3f %0.3f %0.3f  %0.3f", i, actions[i][j][0], actions[i][j][1], actions[i][j][2], actions[i][j][3], actions[i][j][4], actions[i][j][5], actions[i][j][6]);
-
-      // check joint limits
-      if(!rmodel_->checkJointLimits(actions[i][j]))
-        valid = -1;
+      const double *w = actions.getWaypoint(i, j);
+      ROS_DEBUG_NAMED(prm_->expands_log_, "[ succ: %d] angles: %0.3f %0.3f %0.3f %0.3f %0.3f %0.3f  %0.3f", i, w[0], w[1], w[2], w[3], w[4], w[5], w[6]);
 
-      //check for collisions
-      if(!cc_->isStateValid(actions[i][j], pdata_.frames, prm_->verbose_collisions_, false, dist))
+      dist = pdata_.batch_dist[config];
+      if(valid == 1 && !pdata_.batch_valid[config])
       {
         ROS_DEBUG_NAMED(prm_->expands_log_, " succ: %2d  dist: %0.3f is in collision.", i, dist);
         valid = -2;
       }
-
-      if(valid < 1)
-        break;
     }
 
-    if(valid < 1)
-      continue;
-
     // check for collisions along path from parent to first waypoint
-    if(!cc_->isStateToStateValid(source_angles, actions[i][0], pdata_.frames, path_length, nchecks, dist))
+    waypoint.assign(actions.getWaypoint(i, 0), actions.getWaypoint(i, 0) + prm_->num_joints_);
+    if(valid == 1 && !cc_->isStateToStateValid(source_angles, waypoint, path_length, nchecks, dist))
     {
       ROS_DEBUG_NAMED(prm_->expands_log_, " succ: %2d  dist: %0.3f is in collision along interpolated path. (path_length: %d)", i, dist, path_length);
       valid = -3;
     }
 
-    if(valid < 1)
-      continue;
-
     // check for collisions between waypoints
-    for(size_t j = 1; j < actions[i].size(); ++j)
+    for(int j = 1; valid == 1 && j < actions.getNumWaypoints(i); ++j)
     {
-      if(!cc_->isStateToStateValid(actions[i][j-1], actions[i][j], pdata_.frames, path_length, nchecks, dist))
+      prev_waypoint.swap(waypoint);
+      waypoint.assign(actions.getWaypoint(i, j), actions.getWaypoint(i, j) + prm_->num_joints_);
+      if(!cc_->isStateToStateValid(prev_waypoint, waypoint, path_length, nchecks, dist))
       {
         ROS_DEBUG_NAMED(prm_->expands_log_, " succ: %2d  dist: %0.3f is in collision along interpolated path. (path_length: %d)", i, dist, path_length);
         valid = -4;
@@ -233,24 +274,60 @@ void EnvironmentROBARM3D::GetSuccs(int SourceStateID, vector<int>* SuccIDV, vect
       }
     }
 
-    if(valid < 1)
-      continue;
+    // keep track of which primitives get through in this region
+    as_->updatePrimitiveStats(region, actions.getPrimitiveId(i), valid == 1);
+
+    if(valid == 1)
+    {
+      survivors.push_back(i);
+      survivor_dist.push_back(dist);
+    }
+  }
+
+  // planning link poses of the last waypoints of the valid actions, in one
+  // batch
+  int num_survivors = survivors.size();
+  pdata_.batch_fk_angles.resize(num_survivors * prm_->num_joints_);
+  pdata_.batch_poses.resize(num_survivors * 6);
+  for(int s = 0; s < num_survivors; ++s)
+  {
+    const double *last = actions.getLastWaypoint(survivors[s]);
+    for(int j = 0; j < prm_->num_joints_; ++j)
+      pdata_.batch_fk_angles[j*num_survivors + s] = last[j];
+  }
+  bool batch_fk_valid = (num_survivors > 0) && rmodel_->computePlanningLinkFKs(&pdata_.batch_fk_angles[0], num_survivors, &pdata_.batch_poses[0]);
+
+  for (int s = 0; s < num_survivors; ++s)
+  {
+    int i = survivors[s];
+    dist = survivor_dist[s];
+
+    // the last waypoint is the successor
+    waypoint.assign(actions.getLastWaypoint(i), actions.getLastWaypoint(i) + prm_->num_joints_);
 
     // compute coords
-    anglesToCoord(actions[i].back(), scoord);
+    anglesToCoord(waypoint, scoord);
+
+    // snapped back onto the parent
+    if(scoord == parent_entry->coord)
+      continue;
 
     // get the successor
     EnvROBARM3DHashEntry_t* succ_entry;
     bool succ_is_goal_state = false;
 
-    // get pose of planning link
-    if(!rmodel_->computePlanningLinkFK(actions[i].back(), pose))
+    // get pose of planning link, one at a time if the batch failed
+    if(batch_fk_valid)
+    {
+      for(int k = 0; k < 6; ++k)
+        pose[k] = pdata_.batch_poses[k*num_survivors + s];
+    }
+    else if(!rmodel_->computePlanningLinkFK(waypoint, pose))
       continue;
 
     // discretize planning link pose
     grid_->worldToGrid(pose[0],pose[1],pose[2],endeff[0],endeff[1],endeff[2]);
    
-    //ROS_DEBUG_NAMED(prm_->expands_log_, "[ succ: %d] %0.3f %0.3f %0.3f %0.3f %0.3f %0.3f %0.3f", int(i), actions[i].back()[0], actions[i].back()[1], actions[i].back()[2], actions[i].back()[3], actions[i].back()[4], actions[i].back()[5], actions[i].back()[6]);
     ROS_DEBUG_NAMED(prm_->expands_log_, "[ succ: %d]   pose: %0.3f %0.3f %0.3f   %0.3f %0.3f %0.3f", int(i), pose[0], pose[1], pose[2], pose[3], pose[4], pose[5]);
     ROS_DEBUG_NAMED(prm_->expands_log_, "[ succ: %d]    xyz: %d %d %d  goal: %d %d %d  (diff: %d %d %d)", int(i), endeff[0], endeff[1], endeff[2], pdata_.goal_entry->xyz[0], pdata_.goal_entry->xyz[1], pdata_.goal_entry->xyz[2], abs(pdata_.goal_entry->xyz[0] - endeff[0]), abs(pdata_.goal_entry->xyz[1] - endeff[1]), abs(pdata_.goal_entry->xyz[2] - endeff[2]));
 
@@ -265,7 +342,7 @@ void EnvironmentROBARM3D::GetSuccs(int SourceStateID, vector<int>* SuccIDV, vect
       pdata_.goal_entry->xyz[0] = endeff[0];
       pdata_.goal_entry->xyz[1] = endeff[1];
       pdata_.goal_entry->xyz[2] = endeff[2];
-      pdata_.goal_entry->state = actions[i].back();
+      pdata_.goal_entry->state = waypoint;
       pdata_.goal_entry->dist = dist;
     }
 
@@ -273,15 +350,42 @@ void EnvironmentROBARM3D::GetSuccs(int SourceStateID, vector<int>* SuccIDV, vect
     if((succ_entry = getHashEntry(scoord, succ_is_goal_state)) == NULL)
     {
       succ_entry = createHashEntry(scoord, endeff);
-      succ_entry->state = actions[i].back();
+      succ_entry->state = waypoint;
       succ_entry->dist = dist;
+      succ_entry->mprim_id = actions.getPrimitiveId(i);
+      succ_entry->mprim_region = region;
 
       ROS_DEBUG_NAMED(prm_->expands_log_, "%5i: action: %2d dist: %2d edge_distance_cost: %5d heur: %2d endeff: %3d %3d %3d", succ_entry->stateID, i, int(succ_entry->dist), cost(parent_entry,succ_entry, succ_is_goal_state), GetFromToHeuristic(succ_entry->stateID, pdata_.goal_entry->stateID), succ_entry->xyz[0],succ_entry->xyz[1],succ_entry->xyz[2]);
     }
 
     //put successor on successor list with the proper cost
     SuccIDV->push_back(succ_entry->stateID);
-    CostV->push_back(cost(parent_entry, succ_entry, succ_is_goal_state));
+    if(coarse)
+      CostV->push_back(int(cost(parent_entry, succ_entry, succ_is_goal_state) * prm_->coarse_mprim_scale_));
+    else
+      CostV->push_back(cost(parent_entry, succ_entry, succ_is_goal_state));
+  }
+
+  // the skipped primitives are applied when a copy of this state is
+  // expanded. it costs more to reach, so it only comes off the open list if
+  // the search can't make progress without them
+  if(!deferred.empty())
+  {
+    EnvROBARM3DHashEntry_t* deferred_entry;
+    if(parent_entry->deferred_stateID < 0)
+    {
+      deferred_entry = createHashEntry(parent_entry->coord, parent_entry->xyz);
+      deferred_entry->state = parent_entry->state;
+      deferred_entry->dist = parent_entry->dist;
+      parent_entry->deferred_stateID = deferred_entry->stateID;
+    }
+    else
+      deferred_entry = pdata_.StateID2CoordTable[parent_entry->deferred_stateID];
+
+    deferred_entry->deferred_mprims = deferred;
+    SuccIDV->push_back(deferred_entry->stateID);
+    CostV->push_back(prm_->deferred_mprim_cost_);
+    ROS_DEBUG_NAMED(prm_->expands_log_, "%5i: deferred %d primitives to state %d.", SourceStateID, int(deferred.size()), deferred_entry->stateID);
   }
 
   pdata_.expanded_states.push_back(SourceStateID);
@@ -362,6 +466,10 @@ EnvROBARM3DHashEntry_t* EnvironmentROBARM3D::getHashEntry(const std::vector<int>
   {
     int j = 0;
 
+    // the copies that expand deferred primitives share the coords
+    if(!pdata_.Coord2StateIDHashTable[binid][ind]->deferred_mprims.empty())
+      continue;
+
     for(j = 0; j < int(coord.size()); j++)
     {
       if(pdata_.Coord2StateIDHashTable[binid][ind]->coord[j] != coord[j]) 
@@ -384,6 +492,10 @@ EnvROBARM3DHashEntry_t* EnvironmentROBARM3D::createHashEntry(const std::vector<i
 
   memcpy(HashEntry->xyz, endeff, 3*sizeof(int));
 
+  HashEntry->mprim_id = -1;
+  HashEntry->mprim_region = -1;
+  HashEntry->deferred_stateID = -1;
+
   // assign a stateID to HashEntry to be used 
   HashEntry->stateID = pdata_.StateID2CoordTable.size();
 
@@ -440,6 +552,8 @@ bool EnvironmentROBARM3D::initEnvironment()
   //set heuristic function pointer
   getHeuristic_ = &sbpl_arm_planner::EnvironmentROBARM3D::getXYZHeuristic;
 
+  initCoarseLattice();
+
   //set 'environment is initialized' flag
   prm_->ready_to_plan_ = true; 
   ROS_INFO("[env] Environment has been initialized.");
@@ -551,14 +665,14 @@ bool EnvironmentROBARM3D::setStartConfiguration(const std::vector<double> angles
     ROS_WARN("Starting configuration violates the joint limits. Attempting to plan anyway.");
 
   //check if the start configuration is in collision but plan anyway
-  pdata_.frames.clear(); 
-  if(!cc_->isStateValid(angles, pdata_.frames, true, false, dist))
+  if(!cc_->isStateValid(angles, true, false, dist))
   {
     ROS_WARN("[env] The starting configuration is in collision. Attempting to plan anyway. (distance to nearest obstacle %0.2fm)", double(dist)*grid_->getResolution());
   }
 
   //get arm position in environment
   anglesToCoord(angles, pdata_.start_entry->coord);
+  pdata_.start_entry->state = angles;
   grid_->worldToGrid(pose[0],pose[1],pose[2],x,y,z);
   pdata_.start_entry->xyz[0] = (int)x;
   pdata_.start_entry->xyz[1] = (int)y;
@@ -644,6 +758,11 @@ bool EnvironmentROBARM3D::setGoalPosition(const std::vector <std::vector<double>
   bfs_->run(pdata_.goal_entry->xyz[0], pdata_.goal_entry->xyz[1], pdata_.goal_entry->xyz[2]);
   //bfs_->configure(pdata_.goal_entry->xyz[0], pdata_.goal_entry->xyz[1], pdata_.goal_entry->xyz[2]);
 
+  // IK results near the old goal don't apply anymore
+  as_->clearIKCache();
+  as_->clearPrimitiveStats();
+  startGoalCandidates();
+
   pdata_.near_goal = false; 
   pdata_.expanded_states.clear();
   pdata_.t_start = clock();
@@ -781,16 +900,21 @@ bool EnvironmentROBARM3D::convertStateIDPathToJointTrajectory(const std::vector<
 
   traj.header.frame_id = prm_->planning_frame_;
   traj.joint_names = prm_->planning_joints_;
-  traj.points.resize(idpath.size());
+  traj.points.clear();
   
   std::vector<double> angles;
   for(size_t i = 0; i < idpath.size(); ++i)
   {
-    traj.points[i].positions.resize(prm_->num_joints_);
+    // a deferred copy repeats the state before it
+    if(!pdata_.StateID2CoordTable[idpath[i]]->deferred_mprims.empty())
+      continue;
+
+    traj.points.resize(traj.points.size() + 1);
+    traj.points.back().positions.resize(prm_->num_joints_);
     StateID2Angles(idpath[i], angles);
 
     for (int p = 0; p < prm_->num_joints_; ++p)
-      traj.points[i].positions[p] = angles::normalize_angle(angles[p]); 
+      traj.points.back().positions[p] = angles::normalize_angle(angles[p]); 
   }
 
   return true;
@@ -810,7 +934,165 @@ double EnvironmentROBARM3D::getDistanceToGoal(double x, double y, double z)
   return dist;
 }
 
-std::vector<double> EnvironmentROBARM3D::getGoal()
+void EnvironmentROBARM3D::initCoarseLattice()
+{
+  pdata_.use_coarse_lattice = false;
+  if(!prm_->use_multires_lattice_)
+    return;
+
+  if(prm_->coarse_lattice_factor_ < 1 || prm_->coarse_mprim_scale_ <= 0)
+  {
+    ROS_ERROR("The coarse lattice needs a factor of at least 1 and a positive primitive scale. (factor: %d  scale: %0.2f)", prm_->coarse_lattice_factor_, prm_->coarse_mprim_scale_);
+    return;
+  }
+
+  // every coarse bin has to be a fine bin so the hashing is the same on
+  // both levels, including where the angles wrap around
+  std::vector<double> bin_size(prm_->num_joints_, 0);
+  for(int i = 0; i < prm_->num_joints_; ++i)
+  {
+    if(prm_->coord_vals_[i] % prm_->coarse_lattice_factor_ != 0)
+    {
+      ROS_ERROR("Joint %d has %d bins, which isn't a multiple of the coarse lattice factor %d. Not using the coarse lattice.", i, prm_->coord_vals_[i], prm_->coarse_lattice_factor_);
+      return;
+    }
+    bin_size[i] = prm_->coarse_lattice_factor_ * prm_->coord_delta_[i];
+  }
+
+  as_->setCoarseLattice(prm_->coarse_mprim_scale_, bin_size);
+  pdata_.use_coarse_lattice = true;
+  ROS_INFO("[env] Using a coarse lattice of %d bins per joint beyond %0.2fm from the goal.", prm_->coord_vals_[0] / prm_->coarse_lattice_factor_, prm_->coarse_lattice_dist_m_);
+}
+
+bool EnvironmentROBARM3D::isCoarseState(EnvROBARM3DHashEntry_t* entry)
+{
+  if(!pdata_.use_coarse_lattice)
+    return false;
+
+  double x, y, z;
+  grid_->gridToWorld(entry->xyz[0], entry->xyz[1], entry->xyz[2], x, y, z);
+  return getDistanceToGoal(x, y, z) > prm_->coarse_lattice_dist_m_;
+}
+
+void EnvironmentROBARM3D::startGoalCandidates()
+{
+  stopGoalCandidates();
+  pdata_.goal_candidates.clear();
+
+  if(!prm_->use_goal_ik_candidates_ || pdata_.goal.type < GoalType::XYZ_RPY_GOAL || int(pdata_.start_entry->state.size()) < prm_->num_joints_)
+    return;
+
+  // seeds over the robot model's free angle. without one, IK is only
+  // seeded with the start state
+  int free_angle = rmodel_->getRedundantJointIndex();
+  std::vector<double> free_angles;
+  if(free_angle < 0 || free_angle >= prm_->num_joints_)
+  {
+    free_angle = -1;
+    free_angles.push_back(0);
+  }
+  else if(pdata_.goal.type == GoalType::XYZ_RPY_FA_GOAL)
+    free_angles.push_back(pdata_.goal.free_angle);
+  else
+  {
+    for(double fa = -M_PI; fa < M_PI; fa += prm_->goal_ik_free_angle_step_)
+      free_angles.push_back(fa);
+  }
+
+  // the search keeps using the models' own contexts, so the worker gets its
+  // own. A collision context made for another thread never reads the
+  // occupancy bitmaps, which the search rebuilds whenever the grid changed.
+  // without a collision context, find them all before the search starts
+  boost::shared_ptr<RobotModelContext> rctx(rmodel_->createContext());
+  boost::shared_ptr<CollisionCheckerContext> cctx(cc_->createContext());
+  if(!cctx)
+  {
+    double dist = 0;
+    RobotState seed = pdata_.start_entry->state, solution;
+    for(size_t i = 0; i < free_angles.size(); ++i)
+    {
+      if(free_angle >= 0)
+        seed[free_angle] = free_angles[i];
+      if(rmodel_->computeIK(pdata_.goal.pose, seed, solution) && rmodel_->checkJointLimits(solution) && cc_->isStateValid(solution, false, false, dist))
+        addGoalCandidate(solution);
+    }
+    ROS_INFO("[env] Found %d joint-space goals with %d IK seeds.", int(pdata_.goal_candidates.size()), int(free_angles.size()));
+    return;
+  }
+
+  goal_ik_thread_ = boost::thread(boost::bind(&EnvironmentROBARM3D::computeGoalCandidates, this, pdata_.goal.pose, pdata_.start_entry->state, free_angle, free_angles, rctx, cctx));
+}
+
+void EnvironmentROBARM3D::stopGoalCandidates()
+{
+  goal_ik_thread_.interrupt();
+  goal_ik_thread_.join();
+}
+
+void EnvironmentROBARM3D::computeGoalCandidates(std::vector<double> pose, RobotState seed, int free_angle, std::vector<double> free_angles, boost::shared_ptr<RobotModelContext> rctx, boost::shared_ptr<CollisionCheckerContext> cctx)
+{
+  double dist = 0;
+  RobotState solution;
+  for(size_t i = 0; i < free_angles.size(); ++i)
+  {
+    boost::this_thread::interruption_point();
+
+    if(free_angle >= 0)
+      seed[free_angle] = free_angles[i];
+    if(!rmodel_->computeIK(pose, seed, solution, 0, *rctx))
+      continue;
+    if(!rmodel_->checkJointLimits(solution) || !cc_->isStateValid(solution, *cctx, false, dist))
+      continue;
+    addGoalCandidate(solution);
+  }
+
+  boost::mutex::scoped_lock lock(goal_candidates_mutex_);
+  ROS_INFO("[env] Found %d joint-space goals with %d IK seeds.", int(pdata_.goal_candidates.size()), int(free_angles.size()));
+}
+
+bool EnvironmentROBARM3D::addGoalCandidate(const RobotState &solution)
+{
+  boost::mutex::scoped_lock lock(goal_candidates_mutex_);
+
+  // different seeds often converge to the same solution
+  for(size_t i = 0; i < pdata_.goal_candidates.size(); ++i)
+  {
+    bool duplicate = true;
+    for(size_t j = 0; j < solution.size(); ++j)
+    {
+      if(fabs(angles::shortest_angular_distance(solution[j], pdata_.goal_candidates[i][j])) > 0.05)
+      {
+        duplicate = false;
+        break;
+      }
+    }
+    if(duplicate)
+      return false;
+  }
+  pdata_.goal_candidates.push_back(solution);
+  return true;
+}
+
+bool EnvironmentROBARM3D::getNearestGoalCandidate(const RobotState &from, RobotState &goal_config)
+{
+  boost::mutex::scoped_lock lock(goal_candidates_mutex_);
+  double best = -1;
+  for(size_t i = 0; i < pdata_.goal_candidates.size(); ++i)
+  {
+    double d = 0;
+    for(size_t j = 0; j < from.size() && j < pdata_.goal_candidates[i].size(); ++j)
+      d = std::max(d, fabs(angles::shortest_angular_distance(from[j], pdata_.goal_candidates[i][j])));
+
+    if(best < 0 || d < best)
+    {
+      best = d;
+      goal_config = pdata_.goal_candidates[i];
+    }
+  }
+  return best >= 0;
+}
+
+const std::vector<double>& EnvironmentROBARM3D::getGoal()
 {
   return pdata_.goal.pose;
 }
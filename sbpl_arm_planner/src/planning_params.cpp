@@ -46,6 +46,17 @@ PlanningParams::PlanningParams()
 
   planning_link_sphere_radius_ = 0.08;
 
+  use_goal_ik_candidates_ = false;
+  goal_ik_free_angle_step_ = 0.1;
+
+  use_deferred_mprims_ = false;
+  deferred_mprim_cost_ = 3000;
+
+  use_multires_lattice_ = false;
+  coarse_lattice_factor_ = 4;
+  coarse_mprim_scale_ = 2.0;
+  coarse_lattice_dist_m_ = 0.5;
+
   cost_multiplier_ = 1000;
   cost_per_cell_ = 1;
   cost_per_meter_ = 50;
@@ -82,6 +93,14 @@ bool PlanningParams::init(std::string ns)
   nh.param ("planning/seconds_per_waypoint", waypoint_time_, 0.35);
   nh.param<std::string>("planning/planning_frame",planning_frame_,"");
   nh.param<std::string>("planning/group_name",group_name_,"");
+  nh.param("planning/use_goal_ik_candidates", use_goal_ik_candidates_, false);
+  nh.param("planning/goal_ik_free_angle_step", goal_ik_free_angle_step_, 0.1);
+  nh.param("planning/use_deferred_motion_primitives", use_deferred_mprims_, false);
+  nh.param("planning/deferred_motion_primitive_cost", deferred_mprim_cost_, 3000);
+  nh.param("planning/use_multires_lattice", use_multires_lattice_, false);
+  nh.param("planning/coarse_lattice_factor", coarse_lattice_factor_, 4);
+  nh.param("planning/coarse_motion_primitive_scale", coarse_mprim_scale_, 2.0);
+  nh.param("planning/coarse_lattice_distance", coarse_lattice_dist_m_, 0.5);
 
   /* logging */
   nh.param ("debug/print_out_path", print_path_, true);
@@ -147,6 +166,9 @@ void PlanningParams::printParams(std::string stream)
   ROS_INFO_NAMED(stream,"%40s: %s", "postprocessing: shortcut", shortcut_path_ ? "yes" : "no");
   ROS_INFO_NAMED(stream,"%40s: %s", "postprocessing: interpolate", interpolate_path_ ? "yes" : "no");
   ROS_INFO_NAMED(stream,"%40s: %0.3fsec", "time_per_waypoint", waypoint_time_);
+  ROS_INFO_NAMED(stream,"%40s: %s", "goal ik candidates", use_goal_ik_candidates_ ? "yes" : "no");
+  ROS_INFO_NAMED(stream,"%40s: %s", "deferred motion primitives", use_deferred_mprims_ ? "yes" : "no");
+  ROS_INFO_NAMED(stream,"%40s: %s", "multi-resolution lattice", use_multires_lattice_ ? "yes" : "no");
   
   ROS_INFO_NAMED(stream,"%40s: %d", "cost per cell", cost_per_cell_);
   ROS_INFO_NAMED(stream,"%40s: %s", "reference frame", planning_frame_.c_str());
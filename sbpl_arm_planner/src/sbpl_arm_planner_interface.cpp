@@ -303,6 +303,9 @@ bool SBPLArmPlannerInterface::plan(trajectory_msgs::JointTrajectory &traj)
   //b_ret = planner_->replan(prm_->allowed_time_, &solution_state_ids, &solution_cost_);
   b_ret = planner_->replan(&solution_state_ids, replan_params, &solution_cost_);
 
+  // the scene can change once the search is over
+  sbpl_arm_env_->stopGoalCandidates();
+
   //check if an empty plan was received.
   if(b_ret && solution_state_ids.size() <= 0)
   {
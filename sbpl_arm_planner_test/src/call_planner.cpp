@@ -43,6 +43,7 @@
 #include <arm_navigation_msgs/GetMotionPlan.h>
 #include <sbpl_arm_planner/sbpl_arm_planner_interface.h>
 #include <sbpl_manipulation_components/kdl_robot_model.h>
+#include <sbpl_manipulation_components/generated_fk_robot_model.h>
 #include <sbpl_manipulation_components_pr2/pr2_kdl_robot_model.h>
 #include <sbpl_manipulation_components_pr2/ubr1_kdl_robot_model.h>
 #include <sbpl_collision_checking/sbpl_collision_space.h>
@@ -255,6 +256,8 @@ int main(int argc, char **argv)
   ph.param<std::string>("group_name", group_name, "");
   ph.param<std::string>("object_filename", object_filename, "");
   ph.param<std::string>("action_set_filename", action_set_filename, "");
+  bool use_generated_fk;
+  ph.param("use_generated_fk", use_generated_fk, false);
   ph.param("goal/x", goal[0], 0.0);
   ph.param("goal/y", goal[1], 0.0);
   ph.param("goal/z", goal[2], 0.0);
@@ -290,7 +293,12 @@ int main(int argc, char **argv)
 
   // robot model
   RobotModel *rm;
-  if(group_name.compare("right_arm") == 0)
+  if(use_generated_fk)
+  {
+    // FK generated at build time for the chain, IK through KDL
+    rm = new sbpl_arm_planner::GeneratedFKRobotModel(kinematics_frame, chain_tip_link);
+  }
+  else if(group_name.compare("right_arm") == 0)
     rm = new sbpl_arm_planner::PR2KDLRobotModel();
   else if(group_name.compare("arm") == 0)
     rm = new sbpl_arm_planner::UBR1KDLRobotModel();
@@ -20,12 +20,15 @@ namespace sbpl_arm_planner
 
 typedef struct Sphere
 {
+  Sphere() : radius(0.0), priority(0), kdl_chain(0), kdl_segment(0), radius_class(-1) {}
+
   std::string name;
   KDL::Vector v;
   double radius;
   int priority;
   int kdl_chain;
   int kdl_segment;
+  int radius_class;   // index of the collision space's occupancy bitmap (-1 if none)
 
   void print()
   {
@@ -51,6 +54,15 @@ struct Link
   std::vector<Sphere> low_res_spheres_;
 };
 
+/** @brief Scratch space needed to compute the forward kinematics of a group
+ *  without touching the group itself. One per thread. The frames themselves
+ *  are written to a caller-owned buffer of getNumFrames() frames. */
+struct GroupContext
+{
+  std::vector<KDL::JntArray> joint_positions;
+  std::vector<KDL::Vector> sphere_poses;
+};
+
 class Group
 {
   public:
@@ -69,7 +81,7 @@ class Group
 
     std::string getReferenceFrame();
 
-    std::vector<Sphere*> getSpheres(bool low_res);
+    const std::vector<Sphere*>& getSpheres(bool low_res) const;
 
     void getSpheres(std::vector<Sphere*> &spheres, bool low_res=false);
     
@@ -79,6 +91,26 @@ class Group
     
     bool computeFK(const KDL::JntArray &angles, int chain, int segment, KDL::Frame &frame);
 
+    /** @brief allocate the scratch space used by the reentrant computeFK() */
+    bool initContext(GroupContext &ctx) const;
+
+    /** @brief reentrant forward kinematics, the frame of {chain, segment} is
+     *  written to frames[getFrameIndex(chain, segment)]. Each chain is walked
+     *  once, so the segments before the ones with spheres are written too */
+    bool computeFK(const std::vector<double> &angles, GroupContext &ctx, KDL::Frame *frames) const;
+
+    bool computeFK(const double *angles, size_t num_angles, GroupContext &ctx, KDL::Frame *frames) const;
+
+    /** @brief size of the frame buffer that computeFK() writes to */
+    int getNumFrames() const;
+
+    int getFrameIndex(int chain, int segment) const;
+
+    /** @brief get an upper bound on how far the centers of the spheres can
+     *  move (in meters) per radian of each of the input angles. The bounds are
+     *  independent of the configuration. (only revolute joints are supported) */
+    bool getSphereMotionBounds(const std::vector<Sphere*> &spheres, std::vector<double> &bounds) const;
+
     void setOrderOfJointPositions(const std::vector<std::string> &joint_names);
 
     void setJointPosition(const std::string &name, double position);
@@ -110,6 +142,8 @@ class Group
     std::vector<KDL::ChainFkSolverPos_recursive*> solvers_;
     std::vector<KDL::JntArray> joint_positions_;
     std::vector<std::vector<int> > frames_;
+    std::vector<int> frame_offsets_;
+    int num_frames_;
     std::vector<std::vector<std::string> > jntarray_names_;
     std::vector<std::vector<int> > angles_to_jntarray_;
     std::vector<std::string> joint_names_;
@@ -136,6 +170,16 @@ inline KDL::Frame Group::getGroupToWorldTransform()
   return T_root_to_world_;
 }
 
+inline int Group::getNumFrames() const
+{
+  return num_frames_;
+}
+
+inline int Group::getFrameIndex(int chain, int segment) const
+{
+  return frame_offsets_[chain] + segment;
+}
+
 }
 
 #endif
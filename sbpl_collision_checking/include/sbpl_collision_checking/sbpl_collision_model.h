@@ -65,7 +65,7 @@ class SBPLCollisionModel
 
     void getVoxelGroups(std::vector<Group*> &vg);
 
-    void getSphereGroups(std::vector<Group*> &vg);
+    void getSphereGroups(std::vector<Group*> &vg) const;
 
     std::vector<Sphere*> getGroupSpheres(std::string group_name, bool low_res);
 
@@ -85,7 +85,7 @@ class SBPLCollisionModel
 
     Group* getGroup(std::string name);
 
-    Group* getDefaultGroup() {return dgroup_;};
+    Group* getDefaultGroup() const {return dgroup_;};
 
     void printGroups();
     
@@ -34,9 +34,11 @@
 #include <ros/ros.h>
 #include <vector>
 #include <math.h>
+#include <boost/unordered_map.hpp>
 #include <sbpl_manipulation_components/occupancy_grid.h>
 #include <sbpl_manipulation_components/collision_checker.h>
 #include <sbpl_collision_checking/sbpl_collision_model.h>
+#include <sbpl_collision_checking/voxel_cache.h>
 #include <sbpl_geometry_utils/Interpolator.h>
 #include <sbpl_geometry_utils/Voxelizer.h>
 #include <sbpl_geometry_utils/SphereEncloser.h>
@@ -49,9 +51,49 @@
 
 using namespace std;
 
+#define MAX_RADIUS_CLASSES 32
+
 namespace sbpl_arm_planner
 {
 
+/** @brief Per-thread scratch space for the reentrant collision checking
+ *  functions of SBPLCollisionSpace. Initialize it once per thread with
+ *  SBPLCollisionSpace::initContext() and reuse it for every query. */
+struct CollisionContext : public CollisionCheckerContext
+{
+  CollisionContext() : state_version(-1), clearance(100.0), need_clearance(false), use_bitmaps(true) {}
+
+  /* robot state that the non-planning sphere groups were last computed at */
+  int state_version;
+
+  /* one per sphere group, the default group is first */
+  std::vector<GroupContext> groups;
+
+  /* frames of all of the sphere groups, laid out back to back */
+  std::vector<KDL::Frame> frames;
+
+  std::vector<KDL::Vector> attached_sphere_poses;
+
+  /* spheres found to be in collision (only filled in when visualizing) */
+  std::vector<Sphere> collision_spheres;
+
+  /* smallest distance between a moving sphere's surface and an obstacle
+   * (including the padding) found by the last check */
+  double clearance;
+
+  /* compute the clearance instead of using the occupancy bitmaps */
+  bool need_clearance;
+
+  /* false for contexts used by other threads, the bitmaps are rebuilt
+   * without a lock by the non-const checks when the grid changes */
+  bool use_bitmaps;
+
+  /* interpolation of the path currently being checked */
+  std::vector<double> path_start;
+  std::vector<double> path_delta;
+  std::vector<double> waypoint;
+};
+
 class SBPLCollisionSpace : public sbpl_arm_planner::CollisionChecker
 {
   public:
@@ -71,21 +113,33 @@ class SBPLCollisionSpace : public sbpl_arm_planner::CollisionChecker
     /** --------------- Collision Checking ----------- */
     bool checkCollision(const std::vector<double> &angles, bool verbose, bool visualize, double &dist);
     bool checkCollision(const std::vector<double> &angles, bool low_res, bool verbose, bool visualize, double &dist);
-    bool checkCollision(const std::vector<double> &angles, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, bool low_res, bool verbose, bool visualize, double &dist);
     bool checkPathForCollision(const std::vector<double> &start, const std::vector<double> &end, bool verbose, int &path_length, int &num_checks, double &dist);
-    bool checkPathForCollision(const std::vector<double> &start, const std::vector<double> &end, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, bool verbose, int &path_length, int &num_checks, double &dist);
 
     bool checkSphereGroupAgainstWorld(const std::vector<double> &angles, Group *group, bool low_res, bool verbose, bool visualize, double &dist);
-    bool checkSpheresAgainstWorld(const std::vector<std::vector<KDL::Frame> > &frames, const std::vector<Sphere*> &spheres, bool verbose, bool visualize, std::vector<KDL::Vector> &sph_poses, double &dist);
+    bool checkSpheresAgainstWorld(const Group *group, const KDL::Frame *frames, const std::vector<Sphere*> &spheres, bool verbose, bool visualize, std::vector<KDL::Vector> &sph_poses, double &dist);
     bool checkSphereGroupAgainstSphereGroup(Group *group1, Group *group2, const std::vector<KDL::Vector> &spheres1, const std::vector<KDL::Vector> &spheres2, bool low_res1, bool low_res2, bool verbose, bool visualize, double &dist);
 
     inline bool isValidCell(const int x, const int y, const int z, const int radius);
     double isValidLineSegment(const std::vector<int> a, const std::vector<int> b, const int radius);
     bool getClearance(const std::vector<double> &angles, int num_spheres, double &avg_dist, double &min_dist);
     bool isStateValid(const std::vector<double> &angles, bool verbose, bool visualize, double &dist);
-    bool isStateValid(const std::vector<double> &angles, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, bool verbose, bool visualize, double &dist);
     bool isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, int &path_length, int &num_checks, double &dist);
-    bool isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, int &path_length, int &num_checks, double &dist);
+    bool isStatesValid(const double *configs, int num_joints, size_t n, bool verbose, unsigned char *valid, double *dist);
+    bool isStatesValid(const double *configs, int num_joints, const int *group_ends, size_t num_groups, bool verbose, unsigned char *valid, double *dist);
+
+    /** ---------- Reentrant Collision Checking ---------- 
+     *  These may be called concurrently from multiple threads as long as
+     *  each thread uses its own context and the planning scene, robot state
+     *  and attached objects are not modified at the same time. The functions
+     *  above share a single internal context and are not thread-safe. */
+    bool initContext(CollisionContext &ctx) const;
+    CollisionCheckerContext* createContext() const;
+    bool isStateValid(const std::vector<double> &angles, CollisionCheckerContext &ctx, bool verbose, double &dist) const;
+    bool isStateValid(const std::vector<double> &angles, CollisionContext &ctx, bool verbose, double &dist) const;
+    bool isStatesValid(const double *configs, int num_joints, size_t n, CollisionContext &ctx, bool verbose, unsigned char *valid, double *dist) const;
+    bool isStatesValid(const double *configs, int num_joints, const int *group_ends, size_t num_groups, CollisionContext &ctx, bool verbose, unsigned char *valid, double *dist) const;
+    bool isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, CollisionContext &ctx, int &path_length, int &num_checks, double &dist) const;
+    bool checkPathForCollision(const std::vector<double> &start, const std::vector<double> &end, CollisionContext &ctx, bool verbose, int &path_length, int &num_checks, double &dist) const;
 
     /** ---------------- Utils ---------------- */
     bool interpolatePath(const std::vector<double>& start, const std::vector<double>& end, std::vector<std::vector<double> >& path);
@@ -97,6 +151,7 @@ class SBPLCollisionSpace : public sbpl_arm_planner::CollisionChecker
     void setJointPosition(std::string name, double position);
     bool setPlanningJoints(const std::vector<std::string> &joint_names);
     bool getCollisionSpheres(const std::vector<double> &angles, Group *group, bool low_res, std::vector<std::vector<double> > &spheres);
+    bool getCollisionSpheres(const std::vector<double> &angles, std::vector<std::vector<double> > &spheres);
 
     /* ------------- Collision Objects -------------- */
     void addCollisionObject(const arm_navigation_msgs::CollisionObject &object);
@@ -104,6 +159,14 @@ class SBPLCollisionSpace : public sbpl_arm_planner::CollisionChecker
     void processCollisionObjectMsg(const arm_navigation_msgs::CollisionObject &object);
     void removeAllCollisionObjects();
     void putCollisionObjectsInGrid();
+
+    /** @brief rebuild the per-radius occupancy bitmaps from the distance
+     *  field. This is done by setPlanningScene(), but it has to be called
+     *  again after anything else modifies the grid. Until then, the sphere
+     *  checks fall back to reading the distance field. */
+    void updateOccupancyBitmaps();
+    void refreshOccupancyBitmaps();
+    inline bool areBitmapsCurrent() const;
     void getCollisionObjectVoxelPoses(std::vector<geometry_msgs::Pose> &points);
     
     /** --------------- Attached Objects -------------- */
@@ -131,8 +194,23 @@ class SBPLCollisionSpace : public sbpl_arm_planner::CollisionChecker
     sbpl_arm_planner::SBPLCollisionModel model_;
     sbpl_arm_planner::OccupancyGrid* grid_;
 
+    /* context used by the non-reentrant interface */
+    CollisionContext ctx_;
+
+    /* incremented whenever the robot state or model-to-world transform changes */
+    int state_version_;
+
+    /* first group is the default group */
+    std::vector<Group*> sphere_groups_;
+
+    /* where each sphere group's frames start in CollisionContext::frames */
+    std::vector<int> group_frame_offsets_;
+    int num_frames_;
+
     /* ----------- Parameters ------------ */
     bool use_multi_level_collision_check_;
+    bool use_conservative_advancement_;
+    bool use_interpolated_distance_;
     double padding_;
     double object_enclosing_sphere_radius_;
     std::string group_name_;
@@ -143,11 +221,35 @@ class SBPLCollisionSpace : public sbpl_arm_planner::CollisionChecker
     std::vector<double> max_limits_;
     std::vector<bool> continuous_;
 
+    /* how far any sphere can move per radian of each planning joint */
+    std::vector<double> motion_bounds_;
+
+    /* ------------- Occupancy Bitmaps -------------- */
+    /* distinct values of sphere radius + padding, one bitmap per value. a
+     * cell's bit is set if a sphere of that radius centered there collides. */
+    std::vector<double> radius_classes_;
+    std::vector<std::vector<unsigned char> > occupancy_bitmaps_;
+    int bitmap_dims_[3];
+    bool bitmaps_valid_;
+
+    /* grid revision the bitmaps were built from, they're only used while it
+     * matches. the non-const checks rebuild them, the reentrant ones fall
+     * back to the distances */
+    unsigned int bitmaps_revision_;
+
     /* ------------- Collision Objects -------------- */
     std::vector<std::string> known_objects_;
     std::map<std::string, arm_navigation_msgs::CollisionObject> object_map_;
     std::map<std::string, std::vector<Eigen::Vector3d> > object_voxel_map_;
 
+    /* voxels of each voxel group that are currently in the grid */
+    std::map<std::string, std::vector<Eigen::Vector3d> > voxel_group_map_;
+
+    /* number of objects and voxel groups occupying each occupied cell, so
+     * that removing one of them doesn't clear a cell that another still
+     * fills. hashed so that it stays small with the sparse grid */
+    boost::unordered_map<size_t, unsigned short> voxel_counts_;
+
     /** --------------- Attached Objects --------------*/
     bool object_attached_;
     int attached_object_segment_num_;    
@@ -159,8 +261,45 @@ class SBPLCollisionSpace : public sbpl_arm_planner::CollisionChecker
 
     /* for debugging */
     std::vector<sbpl_arm_planner::Sphere> collision_spheres_;
+
+    bool computeFK(const double *angles, size_t num_angles, CollisionContext &ctx) const;
+    bool isStateValid(const std::vector<double> &angles, CollisionContext &ctx, bool verbose, bool visualize, double &dist) const;
+    bool checkCollision(CollisionContext &ctx, bool verbose, bool visualize, double &dist) const;
+    bool checkCollision(CollisionContext &ctx, bool low_res, bool verbose, bool visualize, double &dist) const;
+    bool checkSpheresAgainstWorld(const Group *group, const KDL::Frame *frames, const std::vector<Sphere*> &spheres, bool verbose, bool visualize, std::vector<KDL::Vector> &sph_poses, std::vector<Sphere> &collisions, double &dist, double *clearance, bool use_bitmaps) const;
+    bool checkSphereGroupAgainstSphereGroup(Group *group1, Group *group2, const std::vector<KDL::Vector> &spheres1, const std::vector<KDL::Vector> &spheres2, bool low_res1, bool low_res2, bool verbose, bool visualize, std::vector<Sphere> &collisions, double &dist, double &clearance) const;
+
+    /* path checking */
+    bool getPathDelta(const std::vector<double> &start, const std::vector<double> &end, CollisionContext &ctx, int &path_length) const;
+    bool getAngleWithinLimits(size_t joint, double &angle) const;
+    bool isPathPointValid(CollisionContext &ctx, double t, bool verbose, double &dist) const;
+    bool checkPathConservatively(CollisionContext &ctx, int path_length, bool verbose, int &num_checks, double &dist) const;
+    void updateMotionBounds();
+    void updateAttachedSpheres();
+    int getPathWaypointIndex(long k, int path_length, long num_steps) const;
+
+    int getRadiusClass(double radius);
+    void updateVoxelsInGrid(const std::vector<Eigen::Vector3d> &old_voxels, const std::vector<Eigen::Vector3d> &new_voxels);
+    bool isOccupiedForRadiusClass(int radius_class, int x, int y, int z) const;
 };
 
+inline bool SBPLCollisionSpace::areBitmapsCurrent() const
+{
+  return bitmaps_valid_ && bitmaps_revision_ == grid_->getRevision();
+}
+
+inline bool SBPLCollisionSpace::isOccupiedForRadiusClass(int radius_class, int x, int y, int z) const
+{
+  size_t cell = (size_t(x) * bitmap_dims_[1] + y) * bitmap_dims_[2] + z;
+  return occupancy_bitmaps_[radius_class][cell >> 3] & (1 << (cell & 7));
+}
+
+inline int SBPLCollisionSpace::getPathWaypointIndex(long k, int path_length, long num_steps) const
+{
+  // round(k * (path_length-1) / num_steps)
+  return int((2*k*(path_length-1) + num_steps) / (2*num_steps));
+}
+
 inline bool SBPLCollisionSpace::isValidCell(const int x, const int y, const int z, const int radius)
 {
   if(grid_->getCell(x,y,z) <= radius)
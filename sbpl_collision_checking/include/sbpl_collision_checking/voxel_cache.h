@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2011, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** \author Benjamin Cohen */
+
+#ifndef _VOXEL_CACHE_
+#define _VOXEL_CACHE_
+
+#include <ros/ros.h>
+#include <map>
+#include <list>
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <boost/thread/mutex.hpp>
+#include <Eigen/Geometry>
+#include <geometry_msgs/Point.h>
+
+namespace sbpl_arm_planner
+{
+
+/* \brief Voxelized meshes in their own frame, keyed by a hash of the mesh
+ * geometry, the resolution and whether the inside is filled. The voxels are
+ * kept in memory and, if a directory is set, in one file per mesh so that
+ * they survive a restart. Callers re-pose the cached voxels themselves.
+ * Collision objects come and go with the planning scene, so the memory
+ * side holds at most a set number of voxels and drops the meshes that went
+ * unused the longest to stay under it.
+ */
+class VoxelCache
+{
+  public:
+
+    /** @brief the cache shared by the collision space and the groups */
+    static VoxelCache* getInstance();
+
+    /** @brief directory the voxels are stored in, empty for memory only */
+    void setCacheDirectory(const std::string &directory);
+
+    /** @brief most voxels kept in memory over all meshes, 0 for none */
+    void setMaxVoxels(size_t max_voxels);
+
+    /** @brief voxels of the mesh in its own frame, voxelized only if they
+     *  aren't in memory or on disk yet */
+    void getMeshVoxels(const std::vector<geometry_msgs::Point> &vertices, const std::vector<int> &triangles, double resolution, bool fill, std::vector<Eigen::Vector3d> &voxels);
+
+    void clear();
+
+    static uint64_t hashMesh(const std::vector<geometry_msgs::Point> &vertices, const std::vector<int> &triangles, double resolution, bool fill);
+
+  private:
+
+    /* what a file was voxelized from, checked on top of the hash in case
+     * two meshes collide */
+    struct FileHeader
+    {
+      uint64_t key;
+      double resolution;
+      uint64_t num_vertices;
+      uint64_t num_triangles;
+      unsigned char fill;
+    };
+
+    struct Entry
+    {
+      std::vector<Eigen::Vector3d> voxels;
+      std::list<uint64_t>::iterator use;
+    };
+
+    VoxelCache();
+
+    boost::mutex mutex_;
+    std::string directory_;
+    std::map<uint64_t, Entry> voxels_;
+
+    /* keys from the most to the least recently used */
+    std::list<uint64_t> uses_;
+    size_t num_voxels_;
+    size_t max_voxels_;
+
+    void insert(uint64_t key, const std::vector<Eigen::Vector3d> &voxels);
+    void evict(size_t max_voxels);
+
+    std::string getFilename(uint64_t key) const;
+    bool readVoxels(const FileHeader &header, std::vector<Eigen::Vector3d> &voxels) const;
+    bool writeVoxels(const FileHeader &header, const std::vector<Eigen::Vector3d> &voxels) const;
+};
+
+}
+
+#endif
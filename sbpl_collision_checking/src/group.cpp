@@ -1,4 +1,5 @@
 #include <sbpl_collision_checking/group.h>
+#include <sbpl_collision_checking/voxel_cache.h>
 #include <sbpl_geometry_utils/Voxelizer.h>
 #include <geometric_shapes/shapes.h>
 
@@ -15,6 +16,7 @@ bool sortSphere(sbpl_arm_planner::Sphere* a, sbpl_arm_planner::Sphere* b)
 Group::Group(std::string name) : name_(name)
 {
   init_ = false;
+  num_frames_ = 0;
 }
 
 Group::~Group()
@@ -173,6 +175,15 @@ bool Group::initKinematics()
     ROS_DEBUG("[%s] Instantiated a forward kinematics solver for chain #%d for the %s with %d joints.", name_.c_str(), int(i), name_.c_str(), chains_[i].getNrOfJoints());
   }
 
+  // lay out the frames of all of the chains one after the other
+  frame_offsets_.resize(chains_.size());
+  num_frames_ = 0;
+  for(size_t i = 0; i < chains_.size(); ++i)
+  {
+    frame_offsets_[i] = num_frames_;
+    num_frames_ += chains_[i].getNrOfSegments() + 1;
+  }
+
   ROS_INFO("Initialized %d chains for the %s group.", int(chains_.size()), name_.c_str());
   return true;
 }
@@ -552,6 +563,113 @@ bool Group::computeFK(const std::vector<double> &angles, std::vector<std::vector
   return true;
 }
 
+bool Group::initContext(GroupContext &ctx) const
+{
+  if(!init_)
+  {
+    ROS_ERROR("Failed to initialize a context for the %s group because it is not initialized.", name_.c_str());
+    return false;
+  }
+
+  ctx.joint_positions = joint_positions_;
+  ctx.sphere_poses.reserve(std::max(spheres_.size(), low_res_spheres_.size()));
+  return true;
+}
+
+bool Group::computeFK(const std::vector<double> &angles, GroupContext &ctx, KDL::Frame *frames) const
+{
+  return computeFK(angles.empty() ? NULL : &angles[0], angles.size(), ctx, frames);
+}
+
+bool Group::computeFK(const double *angles, size_t num_angles, GroupContext &ctx, KDL::Frame *frames) const
+{
+  for(size_t i = 0; i < frames_.size(); ++i)
+  {
+    // start from the current robot state, then fill in the input angles
+    ctx.joint_positions[i] = joint_positions_[i];
+    for(size_t k = 0; k < num_angles; ++k)
+    {
+      if(angles_to_jntarray_[i][k] == -1)
+        continue;
+      ctx.joint_positions[i](angles_to_jntarray_[i][k]) = angles[k];
+    }
+
+    int last = 0;
+    for(size_t j = 0; j < frames_[i].size(); ++j)
+      last = std::max(last, frames_[i][j]);
+
+    // walk down the chain once, every segment up to the last one that's
+    // needed gets its frame
+    KDL::Frame *chain_frames = frames + frame_offsets_[i];
+    const KDL::JntArray &q = ctx.joint_positions[i];
+    chain_frames[0] = T_root_to_world_;
+    unsigned int jnt = 0;
+    for(int seg = 0; seg < last; ++seg)
+    {
+      const KDL::Segment &segment = chains_[i].getSegment(seg);
+      if(segment.getJoint().getType() != KDL::Joint::None)
+      {
+        if(jnt >= q.rows())
+        {
+          ROS_ERROR("[%s] Chain %d has more joints than joint positions.", name_.c_str(), int(i));
+          return false;
+        }
+        chain_frames[seg+1] = chain_frames[seg] * segment.pose(q(jnt));
+        ++jnt;
+      }
+      else
+        chain_frames[seg+1] = chain_frames[seg] * segment.pose(0.0);
+    }
+  }
+  return true;
+}
+
+bool Group::getSphereMotionBounds(const std::vector<Sphere*> &spheres, std::vector<double> &bounds) const
+{
+  bounds.assign(order_of_input_angles_.size(), 0.0);
+  for(size_t i = 0; i < spheres.size(); ++i)
+  {
+    const KDL::Chain &chain = chains_[spheres[i]->kdl_chain];
+
+    // walk from the sphere's frame back up the chain, summing the distance
+    // between consecutive joint axes. a joint can't move the sphere farther
+    // than the sum of the links between it and the sphere per radian.
+    double lever = spheres[i]->v.Norm();
+    int jnt = -1;
+    for(int seg = 0; seg < spheres[i]->kdl_segment; ++seg)
+    {
+      if(chain.getSegment(seg).getJoint().getTypeName().compare("None") != 0)
+        jnt++;
+    }
+
+    for(int seg = spheres[i]->kdl_segment-1; seg >= 0; --seg)
+    {
+      const KDL::Segment &segment = chain.getSegment(seg);
+      const KDL::Joint &joint = segment.getJoint();
+      lever += (segment.getFrameToTip().p - joint.JointOrigin()).Norm();
+
+      if(joint.getTypeName().compare("None") != 0)
+      {
+        if(joint.getType() == KDL::Joint::TransAxis || joint.getType() == KDL::Joint::TransX ||
+           joint.getType() == KDL::Joint::TransY || joint.getType() == KDL::Joint::TransZ)
+        {
+          ROS_WARN("[%s] Can't bound the motion of sphere '%s' because '%s' is a prismatic joint.", name_.c_str(), spheres[i]->name.c_str(), joint.getName().c_str());
+          return false;
+        }
+
+        for(size_t k = 0; k < bounds.size(); ++k)
+        {
+          if(angles_to_jntarray_[spheres[i]->kdl_chain][k] == jnt && lever > bounds[k])
+            bounds[k] = lever;
+        }
+        jnt--;
+      }
+      lever += joint.JointOrigin().Norm();
+    }
+  }
+  return true;
+}
+
 void Group::setOrderOfJointPositions(const std::vector<std::string> &joint_names)
 {
   // store the desired order of the input angles for debug information
@@ -622,7 +740,7 @@ void Group::getSpheres(std::vector<Sphere*> &spheres, bool low_res)
     spheres = spheres_;
 }
 
-std::vector<Sphere*> Group::getSpheres(bool low_res)
+const std::vector<Sphere*>& Group::getSpheres(bool low_res) const
 {
   if(low_res)
     return low_res_spheres_;
@@ -677,7 +795,7 @@ bool Group::getLinkVoxels(std::string name, std::vector<KDL::Vector> &voxels)
     scale.x = 1; scale.y = 1; scale.z = 1;
     std::vector<int> triangles;
     std::vector<geometry_msgs::Point> vertices;
-    std::vector<std::vector<double> > v;
+    std::vector<Eigen::Vector3d> v;
     urdf::Mesh* mesh = (urdf::Mesh*) geom.get();
     if(!leatherman::getMeshComponentsFromResource(mesh->filename, scale, triangles, vertices))
     {
@@ -685,15 +803,13 @@ bool Group::getLinkVoxels(std::string name, std::vector<KDL::Vector> &voxels)
       return false;
     }
     ROS_DEBUG("mesh: %s  triangles: %u  vertices: %u", name.c_str(), int(triangles.size()), int(vertices.size()));
-    sbpl::Voxelizer::voxelizeMesh(vertices, triangles, p, RESOLUTION, v, false);
+    // the mesh is voxelized in its own frame once and cached, then posed
+    VoxelCache::getInstance()->getMeshVoxels(vertices, triangles, RESOLUTION, false, v);
     ROS_DEBUG("mesh: %s  voxels: %u", name.c_str(), int(v.size()));
+    KDL::Frame f(KDL::Rotation::Quaternion(p.orientation.x, p.orientation.y, p.orientation.z, p.orientation.w), KDL::Vector(p.position.x, p.position.y, p.position.z));
     voxels.resize(v.size());
     for(size_t i = 0; i < v.size(); ++i)
-    {
-      voxels[i].x(v[i][0]); 
-      voxels[i].y(v[i][1]); 
-      voxels[i].z(v[i][2]); 
-    }
+      voxels[i] = f * KDL::Vector(v[i].x(), v[i].y(), v[i].z());
   }
   else if(geom->type == urdf::Geometry::BOX)
   {
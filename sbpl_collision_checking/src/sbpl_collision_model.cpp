@@ -254,7 +254,7 @@ void SBPLCollisionModel::getVoxelGroups(std::vector<Group*> &vg)
   }
 }
 
-void SBPLCollisionModel::getSphereGroups(std::vector<Group*> &vg)
+void SBPLCollisionModel::getSphereGroups(std::vector<Group*> &vg) const
 { 
   if(!sphere_groups_.empty())
     vg = sphere_groups_;
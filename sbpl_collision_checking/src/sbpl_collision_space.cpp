@@ -43,11 +43,18 @@ SBPLCollisionSpace::SBPLCollisionSpace(sbpl_arm_planner::OccupancyGrid* grid)
   padding_ = 0.005;
   object_enclosing_sphere_radius_ = 0.03;
   use_multi_level_collision_check_ = true;
+  use_conservative_advancement_ = false;
+  use_interpolated_distance_ = false;
+  state_version_ = 0;
+  num_frames_ = 0;
+  bitmaps_valid_ = false;
+  bitmaps_revision_ = 0;
 }
 
 void SBPLCollisionSpace::setPadding(double padding)
 {
   padding_ = padding;
+  bitmaps_valid_ = false;
 }
 
 bool SBPLCollisionSpace::setPlanningJoints(const std::vector<std::string> &joint_names)
@@ -58,6 +65,7 @@ bool SBPLCollisionSpace::setPlanningJoints(const std::vector<std::string> &joint
     return false;
   }
 
+  planning_joints_ = joint_names;
   inc_.resize(joint_names.size(),0.0348);
   min_limits_.resize(joint_names.size(), 0.0);
   max_limits_.resize(joint_names.size(), 0.0);
@@ -79,13 +87,151 @@ bool SBPLCollisionSpace::setPlanningJoints(const std::vector<std::string> &joint
 
   // set the order of the planning joints
   model_.setOrderOfJointPositions(joint_names, group_name_);
+  updateMotionBounds();
   return true;
 }
 
+void SBPLCollisionSpace::updateMotionBounds()
+{
+  std::vector<double> bounds;
+  Group *dgroup = model_.getDefaultGroup();
+  if(dgroup == NULL || !dgroup->getSphereMotionBounds(dgroup->getSpheres(false), motion_bounds_))
+  {
+    motion_bounds_.clear();
+    return;
+  }
+
+  if(object_attached_)
+  {
+    std::vector<Sphere*> spheres(object_spheres_.size());
+    for(size_t i = 0; i < object_spheres_.size(); ++i)
+      spheres[i] = &(object_spheres_[i]);
+
+    if(!dgroup->getSphereMotionBounds(spheres, bounds))
+    {
+      motion_bounds_.clear();
+      return;
+    }
+
+    for(size_t i = 0; i < motion_bounds_.size(); ++i)
+      motion_bounds_[i] = std::max(motion_bounds_[i], bounds[i]);
+  }
+  ROS_DEBUG("[cspace] [motion_bounds] %s", leatherman::getString(motion_bounds_).c_str());
+}
+
+void SBPLCollisionSpace::updateAttachedSpheres()
+{
+  object_spheres_p_.resize(object_spheres_.size());
+  for(size_t i = 0; i < object_spheres_.size(); ++i)
+  {
+    object_spheres_p_[i] = &(object_spheres_[i]);
+
+    // only use a bitmap if one was already built for this radius
+    object_spheres_[i].radius_class = -1;
+    for(size_t j = 0; j < radius_classes_.size(); ++j)
+    {
+      if(radius_classes_[j] == object_spheres_[i].radius + padding_)
+        object_spheres_[i].radius_class = j;
+    }
+  }
+  updateMotionBounds();
+}
+
+int SBPLCollisionSpace::getRadiusClass(double radius)
+{
+  for(size_t i = 0; i < radius_classes_.size(); ++i)
+  {
+    if(radius_classes_[i] == radius)
+      return i;
+  }
+
+  if(int(radius_classes_.size()) >= MAX_RADIUS_CLASSES)
+    return -1;
+
+  radius_classes_.push_back(radius);
+  return radius_classes_.size() - 1;
+}
+
+void SBPLCollisionSpace::updateOccupancyBitmaps()
+{
+  std::vector<Sphere*> spheres;
+
+  // all of the spheres that get checked against the world
+  for(size_t i = 0; i < sphere_groups_.size(); ++i)
+  {
+    spheres.insert(spheres.end(), sphere_groups_[i]->getSpheres(false).begin(), sphere_groups_[i]->getSpheres(false).end());
+    spheres.insert(spheres.end(), sphere_groups_[i]->getSpheres(true).begin(), sphere_groups_[i]->getSpheres(true).end());
+  }
+  spheres.insert(spheres.end(), object_spheres_p_.begin(), object_spheres_p_.end());
+
+  radius_classes_.clear();
+
+  // the bitmaps are dense, so the sparse grid reads the distances instead
+  if(grid_->getBackend() == OccupancyGrid::SPARSE_DISTANCE_FIELD)
+  {
+    for(size_t i = 0; i < spheres.size(); ++i)
+      spheres[i]->radius_class = -1;
+    occupancy_bitmaps_.clear();
+    bitmaps_valid_ = true;
+    bitmaps_revision_ = grid_->getRevision();
+    return;
+  }
+
+  for(size_t i = 0; i < spheres.size(); ++i)
+    spheres[i]->radius_class = getRadiusClass(spheres[i]->radius + padding_);
+
+  grid_->getGridSize(bitmap_dims_[0], bitmap_dims_[1], bitmap_dims_[2]);
+  size_t num_cells = size_t(bitmap_dims_[0]) * bitmap_dims_[1] * bitmap_dims_[2];
+  occupancy_bitmaps_.assign(radius_classes_.size(), std::vector<unsigned char>((num_cells + 7) / 8, 0));
+
+  // same cell order as isOccupiedForRadiusClass()
+  size_t cell = 0;
+  double d;
+  for(int x = 0; x < bitmap_dims_[0]; ++x)
+  {
+    for(int y = 0; y < bitmap_dims_[1]; ++y)
+    {
+      for(int z = 0; z < bitmap_dims_[2]; ++z, ++cell)
+      {
+        d = grid_->getDistance(x,y,z);
+        for(size_t c = 0; c < radius_classes_.size(); ++c)
+        {
+          if(d <= radius_classes_[c])
+            occupancy_bitmaps_[c][cell >> 3] |= (1 << (cell & 7));
+        }
+      }
+    }
+  }
+  bitmaps_valid_ = true;
+  bitmaps_revision_ = grid_->getRevision();
+  ROS_DEBUG("[cspace] Built %d occupancy bitmaps of %d bytes each.", int(radius_classes_.size()), int((num_cells + 7) / 8));
+}
+
+void SBPLCollisionSpace::refreshOccupancyBitmaps()
+{
+  if(!areBitmapsCurrent())
+    updateOccupancyBitmaps();
+}
+
 bool SBPLCollisionSpace::init(std::string group_name, std::string ns)
 {
   group_name_ = group_name;
 
+  ros::NodeHandle ph("~");
+  ph.param("collision_space/use_conservative_advancement", use_conservative_advancement_, false);
+
+  // interpolating doesn't lose up to half a cell to snapping, so the padding
+  // can be smaller, but it's 8 distance lookups per sphere and no bitmaps
+  ph.param("collision_space/use_interpolated_distance", use_interpolated_distance_, false);
+
+  // mesh voxels are kept across restarts if a directory is given
+  std::string voxel_cache_directory;
+  ph.param<std::string>("collision_space/voxel_cache_directory", voxel_cache_directory, "");
+  VoxelCache::getInstance()->setCacheDirectory(voxel_cache_directory);
+  int voxel_cache_max_voxels;
+  ph.param("collision_space/voxel_cache_max_voxels", voxel_cache_max_voxels, 4000000);
+  VoxelCache::getInstance()->setMaxVoxels(std::max(voxel_cache_max_voxels, 0));
+
   // initialize the collision model
   if(!model_.init(ns))
   {
@@ -109,161 +255,121 @@ bool SBPLCollisionSpace::init(std::string group_name, std::string ns)
   //model_.printGroups();
   //model_.printDebugInfo(group_name);
 
+  model_.getSphereGroups(sphere_groups_);
+
+  // the frames of every sphere group share one buffer in the context
+  group_frame_offsets_.resize(sphere_groups_.size());
+  num_frames_ = 0;
+  for(size_t i = 0; i < sphere_groups_.size(); ++i)
+  {
+    group_frame_offsets_[i] = num_frames_;
+    num_frames_ += sphere_groups_[i]->getNumFrames();
+  }
+
+  if(!initContext(ctx_))
+    return false;
+
   if(!updateVoxelGroups())
     return false;
 
+  updateOccupancyBitmaps();
   return true;
 }
 
-bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, bool verbose, bool visualize, double &dist)
-{ 
-  if(!use_multi_level_collision_check_)
-    return checkCollision(angles, false, verbose, visualize, dist);
-  else
+bool SBPLCollisionSpace::initContext(CollisionContext &ctx) const
+{
+  if(sphere_groups_.empty())
   {
-    std::vector<std::vector<std::vector<KDL::Frame> > > frames;
-
-    if(checkCollision(angles, frames, true, verbose, visualize, dist))
-      return true;
-    else
-      return checkCollision(angles, frames, false, verbose, visualize, dist);
+    ROS_ERROR("[cspace] Failed to initialize the collision context because the collision space is not initialized.");
+    return false;
   }
-}
-
-bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, std::vector<std::vector<std::vector<KDL::Frame> > > &frames,  bool low_res, bool verbose, bool visualize, double &dist)
-{  
-  bool in_collision = false;
-  double dist_temp=100.0;
-  dist = 100.0;
-  std::vector<Sphere*> spheres;
-  std::vector<KDL::Vector> dg_spheres, g_spheres;  
-  if(visualize)
-    collision_spheres_.clear();
 
-  // first group, is default group
-  std::vector<Group*> sg;
-  model_.getSphereGroups(sg);
-
-  // if empty, low_res is probably enabled
-  if(frames.empty())
-    frames.resize(sg.size());
-    
-  // compute FK for default group
-  if(frames[0].empty())
+  ctx.frames.assign(num_frames_, KDL::Frame::Identity());
+  ctx.groups.resize(sphere_groups_.size());
+  for(size_t i = 0; i < sphere_groups_.size(); ++i)
   {
-    if(!model_.computeDefaultGroupFK(angles, frames[0]))
+    if(!sphere_groups_[i]->initContext(ctx.groups[i]))
     {
-      ROS_ERROR("[cspace] Failed to compute foward kinematics.");
+      ROS_ERROR("[cspace] Failed to initialize the collision context for the '%s' group.", sphere_groups_[i]->getName().c_str());
       return false;
     }
   }
+  ctx.state_version = -1;
+  ctx.collision_spheres.clear();
+  return true;
+}
 
-  ROS_DEBUG("[cspace] Checking collisions in checkCollision().");
-
-  // check attached object against world
-  if(object_attached_)
+bool SBPLCollisionSpace::computeFK(const double *angles, size_t num_angles, CollisionContext &ctx) const
+{
+  if(ctx.groups.size() != sphere_groups_.size())
   {
-    if(!checkSpheresAgainstWorld(frames[0], object_spheres_p_, verbose, visualize, dg_spheres, dist_temp))
-    {
-      if(!visualize)
-        return false;
-      else
-        in_collision = true;
-    }
-    if(dist_temp < dist)
-      dist = dist_temp;
+    ROS_ERROR("[cspace] The collision context was not initialized.");
+    return false;
   }
 
-  /*
-  sg[0]->getSpheres(spheres, low_res);
-  dg_spheres.resize(spheres.size());
-  for(size_t j = 0; j < spheres.size(); ++j)
-    dg_spheres[j] = frames[0][spheres[j]->kdl_chain][spheres[j]->kdl_segment] * spheres[j]->v;
-  */
- 
-  // check default sphere group against world
-  if(!checkSpheresAgainstWorld(frames[0], sg[0]->getSpheres(low_res), verbose, visualize, dg_spheres, dist_temp))
+  // compute FK for default group
+  if(!sphere_groups_[0]->computeFK(angles, num_angles, ctx.groups[0], &ctx.frames[group_frame_offsets_[0]]))
   {
-    if(!visualize)
-      return false;
-    else
-      in_collision = true;
+    ROS_ERROR("[cspace] Failed to compute foward kinematics.");
+    return false;
   }
-  if(dist_temp < dist)
-    dist = dist_temp;
 
-  // check other sphere groups
-  std::vector<double> empty_angles;
-  for(size_t i = 1; i < sg.size(); ++i)
+  // the other sphere groups only move when the robot state changes
+  if(ctx.state_version != state_version_)
   {
-    // compute FK for group
-    if(frames[i].empty())
+    const std::vector<double> empty_angles;
+    for(size_t i = 1; i < sphere_groups_.size(); ++i)
     {
-      if(!sg[i]->computeFK(empty_angles, frames[i]))
+      if(!sphere_groups_[i]->computeFK(empty_angles, ctx.groups[i], &ctx.frames[group_frame_offsets_[i]]))
       {
-        ROS_ERROR("[cspace] Failed to compute FK for sphere group '%s'.", sg[i]->getName().c_str());
+        ROS_ERROR("[cspace] Failed to compute FK for sphere group '%s'.", sphere_groups_[i]->getName().c_str());
         return false;
       }
     }
-
-    // check against world
-    if(!checkSpheresAgainstWorld(frames[i], sg[i]->getSpheres(low_res), verbose, visualize, g_spheres, dist_temp))
-    {
-      if(!visualize)
-        return false;
-      else
-        in_collision = true;
-    }
-    if(dist_temp < dist)
-      dist = dist_temp;
-
-    /*
-    sg[i]->getSpheres(spheres, low_res);
-    g_spheres.resize(spheres.size());
-    for(size_t j = 0; j < spheres.size(); ++j)
-      g_spheres[j] = frames[i][spheres[j]->kdl_chain][spheres[j]->kdl_segment] * spheres[j]->v;
-    */
-
-    // check against default group spheres (TODO: change to all sphere groups)
-    if(!checkSphereGroupAgainstSphereGroup(sg[0], sg[i], dg_spheres, g_spheres, low_res, low_res, verbose, visualize, dist_temp))
-    {
-      if(!visualize)
-        return false;
-      else
-        in_collision = true;
-    }
-    if(dist_temp < dist)
-      dist = dist_temp;
+    ctx.state_version = state_version_;
   }
+  return true;
+}
 
-  if(visualize && in_collision)
+bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, bool verbose, bool visualize, double &dist)
+{ 
+  bool valid = isStateValid(angles, ctx_, verbose, visualize, dist);
+  if(visualize)
+    collision_spheres_ = ctx_.collision_spheres;
+  return valid;
+}
+
+bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, bool low_res, bool verbose, bool visualize, double &dist)
+{  
+  if(!computeFK(angles.empty() ? NULL : &angles[0], angles.size(), ctx_))
     return false;
 
-  return true;
+  bool valid = checkCollision(ctx_, low_res, verbose, visualize, dist);
+  if(visualize)
+    collision_spheres_ = ctx_.collision_spheres;
+  return valid;
 }
 
-bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, bool low_res, bool verbose, bool visualize, double &dist)
+bool SBPLCollisionSpace::checkCollision(CollisionContext &ctx, bool low_res, bool verbose, bool visualize, double &dist) const
 {  
   bool in_collision = false;
-  double dist_temp=100.0;
+  double dist_temp=100.0, clearance_temp=100.0;
+  double *clearance = ctx.need_clearance ? &clearance_temp : NULL;
   dist = 100.0;
-  std::vector<Sphere*> spheres;
-  std::vector<KDL::Vector> dg_spheres, g_spheres;
-  std::vector<std::vector<KDL::Frame> > dframes, frames;
+  ctx.clearance = 100.0;
   if(visualize)
-    collision_spheres_.clear();
+    ctx.collision_spheres.clear();
 
-  // compute FK for default group
-  if(!model_.computeDefaultGroupFK(angles, dframes))
-  {
-    ROS_ERROR("[cspace] Failed to compute foward kinematics.");
-    return false;
-  }
+  ROS_DEBUG("[cspace] Checking collisions in checkCollision().");
+
+  // first group, is default group
+  GroupContext &dctx = ctx.groups[0];
+  const KDL::Frame *dframes = &ctx.frames[group_frame_offsets_[0]];
 
   // check attached object against world
   if(object_attached_)
   {
-    if(!checkSpheresAgainstWorld(dframes, object_spheres_p_, verbose, visualize, dg_spheres, dist_temp))
+    if(!checkSpheresAgainstWorld(sphere_groups_[0], dframes, object_spheres_p_, verbose, visualize, ctx.attached_sphere_poses, ctx.collision_spheres, dist_temp, clearance, ctx.use_bitmaps))
     {
       if(!visualize)
         return false;
@@ -272,10 +378,12 @@ bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, bool
     }
     if(dist_temp < dist)
       dist = dist_temp;
+    if(clearance_temp < ctx.clearance)
+      ctx.clearance = clearance_temp;
   }
 
   // check default sphere group against world
-  if(!checkSpheresAgainstWorld(dframes, model_.getDefaultGroup()->getSpheres(low_res), verbose, visualize, dg_spheres, dist_temp))
+  if(!checkSpheresAgainstWorld(sphere_groups_[0], dframes, sphere_groups_[0]->getSpheres(low_res), verbose, visualize, dctx.sphere_poses, ctx.collision_spheres, dist_temp, clearance, ctx.use_bitmaps))
   {
     if(!visualize)
       return false;
@@ -284,22 +392,16 @@ bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, bool
   }
   if(dist_temp < dist)
     dist = dist_temp;
+  if(clearance_temp < ctx.clearance)
+    ctx.clearance = clearance_temp;
 
   // check other sphere groups
-  std::vector<Group*> sg;
-  model_.getSphereGroups(sg);
-  std::vector<double> empty_angles;
-  for(size_t i = 1; i < sg.size(); ++i)
+  for(size_t i = 1; i < sphere_groups_.size(); ++i)
   {
-    // compute FK for group
-    if(!sg[i]->computeFK(empty_angles, frames))
-    {
-      ROS_ERROR("[cspace] Failed to compute FK for sphere group '%s'.", sg[i]->getName().c_str());
-      return false;
-    }
+    GroupContext &gctx = ctx.groups[i];
 
-    // check against world
-    if(!checkSpheresAgainstWorld(frames, sg[i]->getSpheres(low_res), verbose, visualize, g_spheres, dist_temp))
+    // check against world (these groups don't move, so their clearance isn't needed)
+    if(!checkSpheresAgainstWorld(sphere_groups_[i], &ctx.frames[group_frame_offsets_[i]], sphere_groups_[i]->getSpheres(low_res), verbose, visualize, gctx.sphere_poses, ctx.collision_spheres, dist_temp, NULL, ctx.use_bitmaps))
     {
       if(!visualize)
         return false;
@@ -309,15 +411,8 @@ bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, bool
     if(dist_temp < dist)
       dist = dist_temp;
 
-    /* 
-    sg[i]->getSpheres(spheres, low_res);
-    g_spheres.resize(spheres.size());
-    for(size_t j = 0; j < spheres.size(); ++j)
-      g_spheres[i] = frames[spheres[i]->kdl_chain][spheres[i]->kdl_segment] * spheres[i]->v;
-    */
-
     // check against default group spheres (TODO: change to all sphere groups)
-    if(!checkSphereGroupAgainstSphereGroup(model_.getDefaultGroup(), sg[i], dg_spheres, g_spheres, low_res, low_res, verbose, visualize, dist_temp))
+    if(!checkSphereGroupAgainstSphereGroup(sphere_groups_[0], sphere_groups_[i], dctx.sphere_poses, gctx.sphere_poses, low_res, low_res, verbose, visualize, ctx.collision_spheres, dist_temp, clearance_temp))
     {
       if(!visualize)
         return false;
@@ -325,7 +420,9 @@ bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, bool
         in_collision = true;
     }
     if(dist_temp < dist)
-      dist = dist_temp; 
+      dist = dist_temp;
+    if(clearance_temp < ctx.clearance)
+      ctx.clearance = clearance_temp;
   }
 
   if(visualize && in_collision)
@@ -336,32 +433,49 @@ bool SBPLCollisionSpace::checkCollision(const std::vector<double> &angles, bool
 
 bool SBPLCollisionSpace::checkSphereGroupAgainstWorld(const std::vector<double> &angles, Group *group, bool low_res, bool verbose, bool visualize, double &dist)
 {
-  std::vector<std::vector<KDL::Frame> > frames;
-  std::vector<Sphere*> spheres;
-  std::vector<KDL::Vector> sph_poses;
+  // use the group's slot in the preallocated context
+  size_t g = std::find(sphere_groups_.begin(), sphere_groups_.end(), group) - sphere_groups_.begin();
+  if(g == sphere_groups_.size() || ctx_.groups.size() != sphere_groups_.size())
+  {
+    ROS_ERROR("[cspace] '%s' is not a sphere group of the collision space.", group->getName().c_str());
+    return false;
+  }
 
   // compute FK for group
-  if(!group->computeFK(angles, frames))
+  KDL::Frame *frames = &ctx_.frames[group_frame_offsets_[g]];
+  if(!group->computeFK(angles, ctx_.groups[g], frames))
   {
     ROS_ERROR("[cspace] Failed to compute FK for sphere group '%s'.", group->getName().c_str());
     return false;
   }
-  return checkSpheresAgainstWorld(frames, group->getSpheres(low_res), verbose, visualize, sph_poses, dist); 
+
+  // the other groups' frames are cached for the robot state, now they aren't
+  if(g != 0)
+    ctx_.state_version = -1;
+
+  return checkSpheresAgainstWorld(group, frames, group->getSpheres(low_res), verbose, visualize, ctx_.groups[g].sphere_poses, dist); 
+}
+
+bool SBPLCollisionSpace::checkSpheresAgainstWorld(const Group *group, const KDL::Frame *frames, const std::vector<Sphere*> &spheres, bool verbose, bool visualize, std::vector<KDL::Vector> &sph_poses, double &dist)
+{
+  double clearance;
+  return checkSpheresAgainstWorld(group, frames, spheres, verbose, visualize, sph_poses, collision_spheres_, dist, &clearance, true);
 }
 
-bool SBPLCollisionSpace::checkSpheresAgainstWorld(const std::vector<std::vector<KDL::Frame> > &frames, const std::vector<Sphere*> &spheres, bool verbose, bool visualize, std::vector<KDL::Vector> &sph_poses, double &dist)
+bool SBPLCollisionSpace::checkSpheresAgainstWorld(const Group *group, const KDL::Frame *frames, const std::vector<Sphere*> &spheres, bool verbose, bool visualize, std::vector<KDL::Vector> &sph_poses, std::vector<Sphere> &collisions, double &dist, double *clearance, bool use_bitmaps) const
 {
   double dist_temp=100.0;
   dist = 100.0;
+  if(clearance)
+    *clearance = 100.0;
   int x,y,z;
   bool in_collision = false; 
   Sphere s;
   sph_poses.resize(spheres.size());
 
-  //ROS_INFO("frames: %d", int(frames.size()));
   for(size_t i = 0; i < spheres.size(); ++i)
   {
-    sph_poses[i] = frames[spheres[i]->kdl_chain][spheres[i]->kdl_segment] * spheres[i]->v;
+    sph_poses[i] = frames[group->getFrameIndex(spheres[i]->kdl_chain, spheres[i]->kdl_segment)] * spheres[i]->v;
 
     grid_->worldToGrid(sph_poses[i].x(), sph_poses[i].y(), sph_poses[i].z(), x, y, z);
 
@@ -373,19 +487,29 @@ bool SBPLCollisionSpace::checkSpheresAgainstWorld(const std::vector<std::vector<
       return false;
     }
 
+    // when the clearance isn't needed, a bit test is enough to clear the sphere
+    if(use_bitmaps && clearance == NULL && areBitmapsCurrent() && spheres[i]->radius_class >= 0 &&
+       !use_interpolated_distance_ && !isOccupiedForRadiusClass(spheres[i]->radius_class, x, y, z))
+      continue;
+
+    if(use_interpolated_distance_)
+      dist_temp = grid_->getInterpolatedDistance(sph_poses[i].x(), sph_poses[i].y(), sph_poses[i].z());
+    else
+      dist_temp = grid_->getDistance(x,y,z);
+
     // check for collision with world
-    if((dist_temp = grid_->getDistance(x,y,z)) <= (spheres[i]->radius + padding_))
+    if(dist_temp <= (spheres[i]->radius + padding_))
     {
       dist = dist_temp;
       if(verbose)
-        ROS_INFO("    [sphere: %d] name: %6s  x: %d y: %d z: %d radius: %0.3fm  dist: %0.3fm  *collision*", int(i), spheres[i]->name.c_str(), x, y, z, spheres[i]->radius + padding_, grid_->getDistance(x,y,z));
+        ROS_INFO("    [sphere: %d] name: %6s  x: %d y: %d z: %d radius: %0.3fm  dist: %0.3fm  *collision*", int(i), spheres[i]->name.c_str(), x, y, z, spheres[i]->radius + padding_, dist_temp);
 
       if(visualize)
       {
         in_collision = true;
         s = *(spheres[i]);
         s.v = sph_poses[i];
-        collision_spheres_.push_back(s);
+        collisions.push_back(s);
       }
       else
         return false;
@@ -393,6 +517,8 @@ bool SBPLCollisionSpace::checkSpheresAgainstWorld(const std::vector<std::vector<
 
     if(dist_temp < dist)
       dist = dist_temp;
+    if(clearance && dist_temp - spheres[i]->radius - padding_ < *clearance)
+      *clearance = dist_temp - spheres[i]->radius - padding_;
   }
 
   if(visualize && in_collision)
@@ -402,14 +528,20 @@ bool SBPLCollisionSpace::checkSpheresAgainstWorld(const std::vector<std::vector<
 }
 
 bool SBPLCollisionSpace::checkSphereGroupAgainstSphereGroup(Group *group1, Group *group2, const std::vector<KDL::Vector> &spheres1, const std::vector<KDL::Vector> &spheres2, bool low_res1, bool low_res2, bool verbose, bool visualize, double &dist)
+{
+  double clearance;
+  return checkSphereGroupAgainstSphereGroup(group1, group2, spheres1, spheres2, low_res1, low_res2, verbose, visualize, collision_spheres_, dist, clearance);
+}
+
+bool SBPLCollisionSpace::checkSphereGroupAgainstSphereGroup(Group *group1, Group *group2, const std::vector<KDL::Vector> &spheres1, const std::vector<KDL::Vector> &spheres2, bool low_res1, bool low_res2, bool verbose, bool visualize, std::vector<Sphere> &collisions, double &dist, double &clearance) const
 {
   bool in_collision = false;
   double d;
   dist = 100;
+  clearance = 100;
   Sphere s;
-  std::vector<Sphere*> gsph1, gsph2;
-  group1->getSpheres(gsph1, low_res1);
-  group2->getSpheres(gsph2, low_res2);
+  const std::vector<Sphere*> &gsph1 = group1->getSpheres(low_res1);
+  const std::vector<Sphere*> &gsph2 = group2->getSpheres(low_res2);
 
   if((gsph1.size() != spheres1.size()) || (gsph2.size() != spheres2.size()))
   {
@@ -438,10 +570,10 @@ bool SBPLCollisionSpace::checkSphereGroupAgainstSphereGroup(Group *group1, Group
           in_collision = true;
           s = *(gsph1[i]);
           s.v = spheres1[i];
-          collision_spheres_.push_back(s);
+          collisions.push_back(s);
           s = *(gsph2[j]);
           s.v = spheres2[j];
-          collision_spheres_.push_back(s);
+          collisions.push_back(s);
         }
         else
           return false;
@@ -449,6 +581,8 @@ bool SBPLCollisionSpace::checkSphereGroupAgainstSphereGroup(Group *group1, Group
 
       if(d < dist)
         dist = d;
+      if(d - max(gsph1[i]->radius + padding_, gsph2[j]->radius + padding_) < clearance)
+        clearance = d - max(gsph1[i]->radius + padding_, gsph2[j]->radius + padding_);
 
       cntr++;
     }
@@ -490,6 +624,7 @@ bool SBPLCollisionSpace::updateVoxelGroup(Group *g)
   std::vector<double> angles;
   std::vector<std::vector<KDL::Frame> > frames;
   std::vector<Eigen::Vector3d> pts;
+  size_t num_pts = 0;
   ROS_DEBUG("Updating voxel group: %s", g->getName().c_str());
   if(!model_.computeGroupFK(angles, g, frames))
   {
@@ -500,97 +635,197 @@ bool SBPLCollisionSpace::updateVoxelGroup(Group *g)
   for(size_t i = 0; i < g->links_.size(); ++i)
   {
     Link* l = &(g->links_[i]);
-    pts.clear();
-    pts.resize(l->voxels_.v.size());
+    pts.resize(num_pts + l->voxels_.v.size());
 
     ROS_DEBUG("Updating Voxel Group %s with %d voxels", g->getName().c_str(), int(l->voxels_.v.size())); 
-    for(size_t j = 0; j < l->voxels_.v.size(); ++j)
+    for(size_t j = 0; j < l->voxels_.v.size(); ++j, ++num_pts)
     {
       v = frames[l->voxels_.kdl_chain][l->voxels_.kdl_segment] * l->voxels_.v[j];
-      pts[j].x() = v.x();
-      pts[j].y() = v.y();
-      pts[j].z() = v.z();
-      ROS_DEBUG("[%s] [%d] xyz: %0.2f %0.2f %0.2f", g->getName().c_str(), int(j), pts[j].x(), pts[j].y(), pts[j].z());
+      pts[num_pts].x() = v.x();
+      pts[num_pts].y() = v.y();
+      pts[num_pts].z() = v.z();
+      ROS_DEBUG("[%s] [%d] xyz: %0.2f %0.2f %0.2f", g->getName().c_str(), int(j), pts[num_pts].x(), pts[num_pts].y(), pts[num_pts].z());
     }
-    grid_->addPointsToField(pts);
   }
+
+  // only the voxels that moved since the last update are changed in the grid
+  updateVoxelsInGrid(voxel_group_map_[g->getName()], pts);
+  voxel_group_map_[g->getName()].swap(pts);
   return true;
 }
 
 bool SBPLCollisionSpace::checkPathForCollision(const std::vector<double> &start, const std::vector<double> &end, bool verbose, int &path_length, int &num_checks, double &dist)
 {
-  std::vector<std::vector<std::vector<KDL::Frame> > > frames;
-  return checkPathForCollision(start, end, frames, verbose, path_length, num_checks, dist); 
+  return checkPathForCollision(start, end, ctx_, verbose, path_length, num_checks, dist); 
 }
 
-bool SBPLCollisionSpace::checkPathForCollision(const std::vector<double> &start, const std::vector<double> &end, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, bool verbose, int &path_length, int &num_checks, double &dist)
+bool SBPLCollisionSpace::checkPathForCollision(const std::vector<double> &start, const std::vector<double> &end, CollisionContext &ctx, bool verbose, int &path_length, int &num_checks, double &dist) const
 {
-  int inc_cc = 5;
   double dist_temp = 0;
-  std::vector<double> start_norm(start);
-  std::vector<double> end_norm(end);
-  std::vector<std::vector<double> > path;
   dist = 100;
   num_checks = 0;
 
-  for(size_t i=0; i < start.size(); ++i)
-  {
-    start_norm[i] = angles::normalize_angle(start[i]);
-    end_norm[i] = angles::normalize_angle(end[i]);
-  }
-
-  if(!interpolatePath(start_norm, end_norm, inc_, path))
+  if(!getPathDelta(start, end, ctx, path_length))
   {
     path_length = 0;
     ROS_ERROR_ONCE("[cspace] Failed to interpolate the path. It's probably infeasible due to joint limits.");
-    ROS_ERROR("[interpolate]  start: % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f", start_norm[0], start_norm[1], start_norm[2], start_norm[3], start_norm[4], start_norm[5], start_norm[6]);
-    ROS_ERROR("[interpolate]    end: % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f", end_norm[0], end_norm[1], end_norm[2], end_norm[3], end_norm[4], end_norm[5], end_norm[6]);
-    ROS_ERROR("[interpolate]    min: % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f", min_limits_[0], min_limits_[1], min_limits_[2], min_limits_[3], min_limits_[4], min_limits_[5], min_limits_[6]);
-    ROS_ERROR("[interpolate]    max: % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f % 0.3f", max_limits_[0], max_limits_[1], max_limits_[2], max_limits_[3], max_limits_[4], max_limits_[5], max_limits_[6]);
     return false;
   }
 
-  // for debugging & statistical purposes
-  path_length = path.size();
+  if(use_conservative_advancement_ && !motion_bounds_.empty())
+    return checkPathConservatively(ctx, path_length, verbose, num_checks, dist);
 
-  // try to find collisions that might come later in the path earlier
-  if(int(path.size()) > inc_cc)
+  // the waypoints are generated on the fly in bisection order (midpoint,
+  // quarter points, ...) so that collisions in the middle of the path, where
+  // they are most likely, are found first. the endpoints are checked last.
+  int n = path_length;
+  if(n > 2)
   {
-    for(int i = 0; i < inc_cc; i++)
+    long P = 1;
+    while(P < n-1)
+      P <<= 1;
+
+    for(long step = P; step >= 2; step >>= 1)
     {
-      for(size_t j = i; j < path.size(); j=j+inc_cc)
+      for(long k = step/2; k < P; k += step)
       {
+        // waypoint k of P, rounded to the nearest of the n waypoints. skip
+        // it if a waypoint from an earlier level already rounded to it.
+        int w = getPathWaypointIndex(k, n, P);
+        if(w == 0 || w == n-1 ||
+           getPathWaypointIndex(k - step/2, n, P) == w ||
+           getPathWaypointIndex(k + step/2, n, P) == w)
+          continue;
+
         num_checks++;
-        if(!isStateValid(path[j], frames, verbose, false, dist_temp))
+        if(!isPathPointValid(ctx, double(w) / double(std::max(n-1, 1)), verbose, dist_temp))
         {
           dist = dist_temp;
-          return false; 
+          return false;
         }
-
         if(dist_temp < dist)
           dist = dist_temp;
       }
     }
   }
-  else
+
+  // the end of the path, then the start
+  for(int w = n-1; w >= 0; w = (w > 0) ? 0 : -1)
   {
-    for(size_t i = 0; i < path.size(); i++)
+    num_checks++;
+    if(!isPathPointValid(ctx, double(w) / double(std::max(n-1, 1)), verbose, dist_temp))
     {
-      num_checks++;
-      if(!isStateValid(path[i], frames, verbose, false, dist_temp))
+      dist = dist_temp;
+      return false;
+    }
+    if(dist_temp < dist)
+      dist = dist_temp;
+  }
+
+  return true;
+}
+
+bool SBPLCollisionSpace::getPathDelta(const std::vector<double> &start, const std::vector<double> &end, CollisionContext &ctx, int &path_length) const
+{
+  double waypoints = 0;
+  ctx.path_start.resize(start.size());
+  ctx.path_delta.resize(start.size());
+  ctx.waypoint.resize(start.size());
+
+  for(size_t i = 0; i < start.size(); ++i)
+  {
+    double s = angles::normalize_angle(start[i]);
+    double e = angles::normalize_angle(end[i]);
+
+    if(continuous_[i])
+      ctx.path_delta[i] = angles::shortest_angular_distance(s, e);
+    else
+    {
+      // the joint can't wrap around, so both ends have to be inside the limits
+      if(!getAngleWithinLimits(i, s) || !getAngleWithinLimits(i, e))
       {
-        dist = dist_temp;
+        ROS_DEBUG("[cspace] Joint %d is out of bounds. (start: % 0.3f  end: % 0.3f  min: % 0.3f  max: % 0.3f)", int(i), s, e, min_limits_[i], max_limits_[i]);
         return false;
       }
-
-      if(dist_temp < dist)
-        dist = dist_temp;
+      ctx.path_delta[i] = e - s;
     }
+    ctx.path_start[i] = s;
+
+    if(fabs(ctx.path_delta[i]) / inc_[i] > waypoints)
+      waypoints = fabs(ctx.path_delta[i]) / inc_[i];
   }
 
+  path_length = int(ceil(waypoints)) + 1;
   return true;
 }
 
+bool SBPLCollisionSpace::getAngleWithinLimits(size_t joint, double &angle) const
+{
+  if(angle < min_limits_[joint])
+    angle += 2*M_PI;
+  else if(angle > max_limits_[joint])
+    angle -= 2*M_PI;
+
+  return (angle >= min_limits_[joint]) && (angle <= max_limits_[joint]);
+}
+
+bool SBPLCollisionSpace::checkPathConservatively(CollisionContext &ctx, int path_length, bool verbose, int &num_checks, double &dist) const
+{
+  double t = 0.0, step, dist_temp = 0;
+  double motion = 0;
+  dist = 100;
+
+  // upper bound on how far any sphere center moves over the whole path
+  for(size_t i = 0; i < ctx.path_delta.size(); ++i)
+    motion += motion_bounds_[i] * fabs(ctx.path_delta[i]);
+
+  // distances are measured from the center of the cell that a sphere is in,
+  // so they're only good to within a cell diagonal at either end of a step
+  double margin = sqrt(3.0) * grid_->getResolution();
+  bool valid = true;
+
+  // never step farther than the regular waypoint spacing when the clearance
+  // is too small to prove anything
+  double min_step = 1.0 / double(std::max(path_length-1, 1));
+
+  // the step size comes from the distance field, so skip the bitmaps
+  ctx.need_clearance = true;
+  while(true)
+  {
+    num_checks++;
+    if(!isPathPointValid(ctx, t, verbose, dist_temp))
+    {
+      dist = dist_temp;
+      valid = false;
+      break;
+    }
+    if(dist_temp < dist)
+      dist = dist_temp;
+
+    if(t >= 1.0)
+      break;
+
+    // no sphere can reach an obstacle before moving farther than its clearance
+    step = min_step;
+    if(motion > 0 && (ctx.clearance - margin) / motion > step)
+      step = (ctx.clearance - margin) / motion;
+    t = std::min(t + step, 1.0);
+  }
+  ctx.need_clearance = false;
+  return valid;
+}
+
+bool SBPLCollisionSpace::isPathPointValid(CollisionContext &ctx, double t, bool verbose, double &dist) const
+{
+  for(size_t i = 0; i < ctx.waypoint.size(); ++i)
+    ctx.waypoint[i] = ctx.path_start[i] + t * ctx.path_delta[i];
+
+  if(!computeFK(&ctx.waypoint[0], ctx.waypoint.size(), ctx))
+    return false;
+
+  return checkCollision(ctx, verbose, false, dist);
+}
+
 double SBPLCollisionSpace::isValidLineSegment(const std::vector<int> a, const std::vector<int> b, const int radius)
 {
   leatherman::bresenham3d_param_t params;
@@ -684,10 +919,16 @@ bool SBPLCollisionSpace::getCollisionSpheres(const std::vector<double> &angles,
   return true;
 }
 
+bool SBPLCollisionSpace::getCollisionSpheres(const std::vector<double> &angles, std::vector<std::vector<double> > &spheres)
+{
+  return getCollisionSpheres(angles, model_.getGroup(group_name_), false, spheres);
+}
+
 void SBPLCollisionSpace::setJointPosition(std::string name, double position)
 {
   ROS_DEBUG("[cspace] Setting %s with position = %0.3f.", name.c_str(), position);
   model_.setJointPosition(name, position);
+  state_version_++;
 }
 
 bool SBPLCollisionSpace::interpolatePath(const std::vector<double>& start,
@@ -741,35 +982,118 @@ bool SBPLCollisionSpace::getClearance(const std::vector<double> &angles, int num
 
 bool SBPLCollisionSpace::isStateValid(const std::vector<double> &angles, bool verbose, bool visualize, double &dist)
 {
-  ROS_DEBUG("Calling old isStateValid()");
+  refreshOccupancyBitmaps();
   return checkCollision(angles, verbose, visualize, dist);
 }
 
-bool SBPLCollisionSpace::isStateValid(const std::vector<double> &angles, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, bool verbose, bool visualize, double &dist)
+CollisionCheckerContext* SBPLCollisionSpace::createContext() const
 {
-  if(!frames.empty())
-    frames[0].clear();
+  CollisionContext *ctx = new CollisionContext();
+  if(!initContext(*ctx))
+  {
+    delete ctx;
+    return NULL;
+  }
+  ctx->use_bitmaps = false;
+  return ctx;
+}
 
-  if(!use_multi_level_collision_check_)
-    return checkCollision(angles, false, verbose, visualize, dist);
-  else
+bool SBPLCollisionSpace::isStateValid(const std::vector<double> &angles, CollisionCheckerContext &ctx, bool verbose, double &dist) const
+{
+  return isStateValid(angles, static_cast<CollisionContext&>(ctx), verbose, false, dist);
+}
+
+bool SBPLCollisionSpace::isStateValid(const std::vector<double> &angles, CollisionContext &ctx, bool verbose, double &dist) const
+{
+  return isStateValid(angles, ctx, verbose, false, dist);
+}
+
+bool SBPLCollisionSpace::isStateValid(const std::vector<double> &angles, CollisionContext &ctx, bool verbose, bool visualize, double &dist) const
+{
+  if(!computeFK(angles.empty() ? NULL : &angles[0], angles.size(), ctx))
+    return false;
+
+  return checkCollision(ctx, verbose, visualize, dist);
+}
+
+bool SBPLCollisionSpace::isStatesValid(const double *configs, int num_joints, size_t n, bool verbose, unsigned char *valid, double *dist)
+{
+  refreshOccupancyBitmaps();
+  return isStatesValid(configs, num_joints, n, ctx_, verbose, valid, dist);
+}
+
+bool SBPLCollisionSpace::isStatesValid(const double *configs, int num_joints, size_t n, CollisionContext &ctx, bool verbose, unsigned char *valid, double *dist) const
+{
+  bool v, all_valid = true;
+  double d;
+
+  // the FK solvers, the non-planning groups and the sphere lists are set up
+  // once and shared by every configuration in the batch
+  for(size_t i = 0; i < n; ++i)
   {
+    d = 0;
+    v = computeFK(configs + i*num_joints, num_joints, ctx) && checkCollision(ctx, verbose, false, d);
+
+    if(valid != NULL)
+      valid[i] = v;
+    if(dist != NULL)
+      dist[i] = d;
+    all_valid = all_valid && v;
+  }
+  return all_valid;
+}
 
-    if(checkCollision(angles, frames, true, verbose, visualize, dist))
-      return true;
-    else
-      return checkCollision(angles, frames, false, verbose, visualize, dist);
+bool SBPLCollisionSpace::isStatesValid(const double *configs, int num_joints, const int *group_ends, size_t num_groups, bool verbose, unsigned char *valid, double *dist)
+{
+  refreshOccupancyBitmaps();
+  return isStatesValid(configs, num_joints, group_ends, num_groups, ctx_, verbose, valid, dist);
+}
+
+bool SBPLCollisionSpace::isStatesValid(const double *configs, int num_joints, const int *group_ends, size_t num_groups, CollisionContext &ctx, bool verbose, unsigned char *valid, double *dist) const
+{
+  bool v, all_valid = true;
+  double d;
+  int begin = 0;
+
+  for(size_t g = 0; g < num_groups; ++g)
+  {
+    // the rest of a group is skipped once one of its configurations fails
+    v = true;
+    for(int i = begin; i < group_ends[g]; ++i)
+    {
+      d = 0;
+      if(v)
+        v = computeFK(configs + i*num_joints, num_joints, ctx) && checkCollision(ctx, verbose, false, d);
+
+      if(valid != NULL)
+        valid[i] = v;
+      if(dist != NULL)
+        dist[i] = d;
+    }
+    all_valid = all_valid && v;
+    begin = group_ends[g];
   }
+  return all_valid;
+}
+
+bool SBPLCollisionSpace::checkCollision(CollisionContext &ctx, bool verbose, bool visualize, double &dist) const
+{
+  // the low-res spheres enclose the full model, so if they are clear we're done
+  if(use_multi_level_collision_check_ && checkCollision(ctx, true, verbose, visualize, dist))
+    return true;
+
+  return checkCollision(ctx, false, verbose, visualize, dist);
 }
 
 bool SBPLCollisionSpace::isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, int &path_length, int &num_checks, double &dist)
 {
+  refreshOccupancyBitmaps();
   return checkPathForCollision(angles0, angles1, false, path_length, num_checks, dist);
 }
 
-bool SBPLCollisionSpace::isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, int &path_length, int &num_checks, double &dist)
+bool SBPLCollisionSpace::isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, CollisionContext &ctx, int &path_length, int &num_checks, double &dist) const
 {
-  return checkPathForCollision(angles0, angles1, frames, false, path_length, num_checks, dist);
+  return checkPathForCollision(angles0, angles1, ctx, false, path_length, num_checks, dist);
 }
 
 void SBPLCollisionSpace::setRobotState(const arm_navigation_msgs::RobotState &state)
@@ -779,6 +1103,7 @@ void SBPLCollisionSpace::setRobotState(const arm_navigation_msgs::RobotState &st
 
   for(size_t i = 0; i < state.joint_state.name.size(); ++i)
     model_.setJointPosition(state.joint_state.name[i], state.joint_state.position[i]);
+  state_version_++;
 
   /*
   grid_->reset();
@@ -801,17 +1126,12 @@ bool SBPLCollisionSpace::setPlanningScene(const arm_navigation_msgs::PlanningSce
     ROS_ERROR("Failed to set the model-to-world transform. The collision model's frame is different from the collision map's frame.");
     return false;
   }
+  state_version_++;
 
-  // reset the distance field (TODO...shouldn't have to reset everytime)
-  grid_->reset();
-
-  // collision objects
+  // collision objects (only the ones that were added, moved or removed
+  // since the last scene are changed in the distance field)
   for(size_t i = 0; i < scene.collision_objects.size(); ++i)
-  {
-    object_map_[scene.collision_objects[i].id] = scene.collision_objects[i];
     processCollisionObjectMsg(scene.collision_objects[i]);
-  }
-  putCollisionObjectsInGrid();
 
   // attached collision objects
   if(!setAttachedObjects(scene.attached_collision_objects))
@@ -821,11 +1141,13 @@ bool SBPLCollisionSpace::setPlanningScene(const arm_navigation_msgs::PlanningSce
   if(scene.collision_map.header.frame_id.compare(grid_->getReferenceFrame()) != 0)
     ROS_WARN_ONCE("collision_map_occ is in %s not in %s", scene.collision_map.header.frame_id.c_str(), grid_->getReferenceFrame().c_str());
 
-  if(!scene.collision_map.boxes.empty())
-    grid_->updateFromCollisionMap(scene.collision_map);
+  // the collision map replaces the grid's dynamic layer
+  grid_->updateFromCollisionMap(scene.collision_map);
 
   // self collision
   updateVoxelGroups();
+
+  refreshOccupancyBitmaps();
   return true;
 }
 
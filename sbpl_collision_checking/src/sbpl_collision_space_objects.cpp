@@ -34,10 +34,51 @@
 namespace sbpl_arm_planner
 {
 
+static bool isSamePose(const geometry_msgs::Pose &a, const geometry_msgs::Pose &b)
+{
+  return a.position.x == b.position.x && a.position.y == b.position.y && a.position.z == b.position.z &&
+         a.orientation.x == b.orientation.x && a.orientation.y == b.orientation.y &&
+         a.orientation.z == b.orientation.z && a.orientation.w == b.orientation.w;
+}
+
+static bool isSameShape(const arm_navigation_msgs::Shape &a, const arm_navigation_msgs::Shape &b)
+{
+  if(a.type != b.type || a.dimensions != b.dimensions || a.triangles != b.triangles || a.vertices.size() != b.vertices.size())
+    return false;
+
+  for(size_t i = 0; i < a.vertices.size(); ++i)
+  {
+    if(a.vertices[i].x != b.vertices[i].x || a.vertices[i].y != b.vertices[i].y || a.vertices[i].z != b.vertices[i].z)
+      return false;
+  }
+  return true;
+}
+
+/* true if the two objects have the same shapes at the same poses */
+static bool isSameCollisionObject(const arm_navigation_msgs::CollisionObject &a, const arm_navigation_msgs::CollisionObject &b)
+{
+  if(a.header.frame_id.compare(b.header.frame_id) != 0 || a.shapes.size() != b.shapes.size() || a.poses.size() != b.poses.size())
+    return false;
+
+  for(size_t i = 0; i < a.shapes.size(); ++i)
+  {
+    if(!isSameShape(a.shapes[i], b.shapes[i]))
+      return false;
+  }
+
+  for(size_t i = 0; i < a.poses.size(); ++i)
+  {
+    if(!isSamePose(a.poses[i], b.poses[i]))
+      return false;
+  }
+  return true;
+}
+
 void SBPLCollisionSpace::removeAttachedObject()
 {
   object_attached_ = false;
   object_spheres_.clear();
+  updateAttachedSpheres();
   ROS_DEBUG("[cspace] Removed attached object.");
 }
 
@@ -58,6 +99,7 @@ void SBPLCollisionSpace::attachSphere(std::string name, std::string link, geomet
 
   ROS_DEBUG("[cspace] frame: %s  group: %s  chain: %d  segment: %d", attached_object_frame_.c_str(), group_name_.c_str(), attached_object_chain_num_, attached_object_segment_num_); 
   ROS_INFO("[cspace] Attached '%s' sphere.  xyz: %0.3f %0.3f %0.3f   radius: %0.3fm", name.c_str(), object_spheres_[0].v.x(), object_spheres_[0].v.y(), object_spheres_[0].v.z(), radius);
+  updateAttachedSpheres();
 }
 
 void SBPLCollisionSpace::attachCylinder(std::string link, geometry_msgs::Pose pose, double radius, double length)
@@ -92,6 +134,7 @@ void SBPLCollisionSpace::attachCylinder(std::string link, geometry_msgs::Pose po
   ROS_INFO("[cspace] [attached_object]  frame: %s  group: %s  chain: %d  segment: %d", attached_object_frame_.c_str(), group_name_.c_str(), attached_object_chain_num_, attached_object_segment_num_); 
   ROS_INFO("[cspace] [attached_object]    top: xyz: %0.3f %0.3f %0.3f  radius: %0.3fm", top.x(), top.y(), top.z(), radius);
   ROS_INFO("[cspace] [attached_object] bottom: xyz: %0.3f %0.3f %0.3f  radius: %0.3fm", bottom.x(), bottom.y(), bottom.z(), radius);
+  updateAttachedSpheres();
 }
 
 void SBPLCollisionSpace::attachCube(std::string name, std::string link, geometry_msgs::Pose pose, double x_dim, double y_dim, double z_dim)
@@ -118,7 +161,6 @@ void SBPLCollisionSpace::attachCube(std::string name, std::string link, geometry
   KDL::Frame center;
   tf::PoseMsgToKDL(pose, center);
   object_spheres_.resize(spheres.size());
-  object_spheres_p_.resize(spheres.size());
   for(size_t i = 0; i < spheres.size(); ++i)
   {
     object_spheres_[i].v.x(spheres[i][0]);
@@ -130,11 +172,10 @@ void SBPLCollisionSpace::attachCube(std::string name, std::string link, geometry
     object_spheres_[i].radius = object_enclosing_sphere_radius_;
     object_spheres_[i].kdl_chain = attached_object_chain_num_;
     object_spheres_[i].kdl_segment = attached_object_segment_num_;
-
-    object_spheres_p_[i] = &(object_spheres_[i]);
   }
   ROS_DEBUG("[cspace] Attaching '%s' represented by %d spheres with dimensions: %0.3f %0.3f %0.3f", name.c_str(), int(spheres.size()), x_dim, y_dim, z_dim);
   ROS_DEBUG("[cspace] ['%s' pose] xyz: %0.3f %0.3f %0.3f  quat: %0.3f %0.3f %0.3f %0.3f", name.c_str(), pose.position.x,pose.position.y,pose.position.z, pose.orientation.x, pose.orientation.y, pose.orientation.z, pose.orientation.w); 
+  updateAttachedSpheres();
 }
 
 void SBPLCollisionSpace::attachMesh(std::string name, std::string link, geometry_msgs::Pose pose, const std::vector<geometry_msgs::Point> &vertices, const std::vector<int> &triangles)
@@ -162,6 +203,7 @@ void SBPLCollisionSpace::attachMesh(std::string name, std::string link, geometry
   }
 
   ROS_INFO("[cspace] Attaching '%s' represented by %d spheres with %d vertices and %d triangles.", name.c_str(), int(spheres.size()), int(vertices.size()), int(triangles.size()));
+  updateAttachedSpheres();
 }
 
 bool SBPLCollisionSpace::getAttachedObject(const std::vector<double> &angles, std::vector<std::vector<double> > &xyz)
@@ -204,6 +246,13 @@ void SBPLCollisionSpace::processCollisionObjectMsg(const arm_navigation_msgs::Co
   }
   else if(object.operation.operation == arm_navigation_msgs::CollisionObjectOperation::ADD)
   {
+    // nothing to do if the object hasn't changed since it was last added
+    if(std::find(known_objects_.begin(), known_objects_.end(), object.id) != known_objects_.end() &&
+       isSameCollisionObject(object_map_[object.id], object))
+    {
+      ROS_DEBUG("[cspace] Collision object '%s' hasn't changed.", object.id.c_str());
+      return;
+    }
     object_map_[object.id] = object;
     addCollisionObject(object);
   }
@@ -217,7 +266,12 @@ void SBPLCollisionSpace::processCollisionObjectMsg(const arm_navigation_msgs::Co
 
 void SBPLCollisionSpace::addCollisionObject(const arm_navigation_msgs::CollisionObject &object)
 {
+  // voxels of the previous version of the object, if there is one
+  std::vector<Eigen::Vector3d> old_voxels;
+  old_voxels.swap(object_voxel_map_[object.id]);
 
+  // the voxels of all of the shapes are appended to the object's list
+  std::vector<Eigen::Vector3d> &object_voxels = object_voxel_map_[object.id];
   for(size_t i = 0; i < object.shapes.size(); ++i)
   {
     if(object.shapes[i].type == arm_navigation_msgs::Shape::BOX)
@@ -226,55 +280,28 @@ void SBPLCollisionSpace::addCollisionObject(const arm_navigation_msgs::Collision
       dims[0] = object.shapes[i].dimensions[0];
       dims[1] = object.shapes[i].dimensions[1];
       dims[2] = object.shapes[i].dimensions[2];
-      object_voxel_map_[object.id].clear();
-      grid_->getOccupiedVoxels(object.poses[i], dims, object_voxel_map_[object.id]);
+      grid_->getOccupiedVoxels(object.poses[i], dims, object_voxels);
+    }
+    else if(object.shapes[i].type == arm_navigation_msgs::Shape::CYLINDER)
+    {
+      grid_->getOccupiedCylinderVoxels(object.poses[i], object.shapes[i].dimensions[0], object.shapes[i].dimensions[1], object_voxels);
     }
     else if(object.shapes[i].type == arm_navigation_msgs::Shape::SPHERE)
     {
-      std::vector<std::vector<double> > voxels;
-      sbpl::Voxelizer::voxelizeSphere(object.shapes[i].dimensions[0], object.poses[i], grid_->getResolution(), voxels, true);
-      object_voxel_map_[object.id].clear();
-      object_voxel_map_[object.id].resize(voxels.size());
-
-      // transform into the world frame
-      Eigen::Affine3d m = Eigen::Affine3d(Eigen::Translation3d(object.poses[i].position.x, object.poses[i].position.y, object.poses[i].position.z)*Eigen::Quaterniond(object.poses[i].orientation.x, object.poses[i].orientation.y, object.poses[i].orientation.z, object.poses[i].orientation.w).toRotationMatrix());
-      for(size_t j = 0; j <  voxels.size(); ++j)
-      {
-        if(voxels[j].size() < 3)
-        {
-          ROS_ERROR("[cspace] Expected 'voxels' to have length 3.");
-          continue;
-        }
-        object_voxel_map_[object.id][j].x() = (voxels[j][0]);
-        object_voxel_map_[object.id][j].y() = (voxels[j][1]);
-        object_voxel_map_[object.id][j].z() = (voxels[j][2]);
-        object_voxel_map_[object.id][j] = m.rotation() * object_voxel_map_[object.id][j];
-        object_voxel_map_[object.id][j] += m.translation();
-      }
+      grid_->getOccupiedSphereVoxels(object.poses[i], object.shapes[i].dimensions[0], object_voxels);
     }
-
     else if(object.shapes[i].type == arm_navigation_msgs::Shape::MESH)
     {
-      std::vector<std::vector<double> > voxels;
-      sbpl::Voxelizer::voxelizeMesh(object.shapes[i].vertices, object.shapes[i].triangles, grid_->getResolution(), voxels, true);
-      object_voxel_map_[object.id].clear();
-      object_voxel_map_[object.id].resize(voxels.size());
+      // voxelized in the mesh frame, so a resent object only gets re-posed
+      std::vector<Eigen::Vector3d> voxels;
+      VoxelCache::getInstance()->getMeshVoxels(object.shapes[i].vertices, object.shapes[i].triangles, grid_->getResolution(), true, voxels);
+      size_t offset = object_voxels.size();
+      object_voxels.resize(offset + voxels.size());
       
       // transform into the world frame
-      Eigen::Affine3d m = Eigen::Affine3d(Eigen::Translation3d(object.poses[i].position.x, object.poses[i].position.y, object.poses[i].position.z)*Eigen::Quaterniond(object.poses[i].orientation.x, object.poses[i].orientation.y, object.poses[i].orientation.z, object.poses[i].orientation.w).toRotationMatrix());
+      Eigen::Affine3d m = Eigen::Affine3d(Eigen::Translation3d(object.poses[i].position.x, object.poses[i].position.y, object.poses[i].position.z)*Eigen::Quaterniond(object.poses[i].orientation.w, object.poses[i].orientation.x, object.poses[i].orientation.y, object.poses[i].orientation.z).toRotationMatrix());
       for(size_t j = 0; j <  voxels.size(); ++j)
-      {
-        if(voxels[j].size() < 3)
-        {
-          ROS_ERROR("[cspace] Expected 'voxels' to have length 3.");
-          continue;
-        }
-        object_voxel_map_[object.id][j].x() = (voxels[j][0]);
-        object_voxel_map_[object.id][j].y() = (voxels[j][1]);
-        object_voxel_map_[object.id][j].z() = (voxels[j][2]);
-        object_voxel_map_[object.id][j] = m.rotation() * object_voxel_map_[object.id][j];
-        object_voxel_map_[object.id][j] += m.translation();
-      }
+        object_voxels[offset+j] = m * voxels[j];
     }
     else
       ROS_WARN("[cspace] Collision objects of type %d are not yet supported.", object.shapes[i].type);
@@ -294,7 +321,7 @@ void SBPLCollisionSpace::addCollisionObject(const arm_navigation_msgs::Collision
   if(new_object)
     known_objects_.push_back(object.id);
 
-  grid_->addPointsToField(object_voxel_map_[object.id]);
+  updateVoxelsInGrid(old_voxels, object_voxel_map_[object.id]);
 }
 
 void SBPLCollisionSpace::removeCollisionObject(const arm_navigation_msgs::CollisionObject &object)
@@ -303,17 +330,71 @@ void SBPLCollisionSpace::removeCollisionObject(const arm_navigation_msgs::Collis
   {
     if(known_objects_[i].compare(object.id) == 0)
     {
+      updateVoxelsInGrid(object_voxel_map_[object.id], std::vector<Eigen::Vector3d>());
+      object_voxel_map_.erase(object.id);
+      object_map_.erase(object.id);
       known_objects_.erase(known_objects_.begin() + i);
       ROS_INFO("[cspace] Removing %s from list of known collision objects.", object.id.c_str());
+      break;
     }
   }
 }
 
 void SBPLCollisionSpace::removeAllCollisionObjects()
 {
+  std::vector<Eigen::Vector3d> old_voxels;
+  for(size_t i = 0; i < known_objects_.size(); ++i)
+    old_voxels.insert(old_voxels.end(), object_voxel_map_[known_objects_[i]].begin(), object_voxel_map_[known_objects_[i]].end());
+
+  updateVoxelsInGrid(old_voxels, std::vector<Eigen::Vector3d>());
+  object_voxel_map_.clear();
+  object_map_.clear();
   known_objects_.clear();
 }
 
+void SBPLCollisionSpace::updateVoxelsInGrid(const std::vector<Eigen::Vector3d> &old_voxels, const std::vector<Eigen::Vector3d> &new_voxels)
+{
+  int x, y, z, dim_x, dim_y, dim_z;
+  size_t cell;
+  std::vector<Eigen::Vector3d> removed, added;
+  boost::unordered_map<size_t, unsigned short>::iterator it;
+  grid_->getGridSize(dim_x, dim_y, dim_z);
+
+  // count the new voxels first so that the cells in both lists are untouched
+  for(size_t i = 0; i < new_voxels.size(); ++i)
+  {
+    grid_->worldToGrid(new_voxels[i].x(), new_voxels[i].y(), new_voxels[i].z(), x, y, z);
+    if(!grid_->isInBounds(x, y, z))
+      continue;
+    cell = (size_t(x) * dim_y + y) * dim_z + z;
+    if(++voxel_counts_[cell] == 1)
+      added.push_back(new_voxels[i]);
+  }
+
+  for(size_t i = 0; i < old_voxels.size(); ++i)
+  {
+    grid_->worldToGrid(old_voxels[i].x(), old_voxels[i].y(), old_voxels[i].z(), x, y, z);
+    if(!grid_->isInBounds(x, y, z))
+      continue;
+    cell = (size_t(x) * dim_y + y) * dim_z + z;
+    it = voxel_counts_.find(cell);
+    if(it == voxel_counts_.end())
+      continue;
+    if(--it->second == 0)
+    {
+      voxel_counts_.erase(it);
+      removed.push_back(old_voxels[i]);
+    }
+  }
+
+  if(removed.empty() && added.empty())
+    return;
+
+  ROS_DEBUG("[cspace] Updating the grid. (removed: %d  added: %d)", int(removed.size()), int(added.size()));
+  grid_->updatePointsInField(removed, added);
+  bitmaps_valid_ = false;
+}
+
 void SBPLCollisionSpace::putCollisionObjectsInGrid()
 {
   ROS_DEBUG("[cspace] Putting %d known objects in grid.", int(known_objects_.size()));
@@ -322,6 +403,7 @@ void SBPLCollisionSpace::putCollisionObjectsInGrid()
     grid_->addPointsToField(object_voxel_map_[known_objects_[i]]);
     ROS_DEBUG("[cspace] [%d] Added %s to grid with %d voxels.", int(i), known_objects_[i].c_str(), int(object_voxel_map_[known_objects_[i]].size()));
   }
+  bitmaps_valid_ = false;
 }
 
 void SBPLCollisionSpace::getCollisionObjectVoxelPoses(std::vector<geometry_msgs::Pose> &points)
@@ -331,7 +331,6 @@ int main(int argc, char **argv)
   ROS_INFO("visualize:  %d", visualize);
   ROS_INFO("-------------------------------------------------------------------------");
   double prep_time, ptps;
-  std::vector<std::vector<std::vector<KDL::Frame> > > frames;
 
   /*
   if(test_timing)
@@ -411,19 +410,16 @@ int main(int argc, char **argv)
         // Timing test: Compute # collisions per second
         if(test_timing) 
         {
-          if(!frames.empty())
-            frames[0].clear();
-
           if(multi_level_check)
           {
-            if(!cspace->isStateValid(ranglesv[i], frames, false, visualize, dist))
+            if(!cspace->isStateValid(ranglesv[i], false, visualize, dist))
               invalid++;
             else
               valid++;
           }
           else
           {
-            if(!cspace->checkCollision(ranglesv[i], frames, low_res, false, visualize, dist))
+            if(!cspace->checkCollision(ranglesv[i], low_res, false, visualize, dist))
               invalid++;
             else
               valid++;
@@ -96,8 +96,31 @@ bool TestSBPLCollisionSpace::init()
 
   resolution_ = 0.01;
 
+  // "propagation", "compact" or "sparse"
+  std::string grid_backend;
+  node_handle_.param<std::string>("collision_space/occupancy_grid/backend", grid_backend, "propagation");
+  sbpl_arm_planner::OccupancyGrid::Backend backend = sbpl_arm_planner::OccupancyGrid::PROPAGATION_DISTANCE_FIELD;
+  if(grid_backend.compare("compact") == 0)
+    backend = sbpl_arm_planner::OccupancyGrid::COMPACT_DISTANCE_FIELD;
+  else if(grid_backend.compare("sparse") == 0)
+    backend = sbpl_arm_planner::OccupancyGrid::SPARSE_DISTANCE_FIELD;
+  bool use_compact_grid = (backend == sbpl_arm_planner::OccupancyGrid::COMPACT_DISTANCE_FIELD);
+  int num_propagation_threads;
+  node_handle_.param("collision_space/occupancy_grid/num_propagation_threads", num_propagation_threads, 0);
+
   ROS_INFO("[test] Creating the grid.");
-  grid_ = new sbpl_arm_planner::OccupancyGrid(sizeX_, sizeY_, sizeZ_, resolution_, originX_, originY_, originZ_);
+  grid_ = new sbpl_arm_planner::OccupancyGrid(sizeX_, sizeY_, sizeZ_, resolution_, originX_, originY_, originZ_, backend);
+  if(use_compact_grid && num_propagation_threads > 0)
+    grid_->setNumPropagationThreads(num_propagation_threads);
+
+  // a precomputed static scene
+  std::string snapshot_filename;
+  node_handle_.param<std::string>("collision_space/occupancy_grid/snapshot", snapshot_filename, "");
+  if(!snapshot_filename.empty() && use_compact_grid)
+  {
+    if(!grid_->loadGridFromBinaryFile(snapshot_filename))
+      ROS_WARN("[test] Failed to load the grid snapshot from %s.", snapshot_filename.c_str());
+  }
   
   ROS_INFO("[test] Creating the collision space."); 
   cspace_ = new sbpl_arm_planner::SBPLCollisionSpace(grid_);
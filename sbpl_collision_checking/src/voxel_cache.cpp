@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2011, Willow Garage, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of Willow Garage, Inc. nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/** \author Benjamin Cohen */
+
+#include <sbpl_collision_checking/voxel_cache.h>
+#include <sbpl_geometry_utils/Voxelizer.h>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+namespace sbpl_arm_planner
+{
+
+static const char VOXEL_FILE_MAGIC[8] = {'S','B','P','L','V','O','X','2'};
+
+/* 64-bit FNV-1a */
+static void hashBytes(uint64_t &h, const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char*)data;
+  for(size_t i = 0; i < size; ++i)
+  {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+}
+
+/* about 100MB of voxels */
+static const size_t DEFAULT_MAX_VOXELS = 4000000;
+
+VoxelCache::VoxelCache() : num_voxels_(0), max_voxels_(DEFAULT_MAX_VOXELS)
+{
+}
+
+VoxelCache* VoxelCache::getInstance()
+{
+  static VoxelCache cache;
+  return &cache;
+}
+
+void VoxelCache::setCacheDirectory(const std::string &directory)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  directory_ = directory;
+}
+
+void VoxelCache::setMaxVoxels(size_t max_voxels)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  max_voxels_ = max_voxels;
+  evict(max_voxels_);
+}
+
+void VoxelCache::clear()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  voxels_.clear();
+  uses_.clear();
+  num_voxels_ = 0;
+}
+
+void VoxelCache::insert(uint64_t key, const std::vector<Eigen::Vector3d> &voxels)
+{
+  // too big to keep, it's on disk if there is a directory
+  if(voxels.size() > max_voxels_)
+    return;
+
+  evict(max_voxels_ - voxels.size());
+  uses_.push_front(key);
+  Entry &entry = voxels_[key];
+  entry.voxels = voxels;
+  entry.use = uses_.begin();
+  num_voxels_ += voxels.size();
+}
+
+void VoxelCache::evict(size_t max_voxels)
+{
+  while(num_voxels_ > max_voxels && !uses_.empty())
+  {
+    std::map<uint64_t, Entry>::iterator it = voxels_.find(uses_.back());
+    num_voxels_ -= it->second.voxels.size();
+    voxels_.erase(it);
+    uses_.pop_back();
+  }
+}
+
+uint64_t VoxelCache::hashMesh(const std::vector<geometry_msgs::Point> &vertices, const std::vector<int> &triangles, double resolution, bool fill)
+{
+  uint64_t h = 14695981039346656037ULL;
+  unsigned char f = fill ? 1 : 0;
+  hashBytes(h, &resolution, sizeof(resolution));
+  hashBytes(h, &f, sizeof(f));
+  for(size_t i = 0; i < vertices.size(); ++i)
+  {
+    hashBytes(h, &vertices[i].x, sizeof(double));
+    hashBytes(h, &vertices[i].y, sizeof(double));
+    hashBytes(h, &vertices[i].z, sizeof(double));
+  }
+  if(!triangles.empty())
+    hashBytes(h, &triangles[0], triangles.size() * sizeof(int));
+  return h;
+}
+
+void VoxelCache::getMeshVoxels(const std::vector<geometry_msgs::Point> &vertices, const std::vector<int> &triangles, double resolution, bool fill, std::vector<Eigen::Vector3d> &voxels)
+{
+  FileHeader header;
+  header.key = hashMesh(vertices, triangles, resolution, fill);
+  header.resolution = resolution;
+  header.num_vertices = vertices.size();
+  header.num_triangles = triangles.size();
+  header.fill = fill ? 1 : 0;
+  uint64_t key = header.key;
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::map<uint64_t, Entry>::iterator it = voxels_.find(key);
+  if(it != voxels_.end())
+  {
+    uses_.splice(uses_.begin(), uses_, it->second.use);
+    voxels = it->second.voxels;
+    return;
+  }
+
+  if(!directory_.empty() && readVoxels(header, voxels))
+  {
+    ROS_DEBUG("[voxel_cache] Loaded %d voxels from %s.", int(voxels.size()), getFilename(key).c_str());
+    insert(key, voxels);
+    return;
+  }
+
+  std::vector<std::vector<double> > v;
+  sbpl::Voxelizer::voxelizeMesh(vertices, triangles, resolution, v, fill);
+  voxels.clear();
+  voxels.reserve(v.size());
+  for(size_t i = 0; i < v.size(); ++i)
+  {
+    if(v[i].size() < 3)
+      continue;
+    voxels.push_back(Eigen::Vector3d(v[i][0], v[i][1], v[i][2]));
+  }
+  insert(key, voxels);
+
+  if(!directory_.empty() && !writeVoxels(header, voxels))
+    ROS_WARN("[voxel_cache] Failed to write the voxels to %s.", getFilename(key).c_str());
+}
+
+std::string VoxelCache::getFilename(uint64_t key) const
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.vox", (unsigned long long)key);
+  return directory_ + "/" + name;
+}
+
+bool VoxelCache::readVoxels(const FileHeader &header, std::vector<Eigen::Vector3d> &voxels) const
+{
+  char magic[8];
+  FileHeader h;
+  uint64_t num_voxels;
+  std::ifstream fin(getFilename(header.key).c_str(), std::ios_base::in | std::ios_base::binary);
+  if(!fin.is_open())
+    return false;
+
+  fin.read(magic, sizeof(magic));
+  fin.read((char*)&h.key, sizeof(h.key));
+  fin.read((char*)&h.resolution, sizeof(h.resolution));
+  fin.read((char*)&h.num_vertices, sizeof(h.num_vertices));
+  fin.read((char*)&h.num_triangles, sizeof(h.num_triangles));
+  fin.read((char*)&h.fill, sizeof(h.fill));
+  fin.read((char*)&num_voxels, sizeof(num_voxels));
+  if(fin.fail() || memcmp(magic, VOXEL_FILE_MAGIC, sizeof(magic)) != 0)
+    return false;
+  if(h.key != header.key || h.resolution != header.resolution || h.num_vertices != header.num_vertices ||
+     h.num_triangles != header.num_triangles || h.fill != header.fill)
+  {
+    ROS_WARN("[voxel_cache] %s was voxelized from a different mesh. Ignoring it.", getFilename(header.key).c_str());
+    return false;
+  }
+
+  // the rest of the file has to hold exactly the voxels, don't trust the
+  // count of a truncated or corrupt file to size the buffer
+  std::streampos begin = fin.tellg();
+  fin.seekg(0, std::ios_base::end);
+  std::streampos end = fin.tellg();
+  fin.seekg(begin);
+  if(fin.fail() || uint64_t(end - begin) / (3 * sizeof(double)) != num_voxels || uint64_t(end - begin) % (3 * sizeof(double)) != 0)
+  {
+    ROS_WARN("[voxel_cache] %s should have %llu voxels but is %lld bytes long. Ignoring it.", getFilename(header.key).c_str(), (unsigned long long)num_voxels, (long long)(end - begin));
+    return false;
+  }
+
+  std::vector<double> v(3*num_voxels);
+  if(num_voxels > 0)
+    fin.read((char*)&v[0], v.size() * sizeof(double));
+  if(fin.fail())
+    return false;
+
+  voxels.resize(num_voxels);
+  for(size_t i = 0; i < num_voxels; ++i)
+    voxels[i] = Eigen::Vector3d(v[3*i], v[3*i+1], v[3*i+2]);
+  return true;
+}
+
+bool VoxelCache::writeVoxels(const FileHeader &header, const std::vector<Eigen::Vector3d> &voxels) const
+{
+  uint64_t num_voxels = voxels.size();
+  std::vector<double> v(3*num_voxels);
+  for(size_t i = 0; i < num_voxels; ++i)
+  {
+    v[3*i] = voxels[i].x();
+    v[3*i+1] = voxels[i].y();
+    v[3*i+2] = voxels[i].z();
+  }
+
+  // write to a temporary file first so a reader never sees half of one
+  std::string filename = getFilename(header.key);
+  std::string tmp_filename = filename + ".tmp";
+  std::ofstream fout(tmp_filename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+  if(!fout.is_open())
+    return false;
+  fout.write(VOXEL_FILE_MAGIC, sizeof(VOXEL_FILE_MAGIC));
+  fout.write((const char*)&header.key, sizeof(header.key));
+  fout.write((const char*)&header.resolution, sizeof(header.resolution));
+  fout.write((const char*)&header.num_vertices, sizeof(header.num_vertices));
+  fout.write((const char*)&header.num_triangles, sizeof(header.num_triangles));
+  fout.write((const char*)&header.fill, sizeof(header.fill));
+  fout.write((const char*)&num_voxels, sizeof(num_voxels));
+  if(num_voxels > 0)
+    fout.write((const char*)&v[0], v.size() * sizeof(double));
+  fout.close();
+  if(fout.fail())
+    return false;
+
+  return rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+}
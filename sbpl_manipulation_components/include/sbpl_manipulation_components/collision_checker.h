@@ -13,6 +13,14 @@
 
 namespace sbpl_arm_planner {
 
+/** @brief Scratch space needed to check states without touching the
+ *  checker itself, one per thread, made by CollisionChecker::createContext().
+ *  Checkers derive from it and only accept contexts they created. */
+struct CollisionCheckerContext
+{
+  virtual ~CollisionCheckerContext() {}
+};
+
 class CollisionChecker
 {
   public:
@@ -35,11 +43,35 @@ class CollisionChecker
 
     /* Collision Checking */
     virtual bool isStateValid(const std::vector<double> &angles, bool verbose, bool visualize, double &dist);
-
-    virtual bool isStateValid(const std::vector<double> &angles, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, bool verbose, bool visualize, double &dist);
    
     virtual bool isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, int &path_length, int &num_checks, double &dist);
-    virtual bool isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, int &path_length, int &num_checks, double &dist);
+
+    /** @brief check n configurations at once
+     *  @param configs n configurations of the planning joints, stored one after the other
+     *  @param num_joints number of planning joints in each configuration
+     *  @param valid (optional) n entries, set to 1 if the configuration is valid, 0 otherwise
+     *  @param dist (optional) n entries, the distance to the nearest obstacle for each configuration
+     *  @return true if all n configurations are valid */
+    virtual bool isStatesValid(const double *configs, int num_joints, size_t n, bool verbose, unsigned char *valid, double *dist);
+
+    /** @brief check groups of consecutive configurations at once (e.g. the
+     *  waypoints of each action). Once a configuration is invalid, the rest
+     *  of its group is skipped and marked invalid with a distance of 0
+     *  @param group_ends index one past the last configuration of each group
+     *  @return true if all of the configurations are valid */
+    virtual bool isStatesValid(const double *configs, int num_joints, const int *group_ends, size_t num_groups, bool verbose, unsigned char *valid, double *dist);
+
+    /** @brief a new context for the const queries, owned by the caller.
+     *  NULL if the checker can only be used from one thread */
+    virtual CollisionCheckerContext* createContext() const;
+
+    /** @brief isStateValid that may be called from several threads at once,
+     *  each with its own context, while the world isn't being changed */
+    virtual bool isStateValid(const std::vector<double> &angles, CollisionCheckerContext &ctx, bool verbose, double &dist) const;
+
+    /** @brief the collision spheres of the planning group at a configuration
+     *  @param spheres {x, y, z, radius} of each sphere, in the planning frame */
+    virtual bool getCollisionSpheres(const std::vector<double> &angles, std::vector<std::vector<double> > &spheres);
 
     /* Utils */
     virtual bool interpolatePath(const std::vector<double> &start, const std::vector<double> &end, const std::vector<double> &inc, std::vector<std::vector<double> >& path);
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2010, Maxim Likhachev
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Pennsylvania nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _COMPACT_DISTANCE_FIELD_
+#define _COMPACT_DISTANCE_FIELD_
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+namespace sbpl_arm_planner
+{
+
+/* \brief A dense distance field that stores the squared distance to the
+ * nearest obstacle in cell units as an unsigned short. Distances are
+ * propagated from the obstacles with a brushfire that carries the nearest
+ * obstacle along, like the PropagationDistanceField does, and are capped at
+ * the max distance.
+ *
+ * The array is padded by one cell on every side. The padding is at distance
+ * zero and is never propagated into, so the propagation doesn't need any
+ * bounds checks and a lookup up to one cell outside the grid reads as
+ * occupied. Cell {x,y,z} has its center at origin + resolution * {x,y,z}.
+ *
+ * With setNumThreads(n > 0) every update instead recomputes the whole field
+ * with an exact separable Euclidean distance transform (Felzenszwalb &
+ * Huttenlocher), one axis at a time, with the lines of each pass split
+ * across n threads. That's much faster when a lot of obstacles are added at
+ * once but slower for small incremental changes.
+ *
+ * saveSnapshot() writes the array to a versioned binary file in one shot and
+ * mapSnapshot() maps it back without copying it. A mapped field doesn't know
+ * the nearest obstacles, so the first update to it propagates from scratch.
+ */
+class CompactDistanceField
+{
+  public:
+
+    /**
+     * @brief Constructor
+     * @param number of cells along X
+     * @param number of cells along Y
+     * @param number of cells along Z
+     * @param resolution of grid (meters)
+     * @param X coordinate of the center of cell {0,0,0} (meters)
+     * @param Y coordinate of the center of cell {0,0,0} (meters)
+     * @param Z coordinate of the center of cell {0,0,0} (meters)
+     * @param distances are capped at this value (meters, at most 255 cells)
+    */
+    CompactDistanceField(int num_cells_x, int num_cells_y, int num_cells_z, double resolution, double origin_x, double origin_y, double origin_z, double max_distance);
+
+    ~CompactDistanceField();
+
+    /** @brief map a file written by saveSnapshot(), returns NULL on failure */
+    static CompactDistanceField* mapSnapshot(const std::string &filename);
+
+    bool saveSnapshot(const std::string &filename) const;
+
+    bool isMapped() const { return mapping_ != NULL; };
+
+    /** @brief clear all of the obstacles */
+    void reset();
+
+    /** @brief mark the cells as obstacles (see getCellIndex()) and propagate */
+    void addObstacleCells(const std::vector<int> &cells);
+
+    /** @brief clear the obstacle cells and repropagate the area around them */
+    void removeObstacleCells(const std::vector<int> &cells);
+
+    /** @brief remove old_cells and add new_cells with a single propagation */
+    void updateObstacleCells(const std::vector<int> &old_cells, const std::vector<int> &new_cells);
+
+    /** @brief 0 to propagate incrementally with the brushfire, otherwise the
+     *  number of threads used to compute the distance transform */
+    void setNumThreads(int num_threads);
+
+    int getNumThreads() const { return num_threads_; };
+
+    inline bool worldToGrid(double wx, double wy, double wz, int &x, int &y, int &z) const;
+
+    inline void gridToWorld(int x, int y, int z, double &wx, double &wy, double &wz) const;
+
+    inline bool isInBounds(int x, int y, int z) const;
+
+    /** @brief index of a cell in the padded array, valid for -1 <= x <= num_cells_x */
+    inline int getCellIndex(int x, int y, int z) const;
+
+    /** @brief distance to the nearest obstacle (meters) */
+    inline double getDistance(int x, int y, int z) const;
+
+    inline double getDistance(int cell) const;
+
+    /** @brief distance to the nearest obstacle (cells, rounded down) */
+    inline unsigned char getCellDistance(int x, int y, int z) const;
+
+    inline unsigned short getSquaredCellDistance(int x, int y, int z) const;
+
+    int getNumCellsX() const { return dims_[0]; };
+    int getNumCellsY() const { return dims_[1]; };
+    int getNumCellsZ() const { return dims_[2]; };
+    double getResolution() const { return resolution_; };
+    double getOriginX() const { return origin_[0]; };
+    double getOriginY() const { return origin_[1]; };
+    double getOriginZ() const { return origin_[2]; };
+    double getMaxDistance() const { return dist_table_[max_dsq_]; };
+
+    /** @brief raw padded array of squared cell distances */
+    const unsigned short* getSquaredDistances() const { return dsq_; };
+
+    size_t getNumPaddedCells() const { return num_padded_cells_; };
+
+  private:
+
+    CompactDistanceField();
+
+    /* not copyable, dsq_ can point into a mapped file */
+    CompactDistanceField(const CompactDistanceField&);
+    CompactDistanceField& operator=(const CompactDistanceField&);
+
+    int dims_[3];
+    int pdims_[3];
+    size_t num_padded_cells_;
+    int stride_x_;
+    int stride_y_;
+    double resolution_;
+    double inv_resolution_;
+    double origin_[3];
+
+    int max_dsq_;
+    int neighbor_offsets_[26];
+    int neighbor_dirs_[26][3];
+
+    /* squared distance to the nearest obstacle, in cells. Points either to
+     * dsq_storage_ or into the mapped snapshot */
+    unsigned short *dsq_;
+    std::vector<unsigned short> dsq_storage_;
+    void *mapping_;
+    size_t mapping_size_;
+
+    /* index of the nearest obstacle cell, -1 if there is none in range */
+    std::vector<int> nearest_;
+
+    /* distance in meters and in whole cells for each squared distance */
+    std::vector<double> dist_table_;
+    std::vector<unsigned char> cell_dist_table_;
+
+    /* cells waiting to be expanded, bucketed by squared distance */
+    std::vector<std::vector<int> > buckets_;
+
+    /* distance transform (num_threads_ > 0) */
+    int num_threads_;
+    std::vector<int> edt_;
+
+    void init(int num_cells_x, int num_cells_y, int num_cells_z, double resolution, double origin_x, double origin_y, double origin_z, double max_distance);
+    void unmapSnapshot();
+    void getCellCoords(int cell, int &x, int &y, int &z) const;
+    void addObstacles(const std::vector<int> &cells);
+    void removeObstacles(const std::vector<int> &cells);
+    void propagate();
+
+    /* in distance transform mode, nearest_ only marks the obstacle cells */
+    void setObstacles(const std::vector<int> &cells, bool obstacle);
+    void computeDistanceTransform();
+    void transformLines(int axis, int begin, int end);
+    void rebuild();
+};
+
+inline bool CompactDistanceField::worldToGrid(double wx, double wy, double wz, int &x, int &y, int &z) const
+{
+  x = int(floor((wx - origin_[0]) * inv_resolution_ + 0.5));
+  y = int(floor((wy - origin_[1]) * inv_resolution_ + 0.5));
+  z = int(floor((wz - origin_[2]) * inv_resolution_ + 0.5));
+  return isInBounds(x, y, z);
+}
+
+inline void CompactDistanceField::gridToWorld(int x, int y, int z, double &wx, double &wy, double &wz) const
+{
+  wx = origin_[0] + resolution_ * x;
+  wy = origin_[1] + resolution_ * y;
+  wz = origin_[2] + resolution_ * z;
+}
+
+inline bool CompactDistanceField::isInBounds(int x, int y, int z) const
+{
+  // a single unsigned compare per axis
+  return (unsigned(x) < unsigned(dims_[0])) && (unsigned(y) < unsigned(dims_[1])) && (unsigned(z) < unsigned(dims_[2]));
+}
+
+inline int CompactDistanceField::getCellIndex(int x, int y, int z) const
+{
+  return (x + 1) * stride_x_ + (y + 1) * stride_y_ + (z + 1);
+}
+
+inline double CompactDistanceField::getDistance(int x, int y, int z) const
+{
+  return dist_table_[dsq_[getCellIndex(x, y, z)]];
+}
+
+inline double CompactDistanceField::getDistance(int cell) const
+{
+  return dist_table_[dsq_[cell]];
+}
+
+inline unsigned char CompactDistanceField::getCellDistance(int x, int y, int z) const
+{
+  return cell_dist_table_[dsq_[getCellIndex(x, y, z)]];
+}
+
+inline unsigned short CompactDistanceField::getSquaredCellDistance(int x, int y, int z) const
+{
+  return dsq_[getCellIndex(x, y, z)];
+}
+
+}
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2010, Maxim Likhachev
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Pennsylvania nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GENERATED_FK_ROBOT_MODEL_
+#define _GENERATED_FK_ROBOT_MODEL_
+
+#include <string>
+#include <vector>
+#include <kdl/frames.hpp>
+#include <sbpl_manipulation_components/kdl_robot_model.h>
+
+namespace sbpl_arm_planner {
+
+/* \brief Forward kinematics of a chain, generated by generate_fk. The
+ * function fills frames[0..num_segments], where frames[i] is the product of
+ * the first i segments of the KDL chain (the same numbering as the segmentNr
+ * of ChainFkSolverPos_recursive). q is in the order of the chain's joints.
+ */
+typedef void (*GeneratedFKFunction)(const double *q, KDL::Frame *frames);
+
+/* number of configurations the lane function computes at once */
+#define GENERATED_FK_LANES 4
+
+/* \brief The same for GENERATED_FK_LANES configurations. Joint j of lane l is
+ * q[j * GENERATED_FK_LANES + l] and element e of frame i of lane l is
+ * frames[(12 * i + e) * GENERATED_FK_LANES + l], where the elements are the
+ * rotation (row major) followed by the translation.
+ */
+typedef void (*GeneratedFKLanesFunction)(const double *q, double *frames);
+
+struct GeneratedFK
+{
+  std::string root;
+  std::string tip;
+  int num_joints;
+  int num_segments;
+  GeneratedFKFunction fk;
+  GeneratedFKLanesFunction fk_lanes;
+};
+
+/** @brief add a generated chain to the registry, replaces one with the same root and tip */
+void registerGeneratedFK(const GeneratedFK &fk);
+
+/** @brief returns NULL if no FK was generated for the chain */
+const GeneratedFK* findGeneratedFK(const std::string &root, const std::string &tip);
+
+/* generated files register themselves with a static instance of this */
+struct GeneratedFKRegistrar
+{
+  GeneratedFKRegistrar(const char *root, const char *tip, int num_joints, int num_segments, GeneratedFKFunction fk, GeneratedFKLanesFunction fk_lanes);
+};
+
+/** @brief buffers of the generated FK */
+struct GeneratedFKRobotModelContext : public KDLRobotModelContext
+{
+  std::vector<double> q;
+  std::vector<KDL::Frame> frames;
+
+  /* lane layout buffers of the batch FK */
+  std::vector<double> q_lanes;
+  std::vector<double> frames_lanes;
+};
+
+/* \brief A KDLRobotModel that computes the forward kinematics with the
+ * function generated for its chain instead of ChainFkSolverPos_recursive.
+ * Everything else, including IK, is left to the KDLRobotModel. init() fails if
+ * nothing was generated for the chain or if it doesn't match the URDF.
+ */
+class GeneratedFKRobotModel : public KDLRobotModel {
+
+  public:
+
+    GeneratedFKRobotModel();
+    GeneratedFKRobotModel(std::string chain_root_link, std::string chain_tip_link);
+    ~GeneratedFKRobotModel();
+
+    virtual bool init(std::string robot_description, std::vector<std::string> &planning_joints);
+
+    virtual RobotModelContext* createContext() const;
+
+    /* Forward Kinematics */
+    using KDLRobotModel::computeFK;
+    using KDLRobotModel::computePlanningLinkFKs;
+
+    virtual bool computeFK(const std::vector<double> &angles, const std::string &name, KDL::Frame &f, RobotModelContext &ctx) const;
+
+    /** @brief all of the frames of the chain in the planning frame, numbered as
+     *  in GeneratedFKFunction, in one pass */
+    bool computeFK(const std::vector<double> &angles, std::vector<KDL::Frame> &frames, RobotModelContext &ctx) const;
+
+    bool computeFK(const std::vector<double> &angles, std::vector<KDL::Frame> &frames);
+
+    /** @brief batch FK, GENERATED_FK_LANES configurations at a time */
+    virtual bool computePlanningLinkFKs(const double *angles, size_t n, double *poses, RobotModelContext &ctx, std::vector<std::vector<KDL::Frame> > *frames=NULL) const;
+
+  protected:
+
+    const GeneratedFK *gen_fk_;
+
+    void computeFrames(const std::vector<double> &angles, GeneratedFKRobotModelContext &ctx) const;
+};
+
+}
+#endif
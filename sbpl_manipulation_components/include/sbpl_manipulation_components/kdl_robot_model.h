@@ -50,6 +50,23 @@ using namespace std;
 
 namespace sbpl_arm_planner {
 
+class IKWorkerPool;
+
+/** @brief The KDL solvers keep intermediate results in members, so each
+ *  context has its own. */
+struct KDLRobotModelContext : public RobotModelContext
+{
+  KDL::JntArray jnt_pos_in;
+  KDL::JntArray jnt_pos_out;
+  boost::shared_ptr<KDL::ChainFkSolverPos_recursive> fk_solver;
+  boost::shared_ptr<KDL::ChainIkSolverVel_pinv> ik_vel_solver;
+  boost::shared_ptr<KDL::ChainIkSolverPos_NR_JL> ik_solver;
+
+  /* helper threads of the parallel IK search, started on first use and
+   * kept waiting for the next search */
+  boost::shared_ptr<IKWorkerPool> ik_workers;
+};
+
 class KDLRobotModel : public RobotModel {
 
   public:
@@ -63,23 +80,45 @@ class KDLRobotModel : public RobotModel {
 
     //bool getJointLimits();
 
+    virtual RobotModelContext* createContext() const;
+
     /* Joint Limits */
-    virtual bool checkJointLimits(const std::vector<double> &angles);
+    virtual bool checkJointLimits(const std::vector<double> &angles) const;
+
+    virtual bool getPlanningJointLimits(const std::string &name, double &min_limit, double &max_limit, bool &continuous) const;
+
+    virtual int getRedundantJointIndex() const;
    
     /* Forward Kinematics */
-    virtual bool computeFK(const std::vector<double> &angles, std::string name, KDL::Frame &f);
+    using RobotModel::computeFK;
+    using RobotModel::computePlanningLinkFKs;
 
-    virtual bool computeFK(const std::vector<double> &angles, std::string name, std::vector<double> &pose);
+    virtual bool computeFK(const std::vector<double> &angles, const std::string &name, KDL::Frame &f, RobotModelContext &ctx) const;
 
-    virtual bool computePlanningLinkFK(const std::vector<double> &angles, std::vector<double> &pose);
+    virtual bool computePlanningLinkFKs(const double *angles, size_t n, double *poses, RobotModelContext &ctx, std::vector<std::vector<KDL::Frame> > *frames=NULL) const;
 
     /* Inverse Kinematics */
-    virtual bool computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option=0);
+    using RobotModel::computeIK;
+    using RobotModel::computeFastIK;
+
+    virtual bool computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option, RobotModelContext &ctx) const;
+
+    virtual bool computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, RobotModelContext &ctx) const;
 
-    virtual bool computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution);
+    bool computeIKSearch(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, double timeout, KDLRobotModelContext &ctx) const;
 
     bool computeIKSearch(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, double timeout);
 
+    /** @brief search the whole range of the free angle with a solver per
+     *  thread. Returns the solution of the seed closest to the initial guess,
+     *  or with the "best" search mode, the solution closest to start. */
+    bool computeParallelIKSearch(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, double timeout, KDLRobotModelContext &ctx) const;
+
+    /** @brief 0 searches the free angle one seed at a time */
+    void setNumIKThreads(int num_threads);
+
+    int getNumIKThreads() const { return num_ik_threads_; };
+
     /* Debug Output */
     virtual void printRobotModelInformation();
 
@@ -93,12 +132,11 @@ class KDLRobotModel : public RobotModel {
 
     KDL::Tree ktree_;
     KDL::Chain kchain_;
-    KDL::JntArray jnt_pos_in_;
-    KDL::JntArray jnt_pos_out_;
-    KDL::Frame p_out_;
-    KDL::ChainIkSolverPos_NR_JL *ik_solver_;
-    KDL::ChainIkSolverVel_pinv *ik_vel_solver_;
-    KDL::ChainFkSolverPos_recursive *fk_solver_;
+
+    /* parallel IK search */
+    struct IKSearch;
+    int num_ik_threads_;
+    bool ik_search_best_;
 
     std::vector<bool> continuous_;
     std::vector<double> min_limits_;
@@ -110,7 +148,13 @@ class KDLRobotModel : public RobotModel {
     
     bool getJointLimits(std::string joint_name, double &min_limit, double &max_limit, bool &continuous, bool use_safety_limit=true);
 
-    bool getCount(int &count, const int &max_count, const int &min_count);
+    bool getCount(int &count, const int &max_count, const int &min_count) const;
+
+    /** @brief set up the KDL part of a context, for models with their own contexts */
+    void initContext(KDLRobotModelContext &ctx) const;
+
+    void getDesiredFrame(const std::vector<double> &pose, KDL::Frame &frame) const;
+    void searchFreeAngle(IKSearch *search, KDLRobotModelContext *ctx) const;
 };
 
 }
@@ -34,6 +34,70 @@ typedef struct MotionPrimitive
 
 } MotionPrimitive;
 
+/* \brief The actions of one expansion in a single flat array of waypoints.
+ * It is meant to be cleared and refilled for every expansion, so once it has
+ * grown to the largest expansion it doesn't allocate anymore.
+ */
+class ActionBuffer
+{
+  public:
+
+    ActionBuffer() : num_joints_(0) { offsets_.push_back(0); };
+
+    /** @brief remove the actions, keeps the memory */
+    void clear(int num_joints)
+    {
+      num_joints_ = num_joints;
+      offsets_.resize(1);
+      ids_.clear();
+    }
+
+    /** @brief append an action and return its first waypoint to be filled
+     *  in. The pointer is only good until the next addAction() */
+    double* addAction(int id, int num_waypoints)
+    {
+      int begin = offsets_.back();
+      offsets_.push_back(begin + num_waypoints);
+      ids_.push_back(id);
+      if(waypoints_.size() < size_t(offsets_.back() * num_joints_))
+        waypoints_.resize(offsets_.back() * num_joints_);
+      return &waypoints_[begin * num_joints_];
+    }
+
+    /** @brief drop the last action, for when it couldn't be filled in */
+    void removeLastAction()
+    {
+      offsets_.pop_back();
+      ids_.pop_back();
+    }
+
+    int getNumActions() const { return int(ids_.size()); };
+    int getNumJoints() const { return num_joints_; };
+    int getNumWaypoints(int a) const { return offsets_[a+1] - offsets_[a]; };
+
+    /** @brief id of the motion primitive the action was made from */
+    int getPrimitiveId(int a) const { return ids_[a]; };
+
+    const double* getWaypoint(int a, int w) const { return &waypoints_[(offsets_[a] + w) * num_joints_]; };
+    const double* getLastWaypoint(int a) const { return &waypoints_[(offsets_[a+1] - 1) * num_joints_]; };
+
+    void getAction(int a, Action &action) const
+    {
+      action.resize(getNumWaypoints(a));
+      for(int w = 0; w < getNumWaypoints(a); ++w)
+        action[w].assign(getWaypoint(a, w), getWaypoint(a, w) + num_joints_);
+    }
+
+  private:
+
+    int num_joints_;
+
+    /* waypoint w of action a starts at (offsets_[a] + w) * num_joints_ */
+    std::vector<double> waypoints_;
+    std::vector<int> offsets_;
+    std::vector<int> ids_;
+};
+
 }
 
 #endif
@@ -35,10 +35,13 @@
 #include <sys/stat.h>
 #include <vector>
 #include <fstream>
+#include <algorithm>
 #include <tf/LinearMath/Vector3.h>
 #include <Eigen/Geometry>
 #include <moveit/distance_field/voxel_grid.h>
 #include <moveit/distance_field/propagation_distance_field.h>
+#include <sbpl_manipulation_components/compact_distance_field.h>
+#include <sbpl_manipulation_components/sparse_distance_field.h>
 #include <arm_navigation_msgs/CollisionMap.h>
 #include <visualization_msgs/MarkerArray.h>
 #include <rosbag/bag.h>
@@ -46,6 +49,18 @@
 /* \brief At this point, this is a very lightweight layer on top of the
  * PropagationDistanceField class. I'll eventually get rid of it once the
  * PDF class has a couple of more things in it.
+ *
+ * Obstacles live in one of two layers that are propagated independently.
+ * The static layer holds things that rarely change (the robot's body, known
+ * collision objects) and the dynamic layer holds the sensed collision map,
+ * which is replaced every cycle. The distance of a cell is the smaller of the
+ * two. The dynamic layer isn't allocated until something is put in it.
+ *
+ * The layers are either PropagationDistanceFields or, when the grid is
+ * constructed with the COMPACT_DISTANCE_FIELD backend, CompactDistanceFields
+ * that store quantized distances in a padded array, or with the
+ * SPARSE_DISTANCE_FIELD backend, SparseDistanceFields that only allocate the
+ * space near obstacles (for large workspaces).
 */
 
 namespace sbpl_arm_planner{
@@ -53,6 +68,19 @@ namespace sbpl_arm_planner{
 class OccupancyGrid
 {
   public:
+
+    enum Layer
+    {
+      STATIC_LAYER,
+      DYNAMIC_LAYER
+    };
+
+    enum Backend
+    {
+      PROPAGATION_DISTANCE_FIELD,
+      COMPACT_DISTANCE_FIELD,
+      SPARSE_DISTANCE_FIELD
+    };
    
     /** 
      * @brief Constructor 
@@ -63,8 +91,9 @@ class OccupancyGrid
      * @param X coordinate of origin (meters)
      * @param Y coordinate of origin (meters)
      * @param Z coordinate of origin (meters)
+     * @param distance field implementation
     */
-    OccupancyGrid(double dim_x, double dim_y, double dim_z, double resolution, double origin_x, double origin_y, double origin_z);
+    OccupancyGrid(double dim_x, double dim_y, double dim_z, double resolution, double origin_x, double origin_y, double origin_z, Backend backend=PROPAGATION_DISTANCE_FIELD);
 
     OccupancyGrid(distance_field::PropagationDistanceField* df);
 
@@ -91,8 +120,41 @@ class OccupancyGrid
     /** @brief check if {x,y,z} is in bounds of the grid */
     inline bool isInBounds(int x, int y, int z);
 
-    /** @brief return a pointer to the distance field */
+    /** @brief distance at a point (meters), trilinearly interpolated between
+     *  the centers of the 8 surrounding cells rather than snapped to one */
+    inline double getInterpolatedDistance(double x, double y, double z);
+
+    /** @brief interpolated distance at a point and its gradient (the
+     *  direction away from the nearest obstacles, not normalized) */
+    inline double getDistanceAndGradient(double x, double y, double z, Eigen::Vector3d &gradient);
+
+    /** @brief getDistanceAndGradient() at each of the points, one after the
+     *  other. A convenience for callers that hold a list of points, it is
+     *  no faster than the single queries */
+    void getDistancesAndGradients(const std::vector<Eigen::Vector3d> &points, std::vector<double> &distances, std::vector<Eigen::Vector3d> &gradients);
+
+    /** @brief return a pointer to the distance field (the static layer),
+     *  NULL when using the compact backend */
     inline distance_field::PropagationDistanceField* getDistanceFieldPtr();
+
+    /** @brief return a pointer to the compact distance field (the static
+     *  layer), NULL when using the propagation distance field backend */
+    inline CompactDistanceField* getCompactDistanceFieldPtr();
+
+    /** @brief return a pointer to the sparse distance field (the static
+     *  layer), NULL when using another backend */
+    inline SparseDistanceField* getSparseDistanceFieldPtr();
+
+    Backend getBackend() const { return backend_; };
+
+    /** @brief changes every time the obstacles are modified through the
+     *  grid, so anything derived from the distances can tell it's stale.
+     *  Writes through the distance field pointers aren't counted */
+    unsigned int getRevision() const { return revision_; };
+
+    /** @brief number of threads the compact backend uses to recompute the
+     *  distance transform after an update, 0 to propagate incrementally */
+    void setNumPropagationThreads(int num_threads);
     
     /** @brief get the dimensions of the grid */
     void getGridSize(int &dim_x, int &dim_y, int &dim_z);
@@ -109,7 +171,7 @@ class OccupancyGrid
     /** @brief get the resolution of the world (meters)*/
     double getResolution();
 
-    /** @brief update the distance field from the collision_map */
+    /** @brief replace the contents of the dynamic layer with the collision_map */
     void updateFromCollisionMap(const arm_navigation_msgs::CollisionMap &collision_map);
        
     /** 
@@ -123,33 +185,88 @@ class OccupancyGrid
     */
     void addCube(double origin_x, double origin_y, double origin_z, double size_x, double size_y, double size_z);
 
-    void addPointsToField(const std::vector<Eigen::Vector3d> &points);
+    void addPointsToField(const std::vector<Eigen::Vector3d> &points, Layer layer=STATIC_LAYER);
 
-    void updatePointsInField(const std::vector<Eigen::Vector3d> &points, bool iterative=false);
+    /** @brief remove the obstacle cells at old_points and add the ones at
+     *  new_points in a single propagation pass */
+    void updatePointsInField(const std::vector<Eigen::Vector3d> &old_points, const std::vector<Eigen::Vector3d> &new_points, Layer layer=STATIC_LAYER);
+
+    void removePointsFromField(const std::vector<Eigen::Vector3d> &points, Layer layer=STATIC_LAYER);
 
     void getOccupiedVoxels(std::vector<geometry_msgs::Point> &voxels);
 
+    /** @brief append the centers of the cells that overlap an oriented box
+     *  (each cell once, only cells in bounds) */
     void getOccupiedVoxels(const geometry_msgs::Pose &pose, const std::vector<double> &dim, std::vector<Eigen::Vector3d> &voxels);
 
+    /** @brief same for a cylinder along the pose's z axis */
+    void getOccupiedCylinderVoxels(const geometry_msgs::Pose &pose, double radius, double length, std::vector<Eigen::Vector3d> &voxels);
+
+    /** @brief same for a sphere */
+    void getOccupiedSphereVoxels(const geometry_msgs::Pose &pose, double radius, std::vector<Eigen::Vector3d> &voxels);
+
     void getOccupiedVoxels(double x_center, double y_center, double z_center, double radius, std::string text, std::vector<geometry_msgs::Point> &voxels);
 
     std::string getReferenceFrame();
 
     void setReferenceFrame(const std::string &frame);
 
+    /** @brief clear both layers */
     void reset();
 
+    void resetDynamicLayer();
+
     visualization_msgs::MarkerArray getVisualization(std::string type);
 
     bool writeOccupancyGridToBagFile(std::string bag_filename, std::string topic_name);
 
     bool writeCollisionMapToBagFile(const arm_navigation_msgs::CollisionMap &map, std::string bag_filename, std::string topic_name);
 
+    /** @brief write the static layer to a binary snapshot in one shot (see
+     *  CompactDistanceField::saveSnapshot) */
+    bool saveGridToBinaryFile(std::string filename);
+
+    /** @brief replace the static layer with a memory mapped snapshot. Only
+     *  for the compact backend, the dimensions have to match this grid's */
+    bool loadGridFromBinaryFile(std::string filename);
+
   private:
 
     bool delete_grid_;
+    Backend backend_;
+    unsigned int revision_;
     std::string reference_frame_;
     distance_field::PropagationDistanceField* grid_;
+
+    /* NULL until the first dynamic obstacle is added */
+    distance_field::PropagationDistanceField* dynamic_grid_;
+    bool dynamic_layer_empty_;
+
+    /* obstacles from the last collision map, so the next one can be diffed */
+    std::vector<Eigen::Vector3d> collision_map_points_;
+
+    /* compact backend */
+    CompactDistanceField* compact_grid_;
+    CompactDistanceField* dynamic_compact_grid_;
+    int num_propagation_threads_;
+
+    /* cached for the interpolated queries */
+    double grid_origin_[3];
+    double inv_resolution_;
+    int grid_dims_[3];
+
+    /* sparse backend */
+    SparseDistanceField* sparse_grid_;
+    SparseDistanceField* dynamic_sparse_grid_;
+
+    distance_field::PropagationDistanceField* getLayer(Layer layer);
+    CompactDistanceField* getCompactLayer(Layer layer);
+    SparseDistanceField* getSparseLayer(Layer layer);
+    void getSparseCells(const std::vector<Eigen::Vector3d> &points, std::vector<int> &cells);
+    void initGeometry();
+    void rasterize(int type, const geometry_msgs::Pose &pose, double hx, double hy, double hz, std::vector<Eigen::Vector3d> &voxels);
+    inline double interpolate(double x, double y, double z, Eigen::Vector3d *gradient);
+    void getCompactCells(const std::vector<Eigen::Vector3d> &points, std::vector<int> &cells);
 };
 
 inline distance_field::PropagationDistanceField* OccupancyGrid::getDistanceFieldPtr()
@@ -157,91 +274,174 @@ inline distance_field::PropagationDistanceField* OccupancyGrid::getDistanceField
   return grid_;
 }
 
+inline CompactDistanceField* OccupancyGrid::getCompactDistanceFieldPtr()
+{
+  return compact_grid_;
+}
+
+inline SparseDistanceField* OccupancyGrid::getSparseDistanceFieldPtr()
+{
+  return sparse_grid_;
+}
+
 inline void OccupancyGrid::gridToWorld(int x, int y, int z, double &wx, double &wy, double &wz)
 {
-  grid_->gridToWorld(x, y, z, wx, wy, wz); 
+  if(compact_grid_)
+    compact_grid_->gridToWorld(x, y, z, wx, wy, wz);
+  else if(sparse_grid_)
+    sparse_grid_->gridToWorld(x, y, z, wx, wy, wz);
+  else
+    grid_->gridToWorld(x, y, z, wx, wy, wz); 
 }
 
+/* the result isn't checked, use isInBounds() before looking up the cell */
 inline void OccupancyGrid::worldToGrid(double wx, double wy, double wz, int &x, int &y, int &z)
 {
-  grid_->worldToGrid(wx, wy, wz, x, y, z);
-
-  if((x > 10000) || (y > 10000) || (z > 10000) ||
-     (x < 0) || (y < 0) || (z < 0))
-  {
-    ROS_ERROR("[grid] worldToGrid converted %0.5f %0.5f %0.5f to %d %d %d", wx, wy, wz, x, y, z);
-    fflush(stdout);
-  }
+  if(compact_grid_)
+    compact_grid_->worldToGrid(wx, wy, wz, x, y, z);
+  else if(sparse_grid_)
+    sparse_grid_->worldToGrid(wx, wy, wz, x, y, z);
+  else
+    grid_->worldToGrid(wx, wy, wz, x, y, z);
 }
 
 inline double OccupancyGrid::getDistance(int x, int y, int z)
 {
-  return grid_->getDistance(x,y,z);
+  if(compact_grid_)
+  {
+    int cell = compact_grid_->getCellIndex(x, y, z);
+    if(dynamic_layer_empty_)
+      return compact_grid_->getDistance(cell);
+    return std::min(compact_grid_->getDistance(cell), dynamic_compact_grid_->getDistance(cell));
+  }
+
+  if(sparse_grid_)
+  {
+    if(dynamic_layer_empty_)
+      return sparse_grid_->getDistance(x,y,z);
+    return std::min(sparse_grid_->getDistance(x,y,z), dynamic_sparse_grid_->getDistance(x,y,z));
+  }
+
+  if(dynamic_layer_empty_)
+    return grid_->getDistance(x,y,z);
+
+  return std::min(grid_->getDistance(x,y,z), dynamic_grid_->getDistance(x,y,z));
 }
 
 inline double OccupancyGrid::getDistanceFromPoint(double x, double y, double z)
 {
   int gx, gy, gz;
   worldToGrid(x, y, z, gx, gy, gz);
-  return grid_->getDistance(gx, gy, gz);
+
+  // outside of the grid is treated as an obstacle, the compact field only
+  // has one cell of padding around it and the sparse one has none
+  if(compact_grid_ && !compact_grid_->isInBounds(gx, gy, gz))
+    return 0.0;
+  if(sparse_grid_ && !sparse_grid_->isInBounds(gx, gy, gz))
+    return 0.0;
+
+  return getDistance(gx, gy, gz);
 }
 
 inline unsigned char OccupancyGrid::getCell(int x, int y, int z)
 {
-  return (unsigned char)(grid_->getDistance(x,y,z) / grid_->getResolution());
+  if(compact_grid_)
+  {
+    if(dynamic_layer_empty_)
+      return compact_grid_->getCellDistance(x,y,z);
+    return std::min(compact_grid_->getCellDistance(x,y,z), dynamic_compact_grid_->getCellDistance(x,y,z));
+  }
+  if(sparse_grid_)
+  {
+    if(dynamic_layer_empty_)
+      return sparse_grid_->getCellDistance(x,y,z);
+    return std::min(sparse_grid_->getCellDistance(x,y,z), dynamic_sparse_grid_->getCellDistance(x,y,z));
+  }
+  return (unsigned char)(getDistance(x,y,z) / grid_->getResolution());
 }
 
 inline double OccupancyGrid::getCell(int *xyz)
 {
-  return grid_->getDistance(xyz[0],xyz[1],xyz[2]);
+  return getDistance(xyz[0],xyz[1],xyz[2]);
 }
 
 inline bool OccupancyGrid::isInBounds(int x, int y, int z)
 {
+  if(compact_grid_)
+    return compact_grid_->isInBounds(x, y, z);
+  if(sparse_grid_)
+    return sparse_grid_->isInBounds(x, y, z);
+
   return (
       x>=0 && x<grid_->getXNumCells() &&
       y>=0 && y<grid_->getYNumCells() &&
       z>=0 && z<grid_->getZNumCells());
 }
 
-inline std::string OccupancyGrid::getReferenceFrame()
+inline double OccupancyGrid::interpolate(double wx, double wy, double wz, Eigen::Vector3d *gradient)
 {
-  return reference_frame_;
+  double g[3] = {(wx - grid_origin_[0]) * inv_resolution_, (wy - grid_origin_[1]) * inv_resolution_, (wz - grid_origin_[2]) * inv_resolution_};
+  double t[3];
+  int c[3];
+
+  // clamp to the cells on the border of the grid
+  for(int i = 0; i < 3; ++i)
+  {
+    c[i] = int(floor(g[i]));
+    if(c[i] < 0)
+      c[i] = 0;
+    if(c[i] > grid_dims_[i] - 2)
+      c[i] = std::max(grid_dims_[i] - 2, 0);
+    t[i] = std::min(std::max(g[i] - c[i], 0.0), 1.0);
+  }
+
+  double d000 = getDistance(c[0],   c[1],   c[2]);
+  double d001 = getDistance(c[0],   c[1],   c[2]+1);
+  double d010 = getDistance(c[0],   c[1]+1, c[2]);
+  double d011 = getDistance(c[0],   c[1]+1, c[2]+1);
+  double d100 = getDistance(c[0]+1, c[1],   c[2]);
+  double d101 = getDistance(c[0]+1, c[1],   c[2]+1);
+  double d110 = getDistance(c[0]+1, c[1]+1, c[2]);
+  double d111 = getDistance(c[0]+1, c[1]+1, c[2]+1);
+
+  // along z, then y, then x
+  double d00 = d000 + (d001 - d000) * t[2];
+  double d01 = d010 + (d011 - d010) * t[2];
+  double d10 = d100 + (d101 - d100) * t[2];
+  double d11 = d110 + (d111 - d110) * t[2];
+  double d0 = d00 + (d01 - d00) * t[1];
+  double d1 = d10 + (d11 - d10) * t[1];
+
+  if(gradient)
+  {
+    double dz00 = d001 - d000, dz01 = d011 - d010, dz10 = d101 - d100, dz11 = d111 - d110;
+    double dz0 = dz00 + (dz01 - dz00) * t[1];
+    double dz1 = dz10 + (dz11 - dz10) * t[1];
+    (*gradient)(0) = (d1 - d0) * inv_resolution_;
+    (*gradient)(1) = ((d01 - d00) + ((d11 - d10) - (d01 - d00)) * t[0]) * inv_resolution_;
+    (*gradient)(2) = (dz0 + (dz1 - dz0) * t[0]) * inv_resolution_;
+  }
+  return d0 + (d1 - d0) * t[0];
 }
 
-inline void OccupancyGrid::setReferenceFrame(const std::string &frame)
+inline double OccupancyGrid::getInterpolatedDistance(double x, double y, double z)
 {
-  reference_frame_ = frame;
+  return interpolate(x, y, z, NULL);
 }
 
-inline void OccupancyGrid::addPointsToField(const std::vector<Eigen::Vector3d> &points)
+inline double OccupancyGrid::getDistanceAndGradient(double x, double y, double z, Eigen::Vector3d &gradient)
 {
-  /*
-  std::vector<tf::Vector3> pts(points.size());
-  for(size_t i = 0; i < points.size(); ++i)
-    pts[i] = tf::Vector3(points[i].x(), points[i].y(), points[i].z());
-  
-  grid_->addPointsToField(pts);
-  */
-  EigenSTL::vector_Vector3d pts(points.size());
-  for(size_t i = 0; i < points.size(); ++i)
-    pts[i] = Eigen::Vector3d(points[i].x(), points[i].y(), points[i].z());
+  return interpolate(x, y, z, &gradient);
+}
 
-  grid_->addPointsToField(pts);
+inline std::string OccupancyGrid::getReferenceFrame()
+{
+  return reference_frame_;
 }
 
-inline void OccupancyGrid::updatePointsInField(const std::vector<Eigen::Vector3d> &points, bool iterative)
+inline void OccupancyGrid::setReferenceFrame(const std::string &frame)
 {
-  if(points.empty())
-    return;
-  /*
-  std::vector<tf::Vector3> pts(points.size());
-  for(size_t i = 0; i < points.size(); ++i)
-    pts[i] = tf::Vector3(points[i].x(), points[i].y(), points[i].z());
-  
-  grid_->updatePointsInField(pts, iterative);
-  */
-  //grid_->updatePointsInField(points, iterative);
+  reference_frame_ = frame;
 }
 
 }
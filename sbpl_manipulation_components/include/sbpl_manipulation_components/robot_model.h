@@ -35,6 +35,7 @@
 #include <ros/console.h>
 #include <angles/angles.h>
 #include <kdl/frames.hpp>
+#include <boost/shared_ptr.hpp>
 
 using namespace std;
 
@@ -48,13 +49,22 @@ namespace ik_option {
   };
 }
 
+/** @brief Scratch space (solvers, joint arrays) needed to run the kinematics
+ *  queries of a RobotModel without touching the model itself. One per
+ *  thread, made by RobotModel::createContext(). Models that need more derive
+ *  from it and only accept contexts they created. */
+struct RobotModelContext
+{
+  virtual ~RobotModelContext() {}
+};
+
 class RobotModel {
 
   public:
 
     RobotModel();
     
-    ~RobotModel(){};
+    virtual ~RobotModel(){};
    
     /* Initialization */
     virtual bool init(std::string robot_description, std::vector<std::string> &planning_joints);
@@ -73,24 +83,58 @@ class RobotModel {
 
     void getKinematicsFrame(std::string &name);
 
+    /** @brief a new context for the const queries, owned by the caller. Only
+     *  valid after init() */
+    virtual RobotModelContext* createContext() const;
+
     /* Joint Limits */
-    virtual bool checkJointLimits(const std::vector<double> &angles);
+    virtual bool checkJointLimits(const std::vector<double> &angles) const;
    
+    /** @brief limits of a planning joint (radians), false if it isn't one */
+    virtual bool getPlanningJointLimits(const std::string &name, double &min_limit, double &max_limit, bool &continuous) const;
+
+    /** @brief index of the planning joint the IK searches over (the free
+     *  angle), -1 if there isn't one */
+    virtual int getRedundantJointIndex() const;
+
     double getMaxJointLimit(std::string name);
 
     double getMinJointLimit(std::string name);
 
-    /* Forward Kinematics */
-    virtual bool computeFK(const std::vector<double> &angles, std::string name, KDL::Frame &f);
+    bool isJointContinuous(std::string name);
+
+    /* Forward Kinematics
+     * The const versions can be called from any number of threads at once,
+     * each with its own context. The others use a context owned by the model. */
+    virtual bool computeFK(const std::vector<double> &angles, const std::string &name, KDL::Frame &f, RobotModelContext &ctx) const;
+
+    virtual bool computeFK(const std::vector<double> &angles, const std::string &name, std::vector<double> &pose, RobotModelContext &ctx) const;
+
+    virtual bool computePlanningLinkFK(const std::vector<double> &angles, std::vector<double> &pose, RobotModelContext &ctx) const;
 
-    virtual bool computeFK(const std::vector<double> &angles, std::string name, std::vector<double> &pose);
+    /** @brief planning link FK of n configurations at once
+     *  @param angles joint j of configuration i is angles[j*n + i]
+     *  @param poses element k of the {x,y,z,r,p,y} pose of configuration i is written to poses[k*n + i]
+     *  @param frames (optional) gets every link frame of each configuration, for the collision model
+     *  @return false if any of the n failed */
+    virtual bool computePlanningLinkFKs(const double *angles, size_t n, double *poses, RobotModelContext &ctx, std::vector<std::vector<KDL::Frame> > *frames=NULL) const;
 
-    virtual bool computePlanningLinkFK(const std::vector<double> &angles, std::vector<double> &pose);
+    bool computeFK(const std::vector<double> &angles, std::string name, KDL::Frame &f);
+
+    bool computeFK(const std::vector<double> &angles, std::string name, std::vector<double> &pose);
+
+    bool computePlanningLinkFK(const std::vector<double> &angles, std::vector<double> &pose);
+
+    bool computePlanningLinkFKs(const double *angles, size_t n, double *poses, std::vector<std::vector<KDL::Frame> > *frames=NULL);
 
     /* Inverse Kinematics */
-    virtual bool computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option=0);
+    virtual bool computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option, RobotModelContext &ctx) const;
+
+    virtual bool computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, RobotModelContext &ctx) const;
 
-    virtual bool computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution);
+    bool computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option=0);
+
+    bool computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution);
 
     /* Debug Output */
     virtual void printRobotModelInformation();
@@ -125,6 +169,11 @@ class RobotModel {
    
     /** \brief ROS logger stream name */ 
     std::string logger_;
+
+    /** \brief context of the non-const queries, made on first use */
+    boost::shared_ptr<RobotModelContext> ctx_;
+
+    RobotModelContext& getContext();
 };
 
 }
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2010, Maxim Likhachev
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Pennsylvania nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SPARSE_DISTANCE_FIELD_
+#define _SPARSE_DISTANCE_FIELD_
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+#include <boost/unordered_map.hpp>
+
+namespace sbpl_arm_planner
+{
+
+/* \brief A distance field over a large bounding box that only stores the
+ * space near obstacles. The box is divided into blocks of 8x8x8 cells that
+ * are allocated the first time a distance below the max distance is
+ * propagated into them and are looked up in a hash map. Any cell in an
+ * unallocated block is at the max distance.
+ *
+ * Distances are propagated with the same brushfire as the
+ * CompactDistanceField (squared distances in cells, carrying the nearest
+ * obstacle along) and a cell has its center at origin + resolution * {x,y,z}.
+ * Unlike the CompactDistanceField, there's no padding, so look ups have to be
+ * in bounds.
+ */
+class SparseDistanceField
+{
+  public:
+
+    /**
+     * @brief Constructor
+     * @param number of cells along X
+     * @param number of cells along Y
+     * @param number of cells along Z
+     * @param resolution of grid (meters)
+     * @param X coordinate of the center of cell {0,0,0} (meters)
+     * @param Y coordinate of the center of cell {0,0,0} (meters)
+     * @param Z coordinate of the center of cell {0,0,0} (meters)
+     * @param distances are capped at this value (meters, at most 255 cells)
+    */
+    SparseDistanceField(int num_cells_x, int num_cells_y, int num_cells_z, double resolution, double origin_x, double origin_y, double origin_z, double max_distance);
+
+    ~SparseDistanceField();
+
+    /** @brief clear all of the obstacles and free the blocks */
+    void reset();
+
+    /** @brief mark the cells as obstacles and propagate. the cells are
+     *  given as {x,y,z} triples and have to be in bounds */
+    void addObstacleCells(const std::vector<int> &cells);
+
+    /** @brief clear the obstacle cells and repropagate the area around them */
+    void removeObstacleCells(const std::vector<int> &cells);
+
+    /** @brief remove old_cells and add new_cells with a single propagation */
+    void updateObstacleCells(const std::vector<int> &old_cells, const std::vector<int> &new_cells);
+
+    inline bool worldToGrid(double wx, double wy, double wz, int &x, int &y, int &z) const;
+
+    inline void gridToWorld(int x, int y, int z, double &wx, double &wy, double &wz) const;
+
+    inline bool isInBounds(int x, int y, int z) const;
+
+    /** @brief distance to the nearest obstacle (meters) */
+    inline double getDistance(int x, int y, int z) const;
+
+    /** @brief distance to the nearest obstacle (cells, rounded down) */
+    inline unsigned char getCellDistance(int x, int y, int z) const;
+
+    inline unsigned short getSquaredCellDistance(int x, int y, int z) const;
+
+    int getNumCellsX() const { return dims_[0]; };
+    int getNumCellsY() const { return dims_[1]; };
+    int getNumCellsZ() const { return dims_[2]; };
+    double getResolution() const { return resolution_; };
+    double getOriginX() const { return origin_[0]; };
+    double getOriginY() const { return origin_[1]; };
+    double getOriginZ() const { return origin_[2]; };
+    double getMaxDistance() const { return dist_table_[max_dsq_]; };
+
+    int getNumBlocks() const { return int(blocks_.size()); };
+
+    /** @brief memory used by the blocks (bytes) */
+    size_t getMemoryUsage() const;
+
+  private:
+
+    enum
+    {
+      BLOCK_BITS = 3,
+      BLOCK_SIZE = 1 << BLOCK_BITS,
+      BLOCK_MASK = BLOCK_SIZE - 1,
+      BLOCK_CELLS = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE
+    };
+
+    struct Block
+    {
+      unsigned short dsq[BLOCK_CELLS];
+
+      /* nearest obstacle of each cell, x is -1 if there is none */
+      short nearest[BLOCK_CELLS][3];
+    };
+
+    struct Cell
+    {
+      int x, y, z;
+    };
+
+    typedef boost::unordered_map<int64_t, Block*> BlockMap;
+
+    /* not copyable, the blocks are owned */
+    SparseDistanceField(const SparseDistanceField&);
+    SparseDistanceField& operator=(const SparseDistanceField&);
+
+    int dims_[3];
+    int block_dims_[3];
+    double resolution_;
+    double inv_resolution_;
+    double origin_[3];
+
+    int max_dsq_;
+    int neighbor_dirs_[26][3];
+
+    BlockMap blocks_;
+
+    /* distance in meters and in whole cells for each squared distance */
+    std::vector<double> dist_table_;
+    std::vector<unsigned char> cell_dist_table_;
+
+    /* cells waiting to be expanded, bucketed by squared distance */
+    std::vector<std::vector<Cell> > buckets_;
+
+    inline int64_t getBlockKey(int x, int y, int z) const;
+    inline int getBlockCell(int x, int y, int z) const;
+    inline const Block* findBlock(int x, int y, int z) const;
+    Block* getBlock(int x, int y, int z);
+
+    bool isObstacle(int x, int y, int z) const;
+    void addObstacles(const std::vector<int> &cells);
+    void removeObstacles(const std::vector<int> &cells);
+    void propagate();
+};
+
+inline bool SparseDistanceField::worldToGrid(double wx, double wy, double wz, int &x, int &y, int &z) const
+{
+  x = int(floor((wx - origin_[0]) * inv_resolution_ + 0.5));
+  y = int(floor((wy - origin_[1]) * inv_resolution_ + 0.5));
+  z = int(floor((wz - origin_[2]) * inv_resolution_ + 0.5));
+  return isInBounds(x, y, z);
+}
+
+inline void SparseDistanceField::gridToWorld(int x, int y, int z, double &wx, double &wy, double &wz) const
+{
+  wx = origin_[0] + resolution_ * x;
+  wy = origin_[1] + resolution_ * y;
+  wz = origin_[2] + resolution_ * z;
+}
+
+inline bool SparseDistanceField::isInBounds(int x, int y, int z) const
+{
+  return (unsigned(x) < unsigned(dims_[0])) && (unsigned(y) < unsigned(dims_[1])) && (unsigned(z) < unsigned(dims_[2]));
+}
+
+inline int64_t SparseDistanceField::getBlockKey(int x, int y, int z) const
+{
+  return (int64_t(x >> BLOCK_BITS) * block_dims_[1] + (y >> BLOCK_BITS)) * block_dims_[2] + (z >> BLOCK_BITS);
+}
+
+inline int SparseDistanceField::getBlockCell(int x, int y, int z) const
+{
+  return (((x & BLOCK_MASK) << BLOCK_BITS) + (y & BLOCK_MASK)) * BLOCK_SIZE + (z & BLOCK_MASK);
+}
+
+inline const SparseDistanceField::Block* SparseDistanceField::findBlock(int x, int y, int z) const
+{
+  BlockMap::const_iterator it = blocks_.find(getBlockKey(x, y, z));
+  if(it == blocks_.end())
+    return NULL;
+  return it->second;
+}
+
+inline unsigned short SparseDistanceField::getSquaredCellDistance(int x, int y, int z) const
+{
+  const Block *b = findBlock(x, y, z);
+  if(b == NULL)
+    return max_dsq_;
+  return b->dsq[getBlockCell(x, y, z)];
+}
+
+inline double SparseDistanceField::getDistance(int x, int y, int z) const
+{
+  return dist_table_[getSquaredCellDistance(x, y, z)];
+}
+
+inline unsigned char SparseDistanceField::getCellDistance(int x, int y, int z) const
+{
+  return cell_dist_table_[getSquaredCellDistance(x, y, z)];
+}
+
+}
+
+#endif
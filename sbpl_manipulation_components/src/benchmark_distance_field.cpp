@@ -0,0 +1,90 @@
+#include <ros/ros.h>
+#include <cstdlib>
+#include <sbpl_manipulation_components/occupancy_grid.h>
+
+using namespace sbpl_arm_planner;
+
+/* fill random boxes of voxels into the workspace */
+void getRandomBoxes(int num_boxes, double size, double resolution, std::vector<Eigen::Vector3d> &points)
+{
+  for(int i = 0; i < num_boxes; ++i)
+  {
+    double cx = size * (rand() / double(RAND_MAX));
+    double cy = size * (rand() / double(RAND_MAX));
+    double cz = size * (rand() / double(RAND_MAX));
+    double half = 0.05 + 0.15 * (rand() / double(RAND_MAX));
+    for(double x = cx - half; x <= cx + half; x += resolution)
+      for(double y = cy - half; y <= cy + half; y += resolution)
+        for(double z = cz - half; z <= cz + half; z += resolution)
+          points.push_back(Eigen::Vector3d(x, y, z));
+  }
+}
+
+double timeAdd(OccupancyGrid *grid, const std::vector<Eigen::Vector3d> &points)
+{
+  ros::WallTime start = ros::WallTime::now();
+  grid->addPointsToField(points);
+  return (ros::WallTime::now() - start).toSec();
+}
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "benchmark_distance_field");
+  double size = 3.0, resolution = 0.02;
+  int num_boxes = 40, num_threads = 4;
+
+  if(argc > 1)
+    num_threads = atoi(argv[1]);
+  if(argc > 2)
+    num_boxes = atoi(argv[2]);
+  if(argc > 3)
+    resolution = atof(argv[3]);
+
+  srand(1);
+  std::vector<Eigen::Vector3d> points;
+  getRandomBoxes(num_boxes, size, resolution, points);
+  ROS_INFO("Adding %d points to a %0.1fm cube at %0.3fm resolution.", int(points.size()), size, resolution);
+
+  OccupancyGrid pdf(size, size, size, resolution, 0, 0, 0);
+  OccupancyGrid brushfire(size, size, size, resolution, 0, 0, 0, OccupancyGrid::COMPACT_DISTANCE_FIELD);
+  OccupancyGrid edt(size, size, size, resolution, 0, 0, 0, OccupancyGrid::COMPACT_DISTANCE_FIELD);
+  OccupancyGrid sparse(size, size, size, resolution, 0, 0, 0, OccupancyGrid::SPARSE_DISTANCE_FIELD);
+  OccupancyGrid edt_single(size, size, size, resolution, 0, 0, 0, OccupancyGrid::COMPACT_DISTANCE_FIELD);
+  edt.setNumPropagationThreads(num_threads);
+  edt_single.setNumPropagationThreads(1);
+
+  ROS_INFO("       PropagationDistanceField: %0.5fsec", timeAdd(&pdf, points));
+  ROS_INFO("   compact field, brushfire: %0.5fsec", timeAdd(&brushfire, points));
+  double sparse_time = timeAdd(&sparse, points);
+  ROS_INFO("                sparse field: %0.5fsec (%d blocks, %0.1fMB)", sparse_time, sparse.getSparseDistanceFieldPtr()->getNumBlocks(), sparse.getSparseDistanceFieldPtr()->getMemoryUsage() / (1024.0*1024.0));
+  ROS_INFO(" compact field, EDT 1 thread: %0.5fsec", timeAdd(&edt_single, points));
+  ROS_INFO("compact field, EDT %d threads: %0.5fsec", num_threads, timeAdd(&edt, points));
+
+  // the transform is exact, compare the others against it
+  int dim_x, dim_y, dim_z, num_pdf = 0, num_brushfire = 0;
+  double max_pdf = 0, max_brushfire = 0, d;
+  edt.getGridSize(dim_x, dim_y, dim_z);
+  for(int x = 0; x < dim_x; ++x)
+  {
+    for(int y = 0; y < dim_y; ++y)
+    {
+      for(int z = 0; z < dim_z; ++z)
+      {
+        d = fabs(pdf.getDistance(x,y,z) - edt.getDistance(x,y,z));
+        if(d > 1e-6)
+        {
+          num_pdf++;
+          max_pdf = std::max(max_pdf, d);
+        }
+        d = fabs(brushfire.getDistance(x,y,z) - edt.getDistance(x,y,z));
+        if(d > 1e-6)
+        {
+          num_brushfire++;
+          max_brushfire = std::max(max_brushfire, d);
+        }
+      }
+    }
+  }
+  ROS_INFO("cells that differ from the EDT:  PropagationDistanceField: %d (max %0.4fm)  brushfire: %d (max %0.4fm)", num_pdf, max_pdf, num_brushfire, max_brushfire);
+  return 0;
+}
@@ -41,19 +41,67 @@ bool CollisionChecker::isStateValid(const std::vector<double> &angles, bool verb
   return false;
 }
 
-bool CollisionChecker::isStateValid(const std::vector<double> &angles, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, bool verbose, bool visualize, double &dist)
+CollisionCheckerContext* CollisionChecker::createContext() const
+{
+  return NULL;
+}
+
+bool CollisionChecker::isStateValid(const std::vector<double> &angles, CollisionCheckerContext &ctx, bool verbose, double &dist) const
 {
   ROS_ERROR("Function is not filled in.");
   return false;
 }
 
-bool CollisionChecker::isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, std::vector<std::vector<std::vector<KDL::Frame> > > &frames, int &path_length, int &num_checks, double &dist)
+bool CollisionChecker::isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, int &path_length, int &num_checks, double &dist)
 {
   ROS_ERROR("Function is not filled in.");
   return false;
 }
 
-bool CollisionChecker::isStateToStateValid(const std::vector<double> &angles0, const std::vector<double> &angles1, int &path_length, int &num_checks, double &dist)
+bool CollisionChecker::isStatesValid(const double *configs, int num_joints, size_t n, bool verbose, unsigned char *valid, double *dist)
+{
+  bool all_valid = true;
+  double d = 0;
+  std::vector<double> angles(num_joints);
+  for(size_t i = 0; i < n; ++i)
+  {
+    angles.assign(configs + i*angles.size(), configs + (i+1)*angles.size());
+    bool v = isStateValid(angles, verbose, false, d);
+    if(valid != NULL)
+      valid[i] = v;
+    if(dist != NULL)
+      dist[i] = d;
+    all_valid = all_valid && v;
+  }
+  return all_valid;
+}
+
+bool CollisionChecker::isStatesValid(const double *configs, int num_joints, const int *group_ends, size_t num_groups, bool verbose, unsigned char *valid, double *dist)
+{
+  bool all_valid = true;
+  int begin = 0;
+  for(size_t g = 0; g < num_groups; ++g)
+  {
+    bool v = true;
+    for(int i = begin; i < group_ends[g]; ++i)
+    {
+      if(v)
+        v = isStatesValid(configs + i*num_joints, num_joints, 1, verbose, valid == NULL ? NULL : valid + i, dist == NULL ? NULL : dist + i);
+      else
+      {
+        if(valid != NULL)
+          valid[i] = 0;
+        if(dist != NULL)
+          dist[i] = 0;
+      }
+    }
+    all_valid = all_valid && v;
+    begin = group_ends[g];
+  }
+  return all_valid;
+}
+
+bool CollisionChecker::getCollisionSpheres(const std::vector<double> &angles, std::vector<std::vector<double> > &spheres)
 {
   ROS_ERROR("Function is not filled in.");
   return false;
@@ -0,0 +1,576 @@
+/*
+ * Copyright (c) 2010, Maxim Likhachev
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Pennsylvania nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sbpl_manipulation_components/compact_distance_field.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <ros/console.h>
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace sbpl_arm_planner
+{
+
+/* the snapshot is this header followed by the padded array as it is in
+ * memory (native byte order) */
+struct SnapshotHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  int32_t num_cells[3];
+  int32_t max_dsq;
+  double resolution;
+  double origin[3];
+  uint64_t data_size;
+};
+
+static const char SNAPSHOT_MAGIC[8] = {'S','B','P','L','G','R','I','D'};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+CompactDistanceField::CompactDistanceField(int num_cells_x, int num_cells_y, int num_cells_z, double resolution, double origin_x, double origin_y, double origin_z, double max_distance)
+{
+  init(num_cells_x, num_cells_y, num_cells_z, resolution, origin_x, origin_y, origin_z, max_distance);
+  reset();
+}
+
+CompactDistanceField::CompactDistanceField()
+{
+  dsq_ = NULL;
+  mapping_ = NULL;
+  mapping_size_ = 0;
+}
+
+CompactDistanceField::~CompactDistanceField()
+{
+  if(mapping_)
+    munmap(mapping_, mapping_size_);
+}
+
+void CompactDistanceField::init(int num_cells_x, int num_cells_y, int num_cells_z, double resolution, double origin_x, double origin_y, double origin_z, double max_distance)
+{
+  dsq_ = NULL;
+  mapping_ = NULL;
+  mapping_size_ = 0;
+
+  dims_[0] = num_cells_x;
+  dims_[1] = num_cells_y;
+  dims_[2] = num_cells_z;
+  for(int i = 0; i < 3; ++i)
+    pdims_[i] = dims_[i] + 2;
+  num_padded_cells_ = size_t(pdims_[0]) * pdims_[1] * pdims_[2];
+  stride_y_ = pdims_[2];
+  stride_x_ = pdims_[1] * pdims_[2];
+
+  resolution_ = resolution;
+  inv_resolution_ = 1.0 / resolution;
+  origin_[0] = origin_x;
+  origin_[1] = origin_y;
+  origin_[2] = origin_z;
+
+  // the distance in whole cells has to fit in an unsigned char
+  int max_cells = int(max_distance * inv_resolution_ + 0.5);
+  if(max_cells > 255)
+    max_cells = 255;
+  if(max_cells < 1)
+    max_cells = 1;
+  max_dsq_ = max_cells * max_cells;
+
+  dist_table_.resize(max_dsq_ + 1);
+  cell_dist_table_.resize(max_dsq_ + 1);
+  for(int d = 0; d <= max_dsq_; ++d)
+  {
+    dist_table_[d] = sqrt(double(d)) * resolution_;
+    cell_dist_table_[d] = (unsigned char)(sqrt(double(d)));
+  }
+  buckets_.resize(max_dsq_ + 1);
+  num_threads_ = 0;
+
+  int n = 0;
+  for(int dx = -1; dx <= 1; ++dx)
+  {
+    for(int dy = -1; dy <= 1; ++dy)
+    {
+      for(int dz = -1; dz <= 1; ++dz)
+      {
+        if(dx == 0 && dy == 0 && dz == 0)
+          continue;
+        neighbor_dirs_[n][0] = dx;
+        neighbor_dirs_[n][1] = dy;
+        neighbor_dirs_[n][2] = dz;
+        neighbor_offsets_[n] = dx * stride_x_ + dy * stride_y_ + dz;
+        n++;
+      }
+    }
+  }
+}
+
+void CompactDistanceField::reset()
+{
+  if(mapping_)
+  {
+    munmap(mapping_, mapping_size_);
+    mapping_ = NULL;
+  }
+
+  dsq_storage_.assign(num_padded_cells_, 0);
+  dsq_ = &dsq_storage_[0];
+  nearest_.assign(num_padded_cells_, -1);
+
+  // everything but the padding starts out far from any obstacle
+  for(int x = 0; x < dims_[0]; ++x)
+  {
+    for(int y = 0; y < dims_[1]; ++y)
+    {
+      int cell = getCellIndex(x, y, 0);
+      for(int z = 0; z < dims_[2]; ++z, ++cell)
+        dsq_[cell] = max_dsq_;
+    }
+  }
+}
+
+void CompactDistanceField::getCellCoords(int cell, int &x, int &y, int &z) const
+{
+  x = cell / stride_x_;
+  cell -= x * stride_x_;
+  y = cell / stride_y_;
+  z = cell - y * stride_y_;
+}
+
+void CompactDistanceField::addObstacleCells(const std::vector<int> &cells)
+{
+  if(mapping_)
+    unmapSnapshot();
+
+  if(num_threads_ > 0)
+  {
+    setObstacles(cells, true);
+    computeDistanceTransform();
+    return;
+  }
+  addObstacles(cells);
+  propagate();
+}
+
+void CompactDistanceField::removeObstacleCells(const std::vector<int> &cells)
+{
+  if(mapping_)
+    unmapSnapshot();
+
+  if(num_threads_ > 0)
+  {
+    setObstacles(cells, false);
+    computeDistanceTransform();
+    return;
+  }
+  removeObstacles(cells);
+  propagate();
+}
+
+void CompactDistanceField::updateObstacleCells(const std::vector<int> &old_cells, const std::vector<int> &new_cells)
+{
+  if(mapping_)
+    unmapSnapshot();
+
+  if(num_threads_ > 0)
+  {
+    setObstacles(old_cells, false);
+    setObstacles(new_cells, true);
+    computeDistanceTransform();
+    return;
+  }
+  removeObstacles(old_cells);
+  addObstacles(new_cells);
+  propagate();
+}
+
+void CompactDistanceField::setNumThreads(int num_threads)
+{
+  if(num_threads < 0)
+    num_threads = 0;
+  if(num_threads == num_threads_)
+    return;
+
+  bool was_transform = (num_threads_ > 0);
+  num_threads_ = num_threads;
+
+  // nearest_ is rebuilt when the snapshot is unmapped
+  if(mapping_)
+    return;
+
+  // the brushfire needs the nearest obstacle of every cell
+  if(was_transform && num_threads_ == 0)
+    rebuild();
+  else if(!was_transform && num_threads_ > 0)
+  {
+    for(int c = 0; c < int(num_padded_cells_); ++c)
+    {
+      if(nearest_[c] != c)
+        nearest_[c] = -1;
+    }
+  }
+}
+
+void CompactDistanceField::rebuild()
+{
+  std::vector<int> obstacles;
+  for(int c = 0; c < int(num_padded_cells_); ++c)
+  {
+    if(nearest_[c] == c)
+      obstacles.push_back(c);
+  }
+  reset();
+  addObstacleCells(obstacles);
+}
+
+void CompactDistanceField::unmapSnapshot()
+{
+  // the snapshot only has the distances, so recover the obstacles from them
+  // and propagate again the first time the field changes
+  std::vector<int> obstacles;
+  for(int x = 0; x < dims_[0]; ++x)
+  {
+    for(int y = 0; y < dims_[1]; ++y)
+    {
+      int cell = getCellIndex(x, y, 0);
+      for(int z = 0; z < dims_[2]; ++z, ++cell)
+      {
+        if(dsq_[cell] == 0)
+          obstacles.push_back(cell);
+      }
+    }
+  }
+  reset();
+  addObstacleCells(obstacles);
+}
+
+bool CompactDistanceField::saveSnapshot(const std::string &filename) const
+{
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.header_size = sizeof(SnapshotHeader);
+  for(int i = 0; i < 3; ++i)
+  {
+    header.num_cells[i] = dims_[i];
+    header.origin[i] = origin_[i];
+  }
+  header.max_dsq = max_dsq_;
+  header.resolution = resolution_;
+  header.data_size = num_padded_cells_ * sizeof(unsigned short);
+
+  std::ofstream fout(filename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+  if(!fout.is_open())
+  {
+    ROS_ERROR("[grid] Failed to open %s for writing.", filename.c_str());
+    return false;
+  }
+  fout.write((const char*)&header, sizeof(header));
+  fout.write((const char*)dsq_, header.data_size);
+  fout.close();
+
+  if(fout.fail())
+  {
+    ROS_ERROR("[grid] Failed to write the snapshot to %s.", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+CompactDistanceField* CompactDistanceField::mapSnapshot(const std::string &filename)
+{
+  struct stat file_stats;
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+  {
+    ROS_ERROR("[grid] Failed to open %s for reading.", filename.c_str());
+    return NULL;
+  }
+
+  if(fstat(fd, &file_stats) != 0 || size_t(file_stats.st_size) < sizeof(SnapshotHeader))
+  {
+    ROS_ERROR("[grid] %s is too small to be a grid snapshot.", filename.c_str());
+    close(fd);
+    return NULL;
+  }
+
+  // private so that the updates are copy-on-write
+  size_t size = file_stats.st_size;
+  void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED)
+  {
+    ROS_ERROR("[grid] Failed to map %s.", filename.c_str());
+    return NULL;
+  }
+
+  const SnapshotHeader *header = (const SnapshotHeader*)mapping;
+  if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION || header->header_size != sizeof(SnapshotHeader))
+  {
+    ROS_ERROR("[grid] %s isn't a version %d grid snapshot.", filename.c_str(), int(SNAPSHOT_VERSION));
+    munmap(mapping, size);
+    return NULL;
+  }
+
+  CompactDistanceField *df = new CompactDistanceField();
+  df->init(header->num_cells[0], header->num_cells[1], header->num_cells[2], header->resolution, header->origin[0], header->origin[1], header->origin[2], sqrt(double(header->max_dsq)) * header->resolution);
+
+  if(df->max_dsq_ != header->max_dsq || header->data_size != df->num_padded_cells_ * sizeof(unsigned short) || size != header->header_size + header->data_size)
+  {
+    ROS_ERROR("[grid] The size of %s doesn't match its header.", filename.c_str());
+    munmap(mapping, size);
+    delete df;
+    return NULL;
+  }
+
+  df->mapping_ = mapping;
+  df->mapping_size_ = size;
+  df->dsq_ = (unsigned short*)((char*)mapping + header->header_size);
+  return df;
+}
+
+void CompactDistanceField::setObstacles(const std::vector<int> &cells, bool obstacle)
+{
+  for(size_t i = 0; i < cells.size(); ++i)
+    nearest_[cells[i]] = obstacle ? cells[i] : -1;
+}
+
+void CompactDistanceField::addObstacles(const std::vector<int> &cells)
+{
+  for(size_t i = 0; i < cells.size(); ++i)
+  {
+    int c = cells[i];
+    if(nearest_[c] == c)
+      continue;
+    dsq_[c] = 0;
+    nearest_[c] = c;
+    buckets_[0].push_back(c);
+  }
+}
+
+void CompactDistanceField::removeObstacles(const std::vector<int> &cells)
+{
+  std::vector<int> cleared;
+  for(size_t i = 0; i < cells.size(); ++i)
+  {
+    int c = cells[i];
+    if(nearest_[c] != c)
+      continue;
+    nearest_[c] = -1;
+    dsq_[c] = max_dsq_;
+    cleared.push_back(c);
+  }
+
+  // the propagation hands a cell's nearest obstacle on to its neighbors, so
+  // the cells that pointed at a removed obstacle are reached by spreading out
+  // from it and the work stays bounded by the region it covered
+  for(size_t i = 0; i < cleared.size(); ++i)
+  {
+    for(int n = 0; n < 26; ++n)
+    {
+      int nc = cleared[i] + neighbor_offsets_[n];
+      int o = nearest_[nc];
+      if(o < 0 || nearest_[o] == o)
+        continue;
+      nearest_[nc] = -1;
+      dsq_[nc] = max_dsq_;
+      cleared.push_back(nc);
+    }
+  }
+
+  // repropagate into the cleared cells from the cells around them
+  for(size_t i = 0; i < cleared.size(); ++i)
+  {
+    for(int n = 0; n < 26; ++n)
+    {
+      int nc = cleared[i] + neighbor_offsets_[n];
+      if(nearest_[nc] >= 0)
+        buckets_[dsq_[nc]].push_back(nc);
+    }
+  }
+}
+
+void CompactDistanceField::propagate()
+{
+  int cx, cy, cz, ox, oy, oz, dx, dy, dz, nd, nc, next;
+
+  int d = 0;
+  while(d <= max_dsq_)
+  {
+    next = d + 1;
+
+    // the bucket can grow while it's being expanded (a neighbor can be as
+    // close to the obstacle as the cell itself)
+    for(size_t i = 0; i < buckets_[d].size(); ++i)
+    {
+      int c = buckets_[d][i];
+      if(dsq_[c] != d)
+        continue;
+
+      int o = nearest_[c];
+      getCellCoords(c, cx, cy, cz);
+      getCellCoords(o, ox, oy, oz);
+
+      for(int n = 0; n < 26; ++n)
+      {
+        nc = c + neighbor_offsets_[n];
+        dx = cx + neighbor_dirs_[n][0] - ox;
+        dy = cy + neighbor_dirs_[n][1] - oy;
+        dz = cz + neighbor_dirs_[n][2] - oz;
+        nd = dx*dx + dy*dy + dz*dz;
+
+        // the padding is at zero, so it's never written to
+        if(nd < dsq_[nc])
+        {
+          dsq_[nc] = nd;
+          nearest_[nc] = o;
+          buckets_[nd].push_back(nc);
+
+          // rarely, a cell is closer than the ones already expanded
+          if(nd < next && nd < d)
+            next = nd;
+        }
+      }
+    }
+    buckets_[d].clear();
+    d = next;
+  }
+}
+
+void CompactDistanceField::computeDistanceTransform()
+{
+  int x, y, z, cell, i;
+  size_t num_cells = size_t(dims_[0]) * dims_[1] * dims_[2];
+  edt_.resize(num_cells);
+
+  // anything farther than the max distance is cut off at the end anyway, so
+  // it can start out at the max distance rather than infinity
+  for(x = 0, i = 0; x < dims_[0]; ++x)
+  {
+    for(y = 0; y < dims_[1]; ++y)
+    {
+      cell = getCellIndex(x, y, 0);
+      for(z = 0; z < dims_[2]; ++z, ++cell, ++i)
+        edt_[i] = (nearest_[cell] == cell) ? 0 : max_dsq_;
+    }
+  }
+
+  // one pass per axis, the lines along the axis are independent
+  int num_lines[3] = {dims_[1]*dims_[2], dims_[0]*dims_[2], dims_[0]*dims_[1]};
+  for(int axis = 2; axis >= 0; --axis)
+  {
+    int num_threads = std::min(num_threads_, num_lines[axis]);
+    if(num_threads <= 1)
+    {
+      transformLines(axis, 0, num_lines[axis]);
+      continue;
+    }
+
+    boost::thread_group threads;
+    for(int t = 0; t < num_threads; ++t)
+      threads.create_thread(boost::bind(&CompactDistanceField::transformLines, this, axis, (t * num_lines[axis]) / num_threads, ((t+1) * num_lines[axis]) / num_threads));
+    threads.join_all();
+  }
+
+  for(x = 0, i = 0; x < dims_[0]; ++x)
+  {
+    for(y = 0; y < dims_[1]; ++y)
+    {
+      cell = getCellIndex(x, y, 0);
+      for(z = 0; z < dims_[2]; ++z, ++cell, ++i)
+        dsq_[cell] = std::min(edt_[i], max_dsq_);
+    }
+  }
+}
+
+void CompactDistanceField::transformLines(int axis, int begin, int end)
+{
+  int n = dims_[axis];
+  int stride, start, k;
+  double s;
+  std::vector<int> f(n), v(n);
+  std::vector<double> b(n+1);
+
+  for(int l = begin; l < end; ++l)
+  {
+    // edt_ is laid out as [x][y][z]
+    if(axis == 2)
+    {
+      stride = 1;
+      start = l * dims_[2];
+    }
+    else if(axis == 1)
+    {
+      stride = dims_[2];
+      start = (l / dims_[2]) * dims_[1] * dims_[2] + (l % dims_[2]);
+    }
+    else
+    {
+      stride = dims_[1] * dims_[2];
+      start = l;
+    }
+
+    for(int q = 0; q < n; ++q)
+      f[q] = edt_[start + q*stride];
+
+    // lower envelope of the parabolas rooted at (q, f[q])
+    k = 0;
+    v[0] = 0;
+    b[0] = -1e20;
+    b[1] = 1e20;
+    for(int q = 1; q < n; ++q)
+    {
+      s = double((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2.0 * (q - v[k]));
+      while(s <= b[k])
+      {
+        k--;
+        s = double((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2.0 * (q - v[k]));
+      }
+      k++;
+      v[k] = q;
+      b[k] = s;
+      b[k+1] = 1e20;
+    }
+
+    k = 0;
+    for(int q = 0; q < n; ++q)
+    {
+      while(b[k+1] < q)
+        k++;
+      edt_[start + q*stride] = (q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+  }
+}
+
+}
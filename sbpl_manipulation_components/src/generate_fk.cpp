@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2010, Maxim Likhachev
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Pennsylvania nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Writes a C++ file with the forward kinematics of a chain in the URDF. The
+ * fixed transforms between the joints are multiplied together ahead of time,
+ * rotations about a principal axis are expanded by hand, and every frame of
+ * the chain comes out of one pass. A second function does the same for
+ * GENERATED_FK_LANES configurations at a time. The CMakeLists runs it for
+ * each chain built into the library (see GENERATED_FK_SOURCES), use a
+ * GeneratedFKRobotModel to get at the result.
+ *
+ *   generate_fk <urdf file> <chain root link> <chain tip link> <output file>
+ */
+
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <urdf/model.h>
+#include <kdl_parser/kdl_parser.hpp>
+#include <kdl/chain.hpp>
+#include <kdl/frames.hpp>
+#include <sbpl_manipulation_components/generated_fk_robot_model.h>
+
+#define EPS 1e-12
+
+static bool isRotational(const KDL::Joint &j)
+{
+  return (j.getType() == KDL::Joint::RotAxis || j.getType() == KDL::Joint::RotX || j.getType() == KDL::Joint::RotY || j.getType() == KDL::Joint::RotZ);
+}
+
+/* The emitted function keeps the frame it's at in r[9] (row major) and
+ * p[3]. With lanes, every variable gets a GENERATED_FK_LANES dimension and
+ * each statement becomes a loop over the lanes. That spreads the call
+ * overhead over the lanes. Whether the loops are vectorized is up to the
+ * compiler, nothing here checks for it. */
+class FKWriter
+{
+  public:
+
+    FKWriter(std::ostream &out, bool lanes) : out_(out), lanes_(lanes), constant_(true), pending_(KDL::Frame::Identity())
+    {
+    }
+
+    /* the fixed transform after the last joint, not applied yet */
+    void appendFixed(const KDL::Frame &f)
+    {
+      pending_ = pending_ * f;
+    }
+
+    /* frames[index] = current * pending */
+    void writeFrame(int index)
+    {
+      if(constant_)
+      {
+        KDL::Frame f = current_ * pending_;
+        if(lanes_)
+        {
+          std::string s;
+          for(int i = 0; i < 12; ++i)
+            s += (i > 0 ? " " : "") + std::string("frames[") + str(12*index + i) + "*GENERATED_FK_LANES + l] = " + num(i < 9 ? f.M(i/3, i%3) : f.p(i-9)) + ";";
+          statement(s);
+          return;
+        }
+        out_ << "  frames[" << index << "] = KDL::Frame(KDL::Rotation(";
+        for(int i = 0; i < 9; ++i)
+          out_ << num(f.M(i/3, i%3)) << (i < 8 ? ", " : "), ");
+        out_ << "KDL::Vector(" << num(f.p(0)) << ", " << num(f.p(1)) << ", " << num(f.p(2)) << "));\n";
+        return;
+      }
+
+      // the next joint starts from this frame, so bring it up to date once
+      flush();
+      if(!lanes_)
+      {
+        out_ << "  frames[" << index << "] = KDL::Frame(KDL::Rotation(r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8]), KDL::Vector(p[0], p[1], p[2]));\n";
+        return;
+      }
+
+      std::string s;
+      for(int i = 0; i < 12; ++i)
+        s += (i > 0 ? " " : "") + std::string("frames[") + str(12*index + i) + "*GENERATED_FK_LANES + l] = " + (i < 9 ? R(i) : P(i-9)) + ";";
+      statement(s);
+    }
+
+    /* current = current * pending * Rot(axis, q[joint]) */
+    void writeRotation(int joint, const KDL::Vector &axis)
+    {
+      flush();
+      int a = principalAxis(axis);
+      statement(C() + " = cos(" + Q(joint) + ");");
+      statement(S() + " = " + (a < 0 ? "-" : "") + "sin(" + Q(joint) + ");");
+
+      // only two columns change for a principal axis
+      if(a == 1 || a == -1)
+        writeColumnRotation(1, 2);
+      else if(a == 2 || a == -2)
+        writeColumnRotation(2, 0);
+      else if(a == 3 || a == -3)
+        writeColumnRotation(0, 1);
+      else
+      {
+        // Rodrigues, r = r * m
+        double x = axis.x(), y = axis.y(), z = axis.z();
+        statement(V() + " = 1 - " + C() + ";");
+        statement(M(0) + " = " + C() + " + " + num(x*x) + "*" + V() + "; " + M(1) + " = " + num(x*y) + "*" + V() + " - " + num(z) + "*" + S() + "; " + M(2) + " = " + num(x*z) + "*" + V() + " + " + num(y) + "*" + S() + ";");
+        statement(M(3) + " = " + num(x*y) + "*" + V() + " + " + num(z) + "*" + S() + "; " + M(4) + " = " + C() + " + " + num(y*y) + "*" + V() + "; " + M(5) + " = " + num(y*z) + "*" + V() + " - " + num(x) + "*" + S() + ";");
+        statement(M(6) + " = " + num(x*z) + "*" + V() + " - " + num(y) + "*" + S() + "; " + M(7) + " = " + num(y*z) + "*" + V() + " + " + num(x) + "*" + S() + "; " + M(8) + " = " + C() + " + " + num(z*z) + "*" + V() + ";");
+        for(int i = 0; i < 3; ++i)
+        {
+          for(int j = 0; j < 3; ++j)
+            statement(T(j) + " = " + R(3*i) + "*" + M(j) + " + " + R(3*i+1) + "*" + M(3+j) + " + " + R(3*i+2) + "*" + M(6+j) + ";");
+          statement(R(3*i) + " = " + T(0) + "; " + R(3*i+1) + " = " + T(1) + "; " + R(3*i+2) + " = " + T(2) + ";");
+        }
+      }
+    }
+
+    /* current = current * pending * Trans(axis * q[joint]) */
+    void writeTranslation(int joint, const KDL::Vector &axis)
+    {
+      flush();
+      for(int i = 0; i < 3; ++i)
+      {
+        std::string e = sum(term(R(3*i), axis.x()), term(R(3*i+1), axis.y()), term(R(3*i+2), axis.z()));
+        if(e != "0")
+          statement(P(i) + " += (" + e + ")*" + Q(joint) + ";");
+      }
+    }
+
+  private:
+
+    std::ostream &out_;
+    bool lanes_;
+
+    /* while no joint has been passed the frame is known here */
+    bool constant_;
+    KDL::Frame current_;
+    KDL::Frame pending_;
+
+    /* variable names */
+    std::string lane() const { return lanes_ ? "[l]" : ""; }
+    std::string R(int i) const { return "r[" + str(i) + "]" + lane(); }
+    std::string P(int i) const { return "p[" + str(i) + "]" + lane(); }
+    std::string T(int i) const { return "t[" + str(i) + "]" + lane(); }
+    std::string M(int i) const { return "m[" + str(i) + "]" + lane(); }
+    std::string C() const { return "c" + lane(); }
+    std::string S() const { return "s" + lane(); }
+    std::string V() const { return "v" + lane(); }
+    std::string Q(int joint) const { return lanes_ ? "q[" + str(joint) + "*GENERATED_FK_LANES + l]" : "q[" + str(joint) + "]"; }
+
+    void statement(const std::string &s)
+    {
+      if(lanes_)
+        out_ << "  for(l = 0; l < GENERATED_FK_LANES; ++l) { " << s << " }\n";
+      else
+        out_ << "  " << s << "\n";
+    }
+
+    static std::string str(int i)
+    {
+      std::ostringstream s;
+      s << i;
+      return s.str();
+    }
+
+    static std::string num(double d)
+    {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.17g", d);
+      return buf;
+    }
+
+    /* 1,2,3 for +X,+Y,+Z, negative for -X,-Y,-Z, 0 otherwise */
+    static int principalAxis(const KDL::Vector &a)
+    {
+      for(int i = 0; i < 3; ++i)
+      {
+        if(fabs(a(i) - 1.0) < EPS && fabs(a((i+1)%3)) < EPS && fabs(a((i+2)%3)) < EPS)
+          return i+1;
+        if(fabs(a(i) + 1.0) < EPS && fabs(a((i+1)%3)) < EPS && fabs(a((i+2)%3)) < EPS)
+          return -(i+1);
+      }
+      return 0;
+    }
+
+    static std::string term(const std::string &var, double d)
+    {
+      if(fabs(d) < EPS)
+        return "";
+      if(fabs(d - 1.0) < EPS)
+        return var;
+      if(fabs(d + 1.0) < EPS)
+        return "-" + var;
+      return num(d) + "*" + var;
+    }
+
+    static std::string sum(const std::string &a, const std::string &b, const std::string &c, const std::string &d = "")
+    {
+      std::string terms[4] = {a, b, c, d};
+      std::string s;
+      for(int i = 0; i < 4; ++i)
+      {
+        if(terms[i].empty())
+          continue;
+        if(s.empty())
+          s = terms[i];
+        else if(terms[i][0] == '-')
+          s += " - " + terms[i].substr(1);
+        else
+          s += " + " + terms[i];
+      }
+      return s.empty() ? "0" : s;
+    }
+
+    /* (r * m)(row, col) */
+    std::string rotationProduct(int row, int col, const KDL::Rotation &m) const
+    {
+      return sum(term(R(3*row), m(0,col)), term(R(3*row+1), m(1,col)), term(R(3*row+2), m(2,col)));
+    }
+
+    /* (p + r * v)(row) */
+    std::string translationProduct(int row, const KDL::Vector &v) const
+    {
+      return sum(P(row), term(R(3*row), v(0)), term(R(3*row+1), v(1)), term(R(3*row+2), v(2)));
+    }
+
+    /* columns a and b are rotated into each other: a' = c*a + s*b, b' = c*b - s*a */
+    void writeColumnRotation(int a, int b)
+    {
+      for(int i = 0; i < 3; ++i)
+        statement(T(0) + " = " + R(3*i+a) + "; " + R(3*i+a) + " = " + C() + "*" + T(0) + " + " + S() + "*" + R(3*i+b) + "; " + R(3*i+b) + " = " + C() + "*" + R(3*i+b) + " - " + S() + "*" + T(0) + ";");
+    }
+
+    /* apply the pending fixed transform to the current frame */
+    void flush()
+    {
+      if(constant_)
+      {
+        KDL::Frame f = current_ * pending_;
+        for(int i = 0; i < 9; ++i)
+          statement(R(i) + " = " + num(f.M(i/3, i%3)) + ";");
+        for(int i = 0; i < 3; ++i)
+          statement(P(i) + " = " + num(f.p(i)) + ";");
+        constant_ = false;
+      }
+      else
+      {
+        std::string e[12];
+        for(int i = 0; i < 3; ++i)
+        {
+          e[9+i] = translationProduct(i, pending_.p);
+          for(int j = 0; j < 3; ++j)
+            e[3*i+j] = rotationProduct(i, j, pending_.M);
+        }
+        for(int i = 0; i < 3; ++i)
+          if(e[9+i] != P(i))
+            statement(P(i) + " = " + e[9+i] + ";");
+
+        // a row at a time, the products only read the same row
+        for(int i = 0; i < 3; ++i)
+        {
+          bool changed = false;
+          for(int j = 0; j < 3; ++j)
+            changed |= (e[3*i+j] != R(3*i+j));
+          if(!changed)
+            continue;
+          for(int j = 0; j < 3; ++j)
+            statement(T(j) + " = " + e[3*i+j] + ";");
+          statement(R(3*i) + " = " + T(0) + "; " + R(3*i+1) + " = " + T(1) + "; " + R(3*i+2) + " = " + T(2) + ";");
+        }
+      }
+      pending_ = KDL::Frame::Identity();
+    }
+};
+
+/* the segment moves as T(origin) * joint motion * T(-origin) * pose(0) */
+bool checkChain(const KDL::Chain &chain)
+{
+  for(unsigned int i = 0; i < chain.getNrOfSegments(); ++i)
+  {
+    const KDL::Segment &seg = chain.getSegment(i);
+    const KDL::Joint &j = seg.getJoint();
+    if(j.getType() == KDL::Joint::None)
+      continue;
+
+    KDL::Vector axis = j.JointAxis();
+    KDL::Frame origin(j.JointOrigin());
+    for(double q = -2.0; q <= 2.0; q += 0.5)
+    {
+      KDL::Frame motion = isRotational(j) ? KDL::Frame(KDL::Rotation::Rot2(axis, q)) : KDL::Frame(axis * q);
+      if(!KDL::Equal(origin * motion * origin.Inverse() * seg.pose(0), seg.pose(q), 1e-9))
+      {
+        fprintf(stderr, "Joint %s has an offset or scale that isn't supported.\n", j.getName().c_str());
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void writeFunctionBody(const KDL::Chain &chain, bool lanes, std::ostream &out)
+{
+  FKWriter w(out, lanes);
+  int joint = 0;
+  w.writeFrame(0);
+  for(unsigned int i = 0; i < chain.getNrOfSegments(); ++i)
+  {
+    const KDL::Segment &seg = chain.getSegment(i);
+    const KDL::Joint &j = seg.getJoint();
+    out << "\n  // " << seg.getName() << " (" << j.getName() << ")\n";
+
+    if(j.getType() == KDL::Joint::None)
+    {
+      w.appendFixed(seg.pose(0));
+      w.writeFrame(i+1);
+      continue;
+    }
+
+    KDL::Frame origin(j.JointOrigin());
+    w.appendFixed(origin);
+    if(isRotational(j))
+      w.writeRotation(joint, j.JointAxis());
+    else
+      w.writeTranslation(joint, j.JointAxis());
+    w.appendFixed(origin.Inverse() * seg.pose(0));
+    w.writeFrame(i+1);
+    joint++;
+  }
+}
+
+bool writeChain(const KDL::Chain &chain, const std::string &root, const std::string &tip, const std::string &source, std::ostream &out)
+{
+  if(!checkChain(chain))
+    return false;
+
+  std::string name = root + "_to_" + tip;
+
+  out << "/* Generated by generate_fk from " << source << ", chain " << root << " -> " << tip << ".\n";
+  out << " * Regenerate it when the URDF changes, don't edit it. */\n\n";
+  out << "#include <cmath>\n";
+  out << "#include <sbpl_manipulation_components/generated_fk_robot_model.h>\n\n";
+  out << "namespace sbpl_arm_planner {\n\n";
+
+  out << "static void computeFK_" << name << "(const double *q, KDL::Frame *frames)\n{\n";
+  out << "  double r[9], p[3], t[3], m[9], c, s, v;\n";
+  out << "  (void)t; (void)m; (void)c; (void)s; (void)v;\n\n";
+  writeFunctionBody(chain, false, out);
+  out << "}\n\n";
+
+  out << "static void computeFKLanes_" << name << "(const double *q, double *frames)\n{\n";
+  out << "  double r[9][GENERATED_FK_LANES], p[3][GENERATED_FK_LANES], t[3][GENERATED_FK_LANES], m[9][GENERATED_FK_LANES];\n";
+  out << "  double c[GENERATED_FK_LANES], s[GENERATED_FK_LANES], v[GENERATED_FK_LANES];\n";
+  out << "  int l;\n";
+  out << "  (void)t; (void)m; (void)c; (void)s; (void)v;\n\n";
+  writeFunctionBody(chain, true, out);
+  out << "}\n\n";
+
+  out << "static GeneratedFKRegistrar registrar_" << name << "(\"" << root << "\", \"" << tip << "\", " << chain.getNrOfJoints() << ", " << chain.getNrOfSegments() << ", computeFK_" << name << ", computeFKLanes_" << name << ");\n\n";
+  out << "}\n";
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  if(argc < 5)
+  {
+    fprintf(stderr, "usage: %s <urdf file> <chain root link> <chain tip link> <output file>\n", argv[0]);
+    return 1;
+  }
+
+  urdf::Model urdf;
+  if(!urdf.initFile(argv[1]))
+  {
+    fprintf(stderr, "Failed to parse the URDF in %s.\n", argv[1]);
+    return 1;
+  }
+
+  KDL::Tree tree;
+  KDL::Chain chain;
+  if(!kdl_parser::treeFromUrdfModel(urdf, tree))
+  {
+    fprintf(stderr, "Failed to parse the kdl tree from the URDF.\n");
+    return 1;
+  }
+  if(!tree.getChain(argv[2], argv[3], chain))
+  {
+    fprintf(stderr, "Failed to fetch the KDL chain. (root: %s, tip: %s)\n", argv[2], argv[3]);
+    return 1;
+  }
+
+  std::ofstream out(argv[4]);
+  if(!out.is_open())
+  {
+    fprintf(stderr, "Failed to open %s for writing.\n", argv[4]);
+    return 1;
+  }
+  if(!writeChain(chain, argv[2], argv[3], urdf.getName(), out))
+    return 1;
+
+  printf("Wrote the FK of %d segments and %d joints to %s.\n", int(chain.getNrOfSegments()), int(chain.getNrOfJoints()), argv[4]);
+  return 0;
+}
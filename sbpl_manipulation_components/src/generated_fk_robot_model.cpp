@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2010, Maxim Likhachev
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Pennsylvania nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sbpl_manipulation_components/generated_fk_robot_model.h>
+#include <ros/ros.h>
+#include <map>
+#include <algorithm>
+
+namespace sbpl_arm_planner {
+
+/* constructed on first use, generated files register during static init */
+static std::map<std::string, GeneratedFK>& getRegistry()
+{
+  static std::map<std::string, GeneratedFK> registry;
+  return registry;
+}
+
+void registerGeneratedFK(const GeneratedFK &fk)
+{
+  getRegistry()[fk.root + " " + fk.tip] = fk;
+}
+
+const GeneratedFK* findGeneratedFK(const std::string &root, const std::string &tip)
+{
+  std::map<std::string, GeneratedFK>::const_iterator it = getRegistry().find(root + " " + tip);
+  if(it == getRegistry().end())
+    return NULL;
+  return &(it->second);
+}
+
+GeneratedFKRegistrar::GeneratedFKRegistrar(const char *root, const char *tip, int num_joints, int num_segments, GeneratedFKFunction fk, GeneratedFKLanesFunction fk_lanes)
+{
+  GeneratedFK g;
+  g.root = root;
+  g.tip = tip;
+  g.num_joints = num_joints;
+  g.num_segments = num_segments;
+  g.fk = fk;
+  g.fk_lanes = fk_lanes;
+  registerGeneratedFK(g);
+}
+
+GeneratedFKRobotModel::GeneratedFKRobotModel() : KDLRobotModel(), gen_fk_(NULL)
+{
+}
+
+GeneratedFKRobotModel::GeneratedFKRobotModel(std::string chain_root_link, std::string chain_tip_link) : KDLRobotModel(chain_root_link, chain_tip_link), gen_fk_(NULL)
+{
+}
+
+GeneratedFKRobotModel::~GeneratedFKRobotModel()
+{
+}
+
+bool GeneratedFKRobotModel::init(std::string robot_description, std::vector<std::string> &planning_joints)
+{
+  if(!KDLRobotModel::init(robot_description, planning_joints))
+    return false;
+
+  gen_fk_ = findGeneratedFK(chain_root_name_, chain_tip_name_);
+  if(gen_fk_ == NULL)
+  {
+    ROS_ERROR("No forward kinematics were generated for the chain. (root: %s, tip: %s)", chain_root_name_.c_str(), chain_tip_name_.c_str());
+    initialized_ = false;
+    return false;
+  }
+
+  if(gen_fk_->num_joints != int(kchain_.getNrOfJoints()) || gen_fk_->num_segments != int(kchain_.getNrOfSegments()))
+  {
+    ROS_ERROR("The generated forward kinematics don't match the URDF. Regenerate them. (generated: %d joints %d segments, URDF: %d joints %d segments)", gen_fk_->num_joints, gen_fk_->num_segments, int(kchain_.getNrOfJoints()), int(kchain_.getNrOfSegments()));
+    gen_fk_ = NULL;
+    initialized_ = false;
+    return false;
+  }
+
+  return true;
+}
+
+RobotModelContext* GeneratedFKRobotModel::createContext() const
+{
+  GeneratedFKRobotModelContext *ctx = new GeneratedFKRobotModelContext();
+  initContext(*ctx);
+  if(gen_fk_ != NULL)
+  {
+    ctx->q.resize(gen_fk_->num_joints, 0);
+    ctx->frames.resize(gen_fk_->num_segments + 1);
+    ctx->q_lanes.resize(gen_fk_->num_joints * GENERATED_FK_LANES, 0);
+    ctx->frames_lanes.resize(12 * (gen_fk_->num_segments + 1) * GENERATED_FK_LANES, 0);
+  }
+  return ctx;
+}
+
+void GeneratedFKRobotModel::computeFrames(const std::vector<double> &angles, GeneratedFKRobotModelContext &ctx) const
+{
+  // normalized like the KDLRobotModel so the results are identical
+  for(size_t i = 0; i < angles.size() && i < ctx.q.size(); ++i)
+    ctx.q[i] = angles::normalize_angle(angles[i]);
+
+  gen_fk_->fk(&ctx.q[0], &ctx.frames[0]);
+}
+
+bool GeneratedFKRobotModel::computeFK(const std::vector<double> &angles, const std::string &name, KDL::Frame &f, RobotModelContext &ctx) const
+{
+  GeneratedFKRobotModelContext &gctx = static_cast<GeneratedFKRobotModelContext&>(ctx);
+  std::map<std::string, int>::const_iterator it = link_map_.find(name);
+  if(it == link_map_.end())
+  {
+    ROS_ERROR("'%s' is not a link in the kinematic chain.", name.c_str());
+    return false;
+  }
+
+  computeFrames(angles, gctx);
+  f = T_kinematics_to_planning_ * gctx.frames[it->second];
+  return true;
+}
+
+bool GeneratedFKRobotModel::computeFK(const std::vector<double> &angles, std::vector<KDL::Frame> &frames, RobotModelContext &ctx) const
+{
+  GeneratedFKRobotModelContext &gctx = static_cast<GeneratedFKRobotModelContext&>(ctx);
+  computeFrames(angles, gctx);
+  frames.resize(gctx.frames.size());
+  for(size_t i = 0; i < gctx.frames.size(); ++i)
+    frames[i] = T_kinematics_to_planning_ * gctx.frames[i];
+  return true;
+}
+
+bool GeneratedFKRobotModel::computeFK(const std::vector<double> &angles, std::vector<KDL::Frame> &frames)
+{
+  return computeFK(angles, frames, getContext());
+}
+
+bool GeneratedFKRobotModel::computePlanningLinkFKs(const double *angles, size_t n, double *poses, RobotModelContext &ctx, std::vector<std::vector<KDL::Frame> > *frames) const
+{
+  GeneratedFKRobotModelContext &gctx = static_cast<GeneratedFKRobotModelContext&>(ctx);
+  std::map<std::string, int>::const_iterator it = link_map_.find(planning_link_);
+  if(it == link_map_.end())
+  {
+    ROS_ERROR("The planning link '%s' is not in the kinematic chain.", planning_link_.c_str());
+    return false;
+  }
+
+  int num_joints = gen_fk_->num_joints;
+  int num_frames = gen_fk_->num_segments + 1;
+  size_t num_angles = std::min(planning_joints_.size(), size_t(num_joints));
+  if(frames != NULL)
+    frames->resize(n);
+
+  KDL::Frame f;
+  for(size_t i = 0; i < n; i += GENERATED_FK_LANES)
+  {
+    // gather into lanes, the last group repeats its last configuration
+    for(int l = 0; l < GENERATED_FK_LANES; ++l)
+    {
+      size_t c = std::min(i + l, n - 1);
+      for(size_t j = 0; j < num_angles; ++j)
+        gctx.q_lanes[j*GENERATED_FK_LANES + l] = angles::normalize_angle(angles[j*n + c]);
+    }
+
+    gen_fk_->fk_lanes(&gctx.q_lanes[0], &gctx.frames_lanes[0]);
+
+    for(int l = 0; l < GENERATED_FK_LANES && i + l < n; ++l)
+    {
+      size_t c = i + l;
+      for(int k = 0; k < num_frames; ++k)
+      {
+        if(frames == NULL && k != it->second)
+          continue;
+
+        const double *e = &gctx.frames_lanes[12 * k * GENERATED_FK_LANES + l];
+        f = T_kinematics_to_planning_ * KDL::Frame(KDL::Rotation(e[0], e[GENERATED_FK_LANES], e[2*GENERATED_FK_LANES], e[3*GENERATED_FK_LANES], e[4*GENERATED_FK_LANES], e[5*GENERATED_FK_LANES], e[6*GENERATED_FK_LANES], e[7*GENERATED_FK_LANES], e[8*GENERATED_FK_LANES]), KDL::Vector(e[9*GENERATED_FK_LANES], e[10*GENERATED_FK_LANES], e[11*GENERATED_FK_LANES]));
+
+        if(frames != NULL)
+        {
+          (*frames)[c].resize(num_frames);
+          (*frames)[c][k] = f;
+        }
+
+        if(k == it->second)
+        {
+          poses[c] = f.p[0];
+          poses[n + c] = f.p[1];
+          poses[2*n + c] = f.p[2];
+          f.M.GetRPY(poses[3*n + c], poses[4*n + c], poses[5*n + c]);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+}
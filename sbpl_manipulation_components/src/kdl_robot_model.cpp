@@ -34,21 +34,29 @@
 #include <leatherman/utils.h>
 #include <sbpl_geometry_utils/utils.h>
 #include <kdl/tree.hpp>
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 
 using namespace std;
 
 namespace sbpl_arm_planner {
 
-KDLRobotModel::KDLRobotModel() : ik_solver_(NULL), ik_vel_solver_(NULL), fk_solver_(NULL)
+KDLRobotModel::KDLRobotModel() : num_ik_threads_(0), ik_search_best_(false)
 {
+  std::string ik_search_mode;
   ros::NodeHandle ph("~");
   ph.param<std::string>("robot_model/chain_root_link", chain_root_name_, " ");
   ph.param<std::string>("robot_model/chain_tip_link", chain_tip_name_, " ");
   ph.param("robot_model/free_angle", free_angle_, 2);
   ph.param("robot_model/use_safety_joint_limits", use_safety_limits_, true);
+  ph.param("robot_model/num_ik_threads", num_ik_threads_, 0);
+  ph.param<std::string>("robot_model/ik_search_mode", ik_search_mode, "first");
+  ik_search_best_ = (ik_search_mode.compare("best") == 0);
 }
 
-KDLRobotModel::KDLRobotModel(std::string chain_root_link, std::string chain_tip_link) : ik_solver_(NULL), ik_vel_solver_(NULL), fk_solver_(NULL)
+KDLRobotModel::KDLRobotModel(std::string chain_root_link, std::string chain_tip_link) : num_ik_threads_(0), ik_search_best_(false)
 {
   free_angle_ = 2;
   chain_root_name_ = chain_root_link;
@@ -57,12 +65,6 @@ KDLRobotModel::KDLRobotModel(std::string chain_root_link, std::string chain_tip_
 
 KDLRobotModel::~KDLRobotModel()
 {
-  if(ik_solver_)
-    delete ik_solver_;
-  if(ik_vel_solver_)
-    delete ik_vel_solver_;
-  if(fk_solver_)
-    delete fk_solver_;
 }
 
 bool KDLRobotModel::init(std::string robot_description, std::vector<std::string> &planning_joints)
@@ -128,21 +130,8 @@ bool KDLRobotModel::init(std::string robot_description, std::vector<std::string>
     return false;
   }
 
-  // FK solver
-  fk_solver_ = new KDL::ChainFkSolverPos_recursive(kchain_);
-  jnt_pos_in_.resize(kchain_.getNrOfJoints());
-  jnt_pos_out_.resize(kchain_.getNrOfJoints());
-
-  // IK solver
-  KDL::JntArray q_min(planning_joints_.size());
-  KDL::JntArray q_max(planning_joints_.size());
-  for(size_t i = 0; i < planning_joints_.size(); ++i)
-  {
-    q_min(i) = min_limits_[i];
-    q_max(i) = max_limits_[i];
-  }
-  ik_vel_solver_ = new KDL::ChainIkSolverVel_pinv(kchain_);
-  ik_solver_ = new KDL::ChainIkSolverPos_NR_JL(kchain_, q_min, q_max, *fk_solver_, *ik_vel_solver_, 200, 0.001);
+  // the solvers are made per context, drop the one made for the old chain
+  ctx_.reset();
 
   // joint name -> index mapping
   for(size_t i = 0; i < planning_joints_.size(); ++i)
@@ -156,6 +145,33 @@ bool KDLRobotModel::init(std::string robot_description, std::vector<std::string>
   return true;
 }
 
+RobotModelContext* KDLRobotModel::createContext() const
+{
+  KDLRobotModelContext *ctx = new KDLRobotModelContext();
+  initContext(*ctx);
+  return ctx;
+}
+
+void KDLRobotModel::initContext(KDLRobotModelContext &ctx) const
+{
+  // FK solver
+  ctx.fk_solver.reset(new KDL::ChainFkSolverPos_recursive(kchain_));
+  ctx.jnt_pos_in.resize(kchain_.getNrOfJoints());
+  ctx.jnt_pos_out.resize(kchain_.getNrOfJoints());
+
+  // IK solver
+  KDL::JntArray q_min(planning_joints_.size());
+  KDL::JntArray q_max(planning_joints_.size());
+  for(size_t i = 0; i < planning_joints_.size(); ++i)
+  {
+    q_min(i) = min_limits_[i];
+    q_max(i) = max_limits_[i];
+  }
+  ctx.ik_vel_solver.reset(new KDL::ChainIkSolverVel_pinv(kchain_));
+  ctx.ik_solver.reset(new KDL::ChainIkSolverPos_NR_JL(kchain_, q_min, q_max, *ctx.fk_solver, *ctx.ik_vel_solver, 200, 0.001));
+  ctx.ik_workers.reset();
+}
+
 bool KDLRobotModel::getJointLimits(std::vector<std::string> &joint_names, std::vector<double> &min_limits, std::vector<double> &max_limits, std::vector<bool> &continuous, bool safety_limits)
 {
   min_limits.resize(joint_names.size());
@@ -219,7 +235,7 @@ bool KDLRobotModel::getJointLimits(std::string joint_name, double &min_limit, do
   return found_joint;
 }
 
-bool KDLRobotModel::checkJointLimits(const std::vector<double> &angles)
+bool KDLRobotModel::checkJointLimits(const std::vector<double> &angles) const
 {
   std::vector<double> a = angles;
   if(!sbpl::utils::NormalizeAnglesIntoRange(a, min_limits_, max_limits_))
@@ -231,161 +247,193 @@ bool KDLRobotModel::checkJointLimits(const std::vector<double> &angles)
   return true;
 }
 
-bool KDLRobotModel::computeFK(const std::vector<double> &angles, std::string name, KDL::Frame &f)
+bool KDLRobotModel::getPlanningJointLimits(const std::string &name, double &min_limit, double &max_limit, bool &continuous) const
+{
+  std::map<std::string, int>::const_iterator it = joint_map_.find(name);
+  if(it == joint_map_.end())
+  {
+    ROS_ERROR("'%s' is not a planning joint.", name.c_str());
+    return false;
+  }
+
+  min_limit = min_limits_[it->second];
+  max_limit = max_limits_[it->second];
+  continuous = continuous_[it->second];
+  return true;
+}
+
+int KDLRobotModel::getRedundantJointIndex() const
+{
+  return free_angle_;
+}
+
+bool KDLRobotModel::computeFK(const std::vector<double> &angles, const std::string &name, KDL::Frame &f, RobotModelContext &ctx) const
 {
+  KDLRobotModelContext &kctx = static_cast<KDLRobotModelContext&>(ctx);
+  std::map<std::string, int>::const_iterator it = link_map_.find(name);
+  if(it == link_map_.end())
+  {
+    ROS_ERROR("'%s' is not a link in the kinematic chain.", name.c_str());
+    return false;
+  }
+
   //TODO: This should NOT loop to angles.size() but rather until the number
   //of joints that are expected or else EIGEN blows up
   for(size_t i = 0; i < angles.size(); ++i)
-    jnt_pos_in_(i) = angles::normalize_angle(angles[i]);
+    kctx.jnt_pos_in(i) = angles::normalize_angle(angles[i]);
 
   KDL::Frame f1;
-  if(fk_solver_->JntToCart(jnt_pos_in_, f1, link_map_[name]) < 0)
+  if(kctx.fk_solver->JntToCart(kctx.jnt_pos_in, f1, it->second) < 0)
   {
     ROS_ERROR("JntToCart returned < 0.");
     return false;
   }
   f = T_kinematics_to_planning_ * f1;
-
-  /*
-  KDL::Frame f1;
-  for(std::map<std::string, int>::const_iterator iter = link_map_.begin(); iter != link_map_.end(); ++iter)
-  {
-    if(fk_solver_->JntToCart(jnt_pos_in_, f1, iter->second) < 0)
-    {
-      ROS_ERROR("JntToCart returned < 0.");
-      return false;
-    }
-
-    f = T_kinematics_to_planning_ * f1;
-    leatherman::printKDLFrame(f,iter->first);
-  }
-  */
-
   return true;
 }
 
-bool KDLRobotModel::computeFK(const std::vector<double> &angles, std::string name, std::vector<double> &pose)
+bool KDLRobotModel::computePlanningLinkFKs(const double *angles, size_t n, double *poses, RobotModelContext &ctx, std::vector<std::vector<KDL::Frame> > *frames) const
 {
-  KDL::Frame f;
-  pose.resize(6,0);
-  if(computeFK(angles, name, f))
+  KDLRobotModelContext &kctx = static_cast<KDLRobotModelContext&>(ctx);
+  std::map<std::string, int>::const_iterator it = link_map_.find(planning_link_);
+  if(it == link_map_.end())
   {
-    pose[0] = f.p[0];
-    pose[1] = f.p[1];
-    pose[2] = f.p[2];
-    f.M.GetRPY(pose[3], pose[4], pose[5]);
-    return true;
+    ROS_ERROR("The planning link '%s' is not in the kinematic chain.", planning_link_.c_str());
+    return false;
   }
-  return false;
-}
 
-bool KDLRobotModel::computePlanningLinkFK(const std::vector<double> &angles, std::vector<double> &pose)
-{
-  KDL::Frame f, f1;
-  pose.resize(6,0);
-  for(size_t i = 0; i < angles.size(); ++i)
-    jnt_pos_in_(i) = angles::normalize_angle(angles[i]);
+  // walk the chain once per configuration, the frames are numbered like the
+  // segmentNr of the FK solver
+  int num_frames = kchain_.getNrOfSegments() + 1;
+  int last = (frames == NULL) ? it->second : num_frames - 1;
+  size_t num_angles = std::min(planning_joints_.size(), size_t(kchain_.getNrOfJoints()));
+  if(frames != NULL)
+    frames->resize(n);
 
-  if(fk_solver_->JntToCart(jnt_pos_in_, f1, link_map_[planning_link_]) < 0)
+  KDL::Frame f, fp;
+  for(size_t i = 0; i < n; ++i)
   {
-    ROS_ERROR("JntToCart returned < 0.");
-    return false;
-  }
+    for(size_t j = 0; j < num_angles; ++j)
+      kctx.jnt_pos_in(j) = angles::normalize_angle(angles[j*n + i]);
 
-  f = T_kinematics_to_planning_ * f1;
+    if(frames != NULL)
+      (*frames)[i].resize(num_frames);
 
-  pose[0] = f.p[0];
-  pose[1] = f.p[1];
-  pose[2] = f.p[2];
-  f.M.GetRPY(pose[3], pose[4], pose[5]);
+    f = KDL::Frame::Identity();
+    int joint = 0;
+    for(int k = 0; k <= last; ++k)
+    {
+      if(k > 0)
+      {
+        const KDL::Segment &seg = kchain_.getSegment(k-1);
+        if(seg.getJoint().getType() != KDL::Joint::None)
+          f = f * seg.pose(kctx.jnt_pos_in(joint++));
+        else
+          f = f * seg.pose(0);
+      }
+
+      fp = T_kinematics_to_planning_ * f;
+      if(frames != NULL)
+        (*frames)[i][k] = fp;
+
+      if(k == it->second)
+      {
+        poses[i] = fp.p[0];
+        poses[n + i] = fp.p[1];
+        poses[2*n + i] = fp.p[2];
+        fp.M.GetRPY(poses[3*n + i], poses[4*n + i], poses[5*n + i]);
+      }
+    }
+  }
   return true;
 }
 
-bool KDLRobotModel::computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option)
+bool KDLRobotModel::computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option, RobotModelContext &ctx) const
 {
   if(option == sbpl_arm_planner::ik_option::RESTRICT_XYZ_JOINTS)
     return false;
 
-  return computeIKSearch(pose, start, solution, 0.005);
+  KDLRobotModelContext &kctx = static_cast<KDLRobotModelContext&>(ctx);
+  if(num_ik_threads_ > 0)
+    return computeParallelIKSearch(pose, start, solution, 0.005, kctx);
+
+  return computeIKSearch(pose, start, solution, 0.005, kctx);
 }
 
-bool KDLRobotModel::computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution)
+void KDLRobotModel::getDesiredFrame(const std::vector<double> &pose, KDL::Frame &frame) const
 {
   //pose: {x,y,z,r,p,y} or {x,y,z,qx,qy,qz,qw}
-
-  KDL::Frame frame_des;
-  frame_des.p.x(pose[0]);
-  frame_des.p.y(pose[1]);
-  frame_des.p.z(pose[2]);
+  frame.p.x(pose[0]);
+  frame.p.y(pose[1]);
+  frame.p.z(pose[2]);
 
   // RPY
   if(pose.size() == 6)
-    frame_des.M = KDL::Rotation::RPY(pose[3],pose[4],pose[5]);
+    frame.M = KDL::Rotation::RPY(pose[3],pose[4],pose[5]);
   // quaternion
   else
-    frame_des.M = KDL::Rotation::Quaternion(pose[3],pose[4],pose[5],pose[6]);
+    frame.M = KDL::Rotation::Quaternion(pose[3],pose[4],pose[5],pose[6]);
 
   // transform into kinematics frame
-  frame_des = T_planning_to_kinematics_ * frame_des;
+  frame = T_planning_to_kinematics_ * frame;
+}
+
+bool KDLRobotModel::computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, RobotModelContext &ctx) const
+{
+  KDLRobotModelContext &kctx = static_cast<KDLRobotModelContext&>(ctx);
+  KDL::Frame frame_des;
+  getDesiredFrame(pose, frame_des);
 
   // seed configuration
   for(size_t i = 0; i < start.size(); i++)
-    jnt_pos_in_(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
+    kctx.jnt_pos_in(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
 
-  if(ik_solver_->CartToJnt(jnt_pos_in_, frame_des, jnt_pos_out_) < 0)
+  if(kctx.ik_solver->CartToJnt(kctx.jnt_pos_in, frame_des, kctx.jnt_pos_out) < 0)
     return false;
 
   solution.resize(start.size());
   for(size_t i = 0; i < solution.size(); ++i)
-    solution[i] = angles::normalize_angle(jnt_pos_out_(i));
+    solution[i] = angles::normalize_angle(kctx.jnt_pos_out(i));
 
   return true;
 }
 
 bool KDLRobotModel::computeIKSearch(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, double timeout)
 {
-  //pose: {x,y,z,r,p,y} or {x,y,z,qx,qy,qz,qw}
-  KDL::Frame frame_des;
-  frame_des.p.x(pose[0]);
-  frame_des.p.y(pose[1]);
-  frame_des.p.z(pose[2]);
-
-  // RPY
-  if(pose.size() == 6)
-    frame_des.M = KDL::Rotation::RPY(pose[3],pose[4],pose[5]);
-  // quaternion
-  else
-    frame_des.M = KDL::Rotation::Quaternion(pose[3],pose[4],pose[5],pose[6]);
+  return computeIKSearch(pose, start, solution, timeout, static_cast<KDLRobotModelContext&>(getContext()));
+}
 
-  // transform into kinematics frame
-  frame_des = T_planning_to_kinematics_ * frame_des;
+bool KDLRobotModel::computeIKSearch(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, double timeout, KDLRobotModelContext &ctx) const
+{
+  KDL::Frame frame_des;
+  getDesiredFrame(pose, frame_des);
 
   // seed configuration
   for(size_t i = 0; i < start.size(); i++)
-    jnt_pos_in_(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
+    ctx.jnt_pos_in(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
 
-  double initial_guess = jnt_pos_in_(free_angle_);
+  double initial_guess = ctx.jnt_pos_in(free_angle_);
   double search_discretization_angle = 0.02;
 
   ros::Time start_time = ros::Time::now();
   double loop_time = 0;
   int count = 0;
 
-  int num_positive_increments = (int)((min_limits_[free_angle_]-initial_guess)/search_discretization_angle);
+  int num_positive_increments = (int)((max_limits_[free_angle_]-initial_guess)/search_discretization_angle);
   int num_negative_increments = (int)((initial_guess-min_limits_[free_angle_])/search_discretization_angle);
   while(loop_time < timeout)
   {
-    if(ik_solver_->CartToJnt(jnt_pos_in_, frame_des, jnt_pos_out_) >= 0)
+    if(ctx.ik_solver->CartToJnt(ctx.jnt_pos_in, frame_des, ctx.jnt_pos_out) >= 0)
     {
       solution.resize(start.size());
       for(size_t i = 0; i < solution.size(); ++i)
-        solution[i] = angles::normalize_angle(jnt_pos_out_(i));
+        solution[i] = angles::normalize_angle(ctx.jnt_pos_out(i));
       return true;
     }
     if(!getCount(count,num_positive_increments,-num_negative_increments))
       return false;
-    jnt_pos_in_(free_angle_) = initial_guess + search_discretization_angle * count;
-    ROS_DEBUG("%d, %f",count,jnt_pos_in_(free_angle_));
+    ctx.jnt_pos_in(free_angle_) = initial_guess + search_discretization_angle * count;
+    ROS_DEBUG("%d, %f",count,ctx.jnt_pos_in(free_angle_));
     loop_time = (ros::Time::now()-start_time).toSec();
   }
   if(loop_time >= timeout)
@@ -401,6 +449,218 @@ bool KDLRobotModel::computeIKSearch(const std::vector<double> &pose, const std::
   return false;
 }
 
+/* Threads that each run a job with their own context. They sleep between
+ * jobs, so a search only has to wake them up. */
+class IKWorkerPool
+{
+  public:
+
+    IKWorkerPool(const std::vector<boost::shared_ptr<KDLRobotModelContext> > &contexts) : contexts_(contexts), generation_(0), num_busy_(0), stop_(false)
+    {
+      for(size_t t = 0; t < contexts_.size(); ++t)
+        threads_.create_thread(boost::bind(&IKWorkerPool::run, this, contexts_[t].get()));
+    }
+
+    ~IKWorkerPool()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        stop_ = true;
+      }
+      work_cond_.notify_all();
+      threads_.join_all();
+    }
+
+    int size() const { return int(contexts_.size()); };
+
+    /* every thread runs the job once */
+    void start(const boost::function<void (KDLRobotModelContext*)> &job)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        job_ = job;
+        num_busy_ = contexts_.size();
+        ++generation_;
+      }
+      work_cond_.notify_all();
+    }
+
+    /* until every thread is done with the job */
+    void wait()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while(num_busy_ > 0)
+        done_cond_.wait(lock);
+    }
+
+  private:
+
+    std::vector<boost::shared_ptr<KDLRobotModelContext> > contexts_;
+    boost::thread_group threads_;
+    boost::mutex mutex_;
+    boost::condition_variable work_cond_;
+    boost::condition_variable done_cond_;
+    boost::function<void (KDLRobotModelContext*)> job_;
+    unsigned int generation_;
+    int num_busy_;
+    bool stop_;
+
+    void run(KDLRobotModelContext *ctx)
+    {
+      unsigned int generation = 0;
+      while(true)
+      {
+        boost::function<void (KDLRobotModelContext*)> job;
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          while(!stop_ && generation_ == generation)
+            work_cond_.wait(lock);
+          if(stop_)
+            return;
+          generation = generation_;
+          job = job_;
+        }
+
+        job(ctx);
+
+        boost::mutex::scoped_lock lock(mutex_);
+        if(--num_busy_ == 0)
+          done_cond_.notify_all();
+      }
+    }
+};
+
+struct KDLRobotModel::IKSearch
+{
+  KDL::Frame frame_des;
+  KDL::JntArray seed;
+
+  /* free angle of each seed, nearest to the initial guess first */
+  std::vector<double> free_angles;
+  ros::WallTime deadline;
+
+  boost::mutex mutex;
+  size_t next;
+  bool done;
+  int solution_index;
+  double solution_cost;
+  KDL::JntArray solution;
+};
+
+void KDLRobotModel::setNumIKThreads(int num_threads)
+{
+  num_ik_threads_ = std::max(num_threads, 0);
+}
+
+bool KDLRobotModel::computeParallelIKSearch(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, double timeout, KDLRobotModelContext &ctx) const
+{
+  IKSearch search;
+  getDesiredFrame(pose, search.frame_des);
+
+  search.seed.resize(kchain_.getNrOfJoints());
+  for(size_t i = 0; i < start.size(); i++)
+    search.seed(i) = angles::normalize_angle(start[i]);
+
+  // the same seeds, in the same order, as computeIKSearch
+  double initial_guess = search.seed(free_angle_);
+  double search_discretization_angle = 0.02;
+  int count = 0;
+  int num_positive_increments = (int)((max_limits_[free_angle_]-initial_guess)/search_discretization_angle);
+  int num_negative_increments = (int)((initial_guess-min_limits_[free_angle_])/search_discretization_angle);
+  search.free_angles.push_back(initial_guess);
+  while(getCount(count,num_positive_increments,-num_negative_increments))
+    search.free_angles.push_back(initial_guess + search_discretization_angle * count);
+
+  search.deadline = ros::WallTime::now() + ros::WallDuration(timeout);
+  search.next = 0;
+  search.done = false;
+  search.solution_index = -1;
+  search.solution_cost = 0;
+
+  // the calling thread is one of the searchers and uses ctx, the helpers
+  // have their own contexts in the pool
+  if(!ctx.ik_workers || ctx.ik_workers->size() != num_ik_threads_ - 1)
+  {
+    std::vector<boost::shared_ptr<KDLRobotModelContext> > contexts(num_ik_threads_ - 1);
+    for(size_t t = 0; t < contexts.size(); ++t)
+    {
+      contexts[t].reset(new KDLRobotModelContext());
+      initContext(*contexts[t]);
+    }
+    ctx.ik_workers.reset(new IKWorkerPool(contexts));
+  }
+
+  ctx.ik_workers->start(boost::bind(&KDLRobotModel::searchFreeAngle, this, &search, _1));
+  searchFreeAngle(&search, &ctx);
+  ctx.ik_workers->wait();
+
+  if(search.solution_index < 0)
+  {
+    ROS_DEBUG("No IK solution was found in %d of %d seeds.", int(std::min(search.next, search.free_angles.size())), int(search.free_angles.size()));
+    return false;
+  }
+
+  solution.resize(start.size());
+  for(size_t i = 0; i < solution.size(); ++i)
+    solution[i] = angles::normalize_angle(search.solution(i));
+  return true;
+}
+
+void KDLRobotModel::searchFreeAngle(IKSearch *search, KDLRobotModelContext *ctx) const
+{
+  KDL::JntArray q_in(search->seed.rows()), q_out(search->seed.rows());
+  while(true)
+  {
+    size_t i;
+    {
+      boost::mutex::scoped_lock lock(search->mutex);
+      if(search->done || search->next >= search->free_angles.size())
+        return;
+      i = search->next++;
+    }
+
+    if(ros::WallTime::now() > search->deadline)
+    {
+      boost::mutex::scoped_lock lock(search->mutex);
+      search->done = true;
+      return;
+    }
+
+    q_in = search->seed;
+    q_in(free_angle_) = search->free_angles[i];
+    if(ctx->ik_solver->CartToJnt(q_in, search->frame_des, q_out) < 0)
+      continue;
+
+    double cost = 0;
+    for(unsigned int j = 0; j < q_out.rows(); ++j)
+    {
+      double d = angles::shortest_angular_distance(search->seed(j), q_out(j));
+      cost += d*d;
+    }
+
+    boost::mutex::scoped_lock lock(search->mutex);
+    if(ik_search_best_)
+    {
+      if(search->solution_index < 0 || cost < search->solution_cost)
+      {
+        search->solution_index = i;
+        search->solution_cost = cost;
+        search->solution = q_out;
+      }
+    }
+    else
+    {
+      // seeds before this one may still be running, the earliest one wins
+      if(search->solution_index < 0 || int(i) < search->solution_index)
+      {
+        search->solution_index = i;
+        search->solution = q_out;
+      }
+      search->done = true;
+    }
+  }
+}
+
 void KDLRobotModel::printRobotModelInformation()
 {
   leatherman::printKDLChain(kchain_, "robot_model");
@@ -415,7 +675,7 @@ void KDLRobotModel::printRobotModelInformation()
 }
 
 
-bool KDLRobotModel::getCount(int &count, const int &max_count, const int &min_count)
+bool KDLRobotModel::getCount(int &count, const int &max_count, const int &min_count) const
 {
   if(count > 0)
   {
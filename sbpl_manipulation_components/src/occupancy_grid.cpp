@@ -32,40 +32,507 @@
 #include <sbpl_manipulation_components/occupancy_grid.h>
 #include <ros/console.h>
 #include <leatherman/viz.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
 
 using namespace std;
 
 namespace sbpl_arm_planner
 {
 
-OccupancyGrid::OccupancyGrid(double dim_x, double dim_y, double dim_z, double resolution, double origin_x, double origin_y, double origin_z)
+enum
 {
-  grid_ = new distance_field::PropagationDistanceField(dim_x, dim_y, dim_z, resolution, origin_x, origin_y,  origin_z, 0.40);
-  grid_->reset();
+  RASTER_BOX,
+  RASTER_CYLINDER,
+  RASTER_SPHERE
+};
+
+/* don't bother with threads for fewer cells than this */
+static const double RASTER_MIN_CELLS_PER_THREAD = 100000;
+
+struct RasterShape
+{
+  int type;
+  double half[3];
+  double resolution;
+  double origin[3];
+  Eigen::Vector3d center;
+
+  /* boxes: the axes that can separate the box from a cell (the world axes,
+   * the box axes and their cross products), and how far apart along each
+   * the two centers can be while still overlapping */
+  int num_axes;
+  Eigen::Vector3d axes[15];
+  double reach[15];
+
+  /* cylinders: shape frame coordinates of cell {0,0,0}, of a step along
+   * each axis and of the corners of a cell relative to its center */
+  Eigen::Vector3d base;
+  Eigen::Vector3d step[3];
+  Eigen::Vector3d corners[8];
+
+  int min[3];
+  int max[3];
+};
+
+/* intersect [lo,hi] with the k for which |q + k*d| <= h */
+static void clipToSlab(double q, double d, double h, double &lo, double &hi)
+{
+  if(fabs(d) < 1e-12)
+  {
+    if(fabs(q) > h)
+      hi = lo - 1;
+    return;
+  }
+  double k1 = (-h - q) / d, k2 = (h - q) / d;
+  lo = std::max(lo, std::min(k1, k2));
+  hi = std::min(hi, std::max(k1, k2));
+}
+
+/* intersect [lo,hi] with the k for which |q + k*d|^2 <= r^2, only over the
+ * first n coordinates */
+static void clipToBall(const Eigen::Vector3d &q, const Eigen::Vector3d &d, int n, double r, double &lo, double &hi)
+{
+  double a = 0, b = 0, c = -r*r;
+  for(int i = 0; i < n; ++i)
+  {
+    a += d(i)*d(i);
+    b += 2*q(i)*d(i);
+    c += q(i)*q(i);
+  }
+  if(a < 1e-12)
+  {
+    if(c > 0)
+      hi = lo - 1;
+    return;
+  }
+  double disc = b*b - 4*a*c;
+  if(disc < 0)
+  {
+    hi = lo - 1;
+    return;
+  }
+  disc = sqrt(disc);
+  lo = std::max(lo, (-b - disc) / (2*a));
+  hi = std::min(hi, (-b + disc) / (2*a));
+}
+
+static double cross2(const Eigen::Vector2d &o, const Eigen::Vector2d &a, const Eigen::Vector2d &b)
+{
+  return (a(0) - o(0))*(b(1) - o(1)) - (a(1) - o(1))*(b(0) - o(0));
+}
+
+static bool lessXY(const Eigen::Vector2d &a, const Eigen::Vector2d &b)
+{
+  return a(0) < b(0) || (a(0) == b(0) && a(1) < b(1));
+}
+
+/* squared distance from the origin to the segment ab */
+static double segmentDistanceSq(const Eigen::Vector2d &a, const Eigen::Vector2d &b)
+{
+  Eigen::Vector2d ab = b - a;
+  double len_sq = ab.squaredNorm();
+  double t = len_sq < 1e-24 ? 0 : std::min(std::max(-a.dot(ab) / len_sq, 0.0), 1.0);
+  return (a + t*ab).squaredNorm();
+}
+
+/* does cell {x,y,z} overlap the cylinder? The part of the cell between the
+ * caps is a convex polytope whose corners are the cell's corners between the
+ * caps and the points where its edges cross them. The cell overlaps if the
+ * outline of those corners seen along the axis touches the disc */
+static bool cellOverlapsCylinder(const RasterShape *shape, int x, int y, int z)
+{
+  Eigen::Vector3d q = shape->base + shape->step[0]*x + shape->step[1]*y + shape->step[2]*z;
+  double r = shape->half[0], h = shape->half[2];
+  Eigen::Vector3d c[8];
+  Eigen::Vector2d pts[32];
+  int n = 0;
+
+  for(int i = 0; i < 8; ++i)
+  {
+    c[i] = q + shape->corners[i];
+    if(fabs(c[i](2)) <= h)
+      pts[n++] = Eigen::Vector2d(c[i](0), c[i](1));
+  }
+  for(int i = 0; i < 8; ++i)
+  {
+    for(int bit = 1; bit < 8; bit <<= 1)
+    {
+      if(i & bit)
+        continue;
+      const Eigen::Vector3d &a = c[i], &b = c[i | bit];
+      for(int s = -1; s <= 1; s += 2)
+      {
+        if((a(2) - s*h) * (b(2) - s*h) < 0)
+        {
+          double t = (s*h - a(2)) / (b(2) - a(2));
+          pts[n++] = Eigen::Vector2d(a(0) + t*(b(0) - a(0)), a(1) + t*(b(1) - a(1)));
+        }
+      }
+    }
+  }
+
+  double r_sq = r*r + 1e-12;
+  for(int i = 0; i < n; ++i)
+  {
+    if(pts[i].squaredNorm() <= r_sq)
+      return true;
+  }
+  if(n < 2)
+    return false;
+
+  // convex hull (monotone chain), counter-clockwise
+  std::sort(pts, pts + n, lessXY);
+  Eigen::Vector2d hull[64];
+  int k = 0;
+  for(int i = 0; i < n; ++i)
+  {
+    while(k >= 2 && cross2(hull[k-2], hull[k-1], pts[i]) <= 0)
+      --k;
+    hull[k++] = pts[i];
+  }
+  for(int i = n - 2, t = k + 1; i >= 0; --i)
+  {
+    while(k >= t && cross2(hull[k-2], hull[k-1], pts[i]) <= 0)
+      --k;
+    hull[k++] = pts[i];
+  }
+  --k;
+
+  // the axis is inside the outline, or the disc reaches one of its sides
+  bool inside = k >= 3;
+  for(int i = 0; i < k; ++i)
+  {
+    const Eigen::Vector2d &a = hull[i], &b = hull[(i+1) % k];
+    if(segmentDistanceSq(a, b) <= r_sq)
+      return true;
+    if(cross2(a, b, Eigen::Vector2d::Zero()) < 0)
+      inside = false;
+  }
+  return inside;
+}
+
+/* the shapes and the cells are convex, so each column of cells along z
+ * overlaps the shape in one run. solve for that run instead of testing
+ * every cell */
+static void rasterizeColumns(const RasterShape *shape, int x_begin, int x_end, std::vector<Eigen::Vector3d> *voxels)
+{
+  double e = 0.5 * shape->resolution;
+  for(int x = x_begin; x < x_end; ++x)
+  {
+    for(int y = shape->min[1]; y <= shape->max[1]; ++y)
+    {
+      // center of cell {x,y,0} relative to the shape
+      Eigen::Vector3d p = Eigen::Vector3d(shape->origin[0] + shape->resolution*x, shape->origin[1] + shape->resolution*y, shape->origin[2]) - shape->center;
+      double lo = shape->min[2], hi = shape->max[2];
+
+      if(shape->type == RASTER_BOX)
+      {
+        for(int i = 0; i < shape->num_axes; ++i)
+          clipToSlab(shape->axes[i].dot(p), shape->axes[i](2) * shape->resolution, shape->reach[i], lo, hi);
+      }
+      else if(shape->type == RASTER_SPHERE)
+      {
+        // distance from the center to the closest point of the column
+        double dx = std::max(fabs(p(0)) - e, 0.0), dy = std::max(fabs(p(1)) - e, 0.0);
+        double rest = shape->half[0]*shape->half[0] - dx*dx - dy*dy;
+        if(rest < 0)
+          continue;
+        clipToSlab(p(2), shape->resolution, e + sqrt(rest), lo, hi);
+      }
+      else
+      {
+        // every overlapping cell has its center within half a cell diagonal
+        // of the cylinder, the ends of that run are tested exactly below
+        Eigen::Vector3d q = shape->base + shape->step[0]*x + shape->step[1]*y;
+        clipToBall(q, shape->step[2], 2, shape->half[0] + sqrt(3.0)*e, lo, hi);
+        clipToSlab(q(2), shape->step[2](2), shape->half[2] + sqrt(3.0)*e, lo, hi);
+      }
+
+      int z_begin = int(ceil(lo - 1e-9));
+      int z_end = int(floor(hi + 1e-9));
+      if(shape->type == RASTER_CYLINDER)
+      {
+        while(z_begin <= z_end && !cellOverlapsCylinder(shape, x, y, z_begin))
+          ++z_begin;
+        while(z_end >= z_begin && !cellOverlapsCylinder(shape, x, y, z_end))
+          --z_end;
+      }
+      for(int z = z_begin; z <= z_end; ++z)
+        voxels->push_back(Eigen::Vector3d(shape->origin[0] + shape->resolution*x, shape->origin[1] + shape->resolution*y, shape->origin[2] + shape->resolution*z));
+    }
+  }
+}
+
+OccupancyGrid::OccupancyGrid(double dim_x, double dim_y, double dim_z, double resolution, double origin_x, double origin_y, double origin_z, Backend backend)
+{
+  grid_ = NULL;
+  compact_grid_ = NULL;
+  sparse_grid_ = NULL;
+  backend_ = backend;
+  if(backend == COMPACT_DISTANCE_FIELD)
+    compact_grid_ = new CompactDistanceField(int(dim_x/resolution + 0.5), int(dim_y/resolution + 0.5), int(dim_z/resolution + 0.5), resolution, origin_x, origin_y, origin_z, 0.40);
+  else if(backend == SPARSE_DISTANCE_FIELD)
+    sparse_grid_ = new SparseDistanceField(int(dim_x/resolution + 0.5), int(dim_y/resolution + 0.5), int(dim_z/resolution + 0.5), resolution, origin_x, origin_y, origin_z, 0.40);
+  else
+  {
+    grid_ = new distance_field::PropagationDistanceField(dim_x, dim_y, dim_z, resolution, origin_x, origin_y,  origin_z, 0.40);
+    grid_->reset();
+  }
   delete_grid_ = true;
+  dynamic_grid_ = NULL;
+  dynamic_compact_grid_ = NULL;
+  dynamic_sparse_grid_ = NULL;
+  num_propagation_threads_ = 0;
+  dynamic_layer_empty_ = true;
+  revision_ = 0;
+  initGeometry();
 }
 
 OccupancyGrid::OccupancyGrid(distance_field::PropagationDistanceField* df)
 {
   grid_ = df;
+  compact_grid_ = NULL;
+  sparse_grid_ = NULL;
+  backend_ = PROPAGATION_DISTANCE_FIELD;
   delete_grid_ = false;
+  dynamic_grid_ = NULL;
+  dynamic_compact_grid_ = NULL;
+  dynamic_sparse_grid_ = NULL;
+  num_propagation_threads_ = 0;
+  dynamic_layer_empty_ = true;
+  revision_ = 0;
+  initGeometry();
 }
 
 OccupancyGrid::~OccupancyGrid()
 {
   if(grid_ && delete_grid_)
     delete grid_;
+  if(compact_grid_)
+    delete compact_grid_;
+  if(dynamic_grid_)
+    delete dynamic_grid_;
+  if(dynamic_compact_grid_)
+    delete dynamic_compact_grid_;
+  if(sparse_grid_)
+    delete sparse_grid_;
+  if(dynamic_sparse_grid_)
+    delete dynamic_sparse_grid_;
+}
+
+void OccupancyGrid::initGeometry()
+{
+  getGridSize(grid_dims_[0], grid_dims_[1], grid_dims_[2]);
+  getOrigin(grid_origin_[0], grid_origin_[1], grid_origin_[2]);
+  inv_resolution_ = 1.0 / getResolution();
+}
+
+void OccupancyGrid::getDistancesAndGradients(const std::vector<Eigen::Vector3d> &points, std::vector<double> &distances, std::vector<Eigen::Vector3d> &gradients)
+{
+  distances.resize(points.size());
+  gradients.resize(points.size());
+  for(size_t i = 0; i < points.size(); ++i)
+    distances[i] = interpolate(points[i].x(), points[i].y(), points[i].z(), &gradients[i]);
+}
+
+distance_field::PropagationDistanceField* OccupancyGrid::getLayer(Layer layer)
+{
+  if(layer == STATIC_LAYER)
+    return grid_;
+
+  // same dimensions as the static layer so that cell indices match
+  if(dynamic_grid_ == NULL)
+  {
+    dynamic_grid_ = new distance_field::PropagationDistanceField(grid_->getSizeX(), grid_->getSizeY(), grid_->getSizeZ(), grid_->getResolution(), grid_->getOriginX(), grid_->getOriginY(), grid_->getOriginZ(), grid_->getUninitializedDistance());
+    dynamic_grid_->reset();
+  }
+  dynamic_layer_empty_ = false;
+  return dynamic_grid_;
+}
+
+CompactDistanceField* OccupancyGrid::getCompactLayer(Layer layer)
+{
+  if(layer == STATIC_LAYER)
+    return compact_grid_;
+
+  if(dynamic_compact_grid_ == NULL)
+  {
+    dynamic_compact_grid_ = new CompactDistanceField(compact_grid_->getNumCellsX(), compact_grid_->getNumCellsY(), compact_grid_->getNumCellsZ(), compact_grid_->getResolution(), compact_grid_->getOriginX(), compact_grid_->getOriginY(), compact_grid_->getOriginZ(), compact_grid_->getMaxDistance());
+    dynamic_compact_grid_->setNumThreads(num_propagation_threads_);
+  }
+  dynamic_layer_empty_ = false;
+  return dynamic_compact_grid_;
+}
+
+SparseDistanceField* OccupancyGrid::getSparseLayer(Layer layer)
+{
+  if(layer == STATIC_LAYER)
+    return sparse_grid_;
+
+  if(dynamic_sparse_grid_ == NULL)
+    dynamic_sparse_grid_ = new SparseDistanceField(sparse_grid_->getNumCellsX(), sparse_grid_->getNumCellsY(), sparse_grid_->getNumCellsZ(), sparse_grid_->getResolution(), sparse_grid_->getOriginX(), sparse_grid_->getOriginY(), sparse_grid_->getOriginZ(), sparse_grid_->getMaxDistance());
+  dynamic_layer_empty_ = false;
+  return dynamic_sparse_grid_;
+}
+
+void OccupancyGrid::setNumPropagationThreads(int num_threads)
+{
+  if(!compact_grid_)
+  {
+    ROS_WARN("[grid] Multi-threaded propagation is only supported by the compact distance field.");
+    return;
+  }
+
+  num_propagation_threads_ = num_threads;
+  compact_grid_->setNumThreads(num_threads);
+  if(dynamic_compact_grid_)
+    dynamic_compact_grid_->setNumThreads(num_threads);
+}
+
+void OccupancyGrid::getCompactCells(const std::vector<Eigen::Vector3d> &points, std::vector<int> &cells)
+{
+  int x, y, z;
+  cells.clear();
+  cells.reserve(points.size());
+  for(size_t i = 0; i < points.size(); ++i)
+  {
+    if(compact_grid_->worldToGrid(points[i].x(), points[i].y(), points[i].z(), x, y, z))
+      cells.push_back(compact_grid_->getCellIndex(x, y, z));
+  }
+}
+
+void OccupancyGrid::getSparseCells(const std::vector<Eigen::Vector3d> &points, std::vector<int> &cells)
+{
+  int x, y, z;
+  cells.clear();
+  cells.reserve(3*points.size());
+  for(size_t i = 0; i < points.size(); ++i)
+  {
+    if(!sparse_grid_->worldToGrid(points[i].x(), points[i].y(), points[i].z(), x, y, z))
+      continue;
+    cells.push_back(x);
+    cells.push_back(y);
+    cells.push_back(z);
+  }
+}
+
+void OccupancyGrid::addPointsToField(const std::vector<Eigen::Vector3d> &points, Layer layer)
+{
+  revision_++;
+  if(compact_grid_)
+  {
+    std::vector<int> cells;
+    getCompactCells(points, cells);
+    getCompactLayer(layer)->addObstacleCells(cells);
+    return;
+  }
+
+  if(sparse_grid_)
+  {
+    std::vector<int> cells;
+    getSparseCells(points, cells);
+    getSparseLayer(layer)->addObstacleCells(cells);
+    return;
+  }
+
+  EigenSTL::vector_Vector3d pts(points.begin(), points.end());
+  getLayer(layer)->addPointsToField(pts);
+}
+
+void OccupancyGrid::updatePointsInField(const std::vector<Eigen::Vector3d> &old_points, const std::vector<Eigen::Vector3d> &new_points, Layer layer)
+{
+  if(old_points.empty() && new_points.empty())
+    return;
+  revision_++;
+
+  if(compact_grid_)
+  {
+    std::vector<int> old_cells, new_cells;
+    getCompactCells(old_points, old_cells);
+    getCompactCells(new_points, new_cells);
+    getCompactLayer(layer)->updateObstacleCells(old_cells, new_cells);
+    return;
+  }
+
+  if(sparse_grid_)
+  {
+    std::vector<int> old_cells, new_cells;
+    getSparseCells(old_points, old_cells);
+    getSparseCells(new_points, new_cells);
+    getSparseLayer(layer)->updateObstacleCells(old_cells, new_cells);
+    return;
+  }
+
+  EigenSTL::vector_Vector3d old_pts(old_points.begin(), old_points.end());
+  EigenSTL::vector_Vector3d new_pts(new_points.begin(), new_points.end());
+  getLayer(layer)->updatePointsInField(old_pts, new_pts);
+}
+
+void OccupancyGrid::removePointsFromField(const std::vector<Eigen::Vector3d> &points, Layer layer)
+{
+  if(points.empty())
+    return;
+  revision_++;
+
+  if(compact_grid_)
+  {
+    std::vector<int> cells;
+    getCompactCells(points, cells);
+    getCompactLayer(layer)->removeObstacleCells(cells);
+    return;
+  }
+
+  if(sparse_grid_)
+  {
+    std::vector<int> cells;
+    getSparseCells(points, cells);
+    getSparseLayer(layer)->removeObstacleCells(cells);
+    return;
+  }
+
+  EigenSTL::vector_Vector3d pts(points.begin(), points.end());
+  getLayer(layer)->removePointsFromField(pts);
 }
 
 void OccupancyGrid::getGridSize(int &dim_x, int &dim_y, int &dim_z)
 {
-  dim_x = grid_->getSizeX() / grid_->getResolution();
-  dim_y = grid_->getSizeY() / grid_->getResolution();
-  dim_z = grid_->getSizeZ() / grid_->getResolution();
+  if(compact_grid_)
+  {
+    dim_x = compact_grid_->getNumCellsX();
+    dim_y = compact_grid_->getNumCellsY();
+    dim_z = compact_grid_->getNumCellsZ();
+    return;
+  }
+  if(sparse_grid_)
+  {
+    dim_x = sparse_grid_->getNumCellsX();
+    dim_y = sparse_grid_->getNumCellsY();
+    dim_z = sparse_grid_->getNumCellsZ();
+    return;
+  }
+  dim_x = grid_->getXNumCells();
+  dim_y = grid_->getYNumCells();
+  dim_z = grid_->getZNumCells();
 }
 
 void OccupancyGrid::getWorldSize(double &dim_x, double &dim_y, double &dim_z)
 {
+  if(compact_grid_)
+  {
+    dim_x = compact_grid_->getNumCellsX() * compact_grid_->getResolution();
+    dim_y = compact_grid_->getNumCellsY() * compact_grid_->getResolution();
+    dim_z = compact_grid_->getNumCellsZ() * compact_grid_->getResolution();
+    return;
+  }
+  if(sparse_grid_)
+  {
+    dim_x = sparse_grid_->getNumCellsX() * sparse_grid_->getResolution();
+    dim_y = sparse_grid_->getNumCellsY() * sparse_grid_->getResolution();
+    dim_z = sparse_grid_->getNumCellsZ() * sparse_grid_->getResolution();
+    return;
+  }
   dim_x = grid_->getSizeX();
   dim_y = grid_->getSizeY();
   dim_z = grid_->getSizeZ();
@@ -73,28 +540,58 @@ void OccupancyGrid::getWorldSize(double &dim_x, double &dim_y, double &dim_z)
 
 void OccupancyGrid::reset()
 {
-  grid_->reset();
+  revision_++;
+  if(compact_grid_)
+    compact_grid_->reset();
+  else if(sparse_grid_)
+    sparse_grid_->reset();
+  else
+    grid_->reset();
+  resetDynamicLayer();
+}
+
+void OccupancyGrid::resetDynamicLayer()
+{
+  revision_++;
+  if(dynamic_grid_)
+    dynamic_grid_->reset();
+  if(dynamic_compact_grid_)
+    dynamic_compact_grid_->reset();
+  if(dynamic_sparse_grid_)
+    dynamic_sparse_grid_->reset();
+  dynamic_layer_empty_ = true;
+  collision_map_points_.clear();
 }
 
 void OccupancyGrid::getOrigin(double &wx, double &wy, double &wz)
 {
-  grid_->gridToWorld(0, 0, 0, wx, wy, wz);
+  gridToWorld(0, 0, 0, wx, wy, wz);
 }
 
 double OccupancyGrid::getResolution()
 {
+  if(compact_grid_)
+    return compact_grid_->getResolution();
+  if(sparse_grid_)
+    return sparse_grid_->getResolution();
   return grid_->getResolution();
 }
 
 void OccupancyGrid::updateFromCollisionMap(const arm_navigation_msgs::CollisionMap &collision_map)
 {
+  // an empty map still clears the obstacles from the previous one
   if(collision_map.boxes.empty())
-  {
     ROS_DEBUG("[grid] collision map received is empty.");
-    return;
-  }
-  reference_frame_ = collision_map.header.frame_id;
-  //grid_->addCollisionMapToField(collision_map);
+  else
+    reference_frame_ = collision_map.header.frame_id;
+
+  std::vector<Eigen::Vector3d> pts(collision_map.boxes.size());
+  for(size_t i = 0; i < collision_map.boxes.size(); ++i)
+    pts[i] = Eigen::Vector3d(collision_map.boxes[i].center.x, collision_map.boxes[i].center.y, collision_map.boxes[i].center.z);
+
+  // only the cells that changed since the last map get propagated
+  updatePointsInField(collision_map_points_, pts, DYNAMIC_LAYER);
+  collision_map_points_.swap(pts);
 }
 
 void OccupancyGrid::addCube(double origin_x, double origin_y, double origin_z, double size_x, double size_y, double size_z)
@@ -102,11 +599,11 @@ void OccupancyGrid::addCube(double origin_x, double origin_y, double origin_z, d
   int num_points=0;
   std::vector<tf::Vector3> pts;
 
-  for (double x=origin_x-size_x/2.0; x<=origin_x+size_x/2.0; x+=grid_->getResolution())
+  for (double x=origin_x-size_x/2.0; x<=origin_x+size_x/2.0; x+=getResolution())
   {
-    for (double y=origin_y-size_y/2.0; y<=origin_y+size_y/2.0; y+=grid_->getResolution())
+    for (double y=origin_y-size_y/2.0; y<=origin_y+size_y/2.0; y+=getResolution())
     {
-      for (double z=origin_z-size_z/2.0; z<=origin_z+size_z/2.0; z+=grid_->getResolution())
+      for (double z=origin_z-size_z/2.0; z<=origin_z+size_z/2.0; z+=getResolution())
       {
         pts.push_back(tf::Vector3(x,y,z));
         ++num_points;
@@ -119,25 +616,115 @@ void OccupancyGrid::addCube(double origin_x, double origin_y, double origin_z, d
 
 void OccupancyGrid::getOccupiedVoxels(const geometry_msgs::Pose &pose, const std::vector<double> &dim, std::vector<Eigen::Vector3d> &voxels)
 {
-  Eigen::Vector3d vin, vout, v(pose.position.x, pose.position.y, pose.position.z);
-  Eigen::Matrix3d m(Eigen::Quaterniond(pose.orientation.w, pose.orientation.x, pose.orientation.y, pose.orientation.z));
+  rasterize(RASTER_BOX, pose, dim[0]/2.0, dim[1]/2.0, dim[2]/2.0, voxels);
+}
 
-  for (double x=0-dim[0]/2.0; x<=dim[0]/2.0; x+=grid_->getResolution())
+void OccupancyGrid::getOccupiedCylinderVoxels(const geometry_msgs::Pose &pose, double radius, double length, std::vector<Eigen::Vector3d> &voxels)
+{
+  rasterize(RASTER_CYLINDER, pose, radius, radius, length/2.0, voxels);
+}
+
+void OccupancyGrid::getOccupiedSphereVoxels(const geometry_msgs::Pose &pose, double radius, std::vector<Eigen::Vector3d> &voxels)
+{
+  rasterize(RASTER_SPHERE, pose, radius, radius, radius, voxels);
+}
+
+void OccupancyGrid::rasterize(int type, const geometry_msgs::Pose &pose, double hx, double hy, double hz, std::vector<Eigen::Vector3d> &voxels)
+{
+  // a cell is occupied if any part of it overlaps the shape, not just its
+  // center. boxes are tested against the cells with separating axes and
+  // spheres with the point of the cell closest to the center, both exactly.
+  // cylinders are tested exactly at the ends of each column's run
+  double e = 0.5 * getResolution();
+
+  RasterShape shape;
+  shape.type = type;
+  shape.half[0] = hx;
+  shape.half[1] = hy;
+  shape.half[2] = hz;
+  shape.resolution = getResolution();
+  for(int a = 0; a < 3; ++a)
+    shape.origin[a] = grid_origin_[a];
+
+  Eigen::Matrix3d rot(Eigen::Quaterniond(pose.orientation.w, pose.orientation.x, pose.orientation.y, pose.orientation.z));
+  shape.center = Eigen::Vector3d(pose.position.x, pose.position.y, pose.position.z);
+  Eigen::Matrix3d inv = rot.transpose();
+
+  // shape frame coordinates of cell {0,0,0}, of a step along each axis and
+  // of the cell corners
+  shape.base = inv * (Eigen::Vector3d(grid_origin_[0], grid_origin_[1], grid_origin_[2]) - shape.center);
+  shape.step[0] = inv.col(0) * shape.resolution;
+  shape.step[1] = inv.col(1) * shape.resolution;
+  shape.step[2] = inv.col(2) * shape.resolution;
+  for(int i = 0; i < 8; ++i)
+    shape.corners[i] = inv * Eigen::Vector3d((i & 1) ? e : -e, (i & 2) ? e : -e, (i & 4) ? e : -e);
+
+  // the world axes, the box axes and their cross products. along each, a
+  // cell and the box overlap if their centers are closer than the sum of
+  // their half widths
+  shape.num_axes = 0;
+  if(type == RASTER_BOX)
   {
-    for (double y=0-dim[1]/2.0; y<=dim[1]/2.0; y+=grid_->getResolution())
+    std::vector<Eigen::Vector3d> axes;
+    for(int a = 0; a < 3; ++a)
     {
-      for (double z=0-dim[2]/2.0; z<=dim[2]/2.0; z+=grid_->getResolution())
-      {
-        vin(0) = (x);
-        vin(1) = (y);
-        vin(2) = (z); 
-        vout = m*vin;
-        vout += v;
-
-        voxels.push_back(vout);
-      }
+      axes.push_back(Eigen::Vector3d::Unit(a));
+      axes.push_back(rot.col(a));
     }
+    for(int a = 0; a < 3; ++a)
+    {
+      for(int b = 0; b < 3; ++b)
+        axes.push_back(Eigen::Vector3d::Unit(a).cross(rot.col(b)));
+    }
+    for(size_t i = 0; i < axes.size(); ++i)
+    {
+      // parallel edges don't add an axis
+      if(axes[i].squaredNorm() < 1e-12)
+        continue;
+      shape.axes[shape.num_axes] = axes[i];
+      shape.reach[shape.num_axes] = e * (fabs(axes[i](0)) + fabs(axes[i](1)) + fabs(axes[i](2)));
+      for(int b = 0; b < 3; ++b)
+        shape.reach[shape.num_axes] += shape.half[b] * fabs(axes[i].dot(rot.col(b)));
+      ++shape.num_axes;
+    }
+  }
+
+  // cell range of the world aligned bounding box, clipped to the grid
+  for(int a = 0; a < 3; ++a)
+  {
+    double extent;
+    if(type == RASTER_SPHERE)
+      extent = shape.half[0];
+    else if(type == RASTER_CYLINDER)
+      extent = shape.half[0]*sqrt(std::max(1.0 - rot(a,2)*rot(a,2), 0.0)) + fabs(rot(a,2))*shape.half[2];
+    else
+      extent = fabs(rot(a,0))*shape.half[0] + fabs(rot(a,1))*shape.half[1] + fabs(rot(a,2))*shape.half[2];
+    extent += e;
+
+    shape.min[a] = std::max(int(ceil((shape.center(a) - extent - grid_origin_[a]) * inv_resolution_ - 1e-9)), 0);
+    shape.max[a] = std::min(int(floor((shape.center(a) + extent - grid_origin_[a]) * inv_resolution_ + 1e-9)), grid_dims_[a] - 1);
+    if(shape.min[a] > shape.max[a])
+      return;
   }
+
+  // split big objects up by x
+  int num_x = shape.max[0] - shape.min[0] + 1;
+  double num_cells = double(num_x) * (shape.max[1] - shape.min[1] + 1) * (shape.max[2] - shape.min[2] + 1);
+  int num_threads = std::min(int(boost::thread::hardware_concurrency()), num_x);
+  if(num_cells < RASTER_MIN_CELLS_PER_THREAD * 2 || num_threads <= 1)
+  {
+    rasterizeColumns(&shape, shape.min[0], shape.max[0] + 1, &voxels);
+    return;
+  }
+
+  std::vector<std::vector<Eigen::Vector3d> > parts(num_threads);
+  boost::thread_group threads;
+  for(int t = 0; t < num_threads; ++t)
+    threads.create_thread(boost::bind(&rasterizeColumns, &shape, shape.min[0] + (t * num_x) / num_threads, shape.min[0] + ((t+1) * num_x) / num_threads, &parts[t]));
+  threads.join_all();
+
+  for(int t = 0; t < num_threads; ++t)
+    voxels.insert(voxels.end(), parts[t].begin(), parts[t].end());
 }
 
 void OccupancyGrid::getOccupiedVoxels(double x_center, double y_center, double z_center, double radius, std::string text, std::vector<geometry_msgs::Point> &voxels)
@@ -153,7 +740,7 @@ void OccupancyGrid::getOccupiedVoxels(double x_center, double y_center, double z
     {
       for(int x = x_c-radius_c; x < x_c+radius_c; ++x)
       {
-        if(getCell(x,y,z) == 0)
+        if(isInBounds(x,y,z) && getCell(x,y,z) == 0)
         {
           gridToWorld(x, y, z, v.x, v.y, v.z);
           voxels.push_back(v);
@@ -170,11 +757,11 @@ void OccupancyGrid::getOccupiedVoxels(std::vector<geometry_msgs::Point> &voxels)
   getOrigin(origin[0], origin[1], origin[2]);
   getWorldSize(dim[0], dim[1], dim[2]);
   
-  for(double x=origin[0]; x<=origin[0]+dim[0]; x+=grid_->getResolution())
+  for(double x=origin[0]; x<=origin[0]+dim[0]; x+=getResolution())
   {
-    for(double y=origin[1]; y<=origin[1]+dim[1]; y+=grid_->getResolution())
+    for(double y=origin[1]; y<=origin[1]+dim[1]; y+=getResolution())
     {
-      for(double z=origin[2]; z<=origin[2]+dim[2]; z+=grid_->getResolution())
+      for(double z=origin[2]; z<=origin[2]+dim[2]; z+=getResolution())
       {
         if(getDistanceFromPoint(x,y,z) == 0)
         {
@@ -214,6 +801,11 @@ visualization_msgs::MarkerArray OccupancyGrid::getVisualization(std::string type
   }
   else if(type.compare("distance_field") == 0)
   {
+    if(!grid_)
+    {
+      ROS_WARN("[grid] The distance_field visualization is only supported by the PropagationDistanceField.");
+      return ma;
+    }
     visualization_msgs::Marker m;
     // grid_->getIsoSurfaceMarkers(0.01, 0.03, getReferenceFrame(), ros::Time::now(),  Eigen::Affine3d::Identity(), m);
     //grid_->getIsoSurfaceMarkers(0.01, 0.08, getReferenceFrame(), ros::Time::now(), tf::Transform(tf::createIdentityQuaternion(), tf::Vector3(0,0,0)), m);
@@ -234,9 +826,9 @@ visualization_msgs::MarkerArray OccupancyGrid::getVisualization(std::string type
     marker.type = visualization_msgs::Marker::POINTS;
     marker.action = visualization_msgs::Marker::ADD;
     marker.lifetime = ros::Duration(0.0);
-    marker.scale.x = grid_->getResolution() / 2.0;
-    marker.scale.y = grid_->getResolution() / 2.0;
-    marker.scale.z = grid_->getResolution() / 2.0;
+    marker.scale.x = getResolution() / 2.0;
+    marker.scale.y = getResolution() / 2.0;
+    marker.scale.z = getResolution() / 2.0;
     marker.color.r = 0.8;
     marker.color.g = 0.3;
     marker.color.b = 0.5;
@@ -269,15 +861,15 @@ bool OccupancyGrid::writeOccupancyGridToBagFile(std::string bag_filename, std::s
 
   map.header.frame_id = reference_frame_;
   box.angle = 0.0;
-  box.extents.x = grid_->getResolution();
-  box.extents.y = grid_->getResolution();
-  box.extents.z = grid_->getResolution();
+  box.extents.x = getResolution();
+  box.extents.y = getResolution();
+  box.extents.z = getResolution();
  
-  for(double x=origin[0]; x<=origin[0]+dim[0]; x+=grid_->getResolution())
+  for(double x=origin[0]; x<=origin[0]+dim[0]; x+=getResolution())
   {
-    for(double y=origin[1]; y<=origin[1]+dim[1]; y+=grid_->getResolution())
+    for(double y=origin[1]; y<=origin[1]+dim[1]; y+=getResolution())
     {
-      for(double z=origin[2]; z<=origin[2]+dim[2]; z+=grid_->getResolution())
+      for(double z=origin[2]; z<=origin[2]+dim[2]; z+=getResolution())
       {
         if(getDistanceFromPoint(x,y,z) == 0)
         {
@@ -292,104 +884,71 @@ bool OccupancyGrid::writeOccupancyGridToBagFile(std::string bag_filename, std::s
   return writeCollisionMapToBagFile(map, bag_filename, topic_name);
 }
 
-/*
-void OccupancyGrid::printGridFromBinaryFile(std::string filename)
+bool OccupancyGrid::saveGridToBinaryFile(std::string filename)
 {
-  ifstream fin;
-  int dimx,dimy,dimz;
-  unsigned char temp = 0;
-  struct stat file_stats;
-
-  const char *name  = filename.c_str();
-  fin.open(name, ios_base::in | ios_base::binary);
+  if(compact_grid_)
+    return compact_grid_->saveSnapshot(filename);
 
-  if (fin.is_open())
+  if(sparse_grid_)
   {
-    fin.read( (char*) &dimx, sizeof(int));
-    fin.read( (char*) &dimy, sizeof(int));
-    fin.read( (char*) &dimz, sizeof(int));
+    ROS_ERROR("[grid] Grid snapshots aren't supported by the sparse distance field.");
+    return false;
+  }
 
-    for(int x = 0; x < dimx; x++)
+  // the snapshot is always in the compact format, so rebuild the static
+  // layer as a compact field from its obstacle cells
+  int dim_x, dim_y, dim_z;
+  double ox, oy, oz;
+  std::vector<int> cells;
+  getGridSize(dim_x, dim_y, dim_z);
+  gridToWorld(0, 0, 0, ox, oy, oz);
+  CompactDistanceField df(dim_x, dim_y, dim_z, getResolution(), ox, oy, oz, grid_->getUninitializedDistance());
+  for(int x = 0; x < dim_x; ++x)
+  {
+    for(int y = 0; y < dim_y; ++y)
     {
-      for(int y = 0; y < dimy; y++)
+      for(int z = 0; z < dim_z; ++z)
       {
-        for(int z = 0; z < dimz; z++)
-        {
-          fin.read( (char*) &temp, sizeof(unsigned char));
-        }
+        if(grid_->getDistance(x,y,z) == 0)
+          cells.push_back(df.getCellIndex(x,y,z));
       }
     }
   }
-  else
-  {
-    ROS_ERROR("Failed to open file for reading.");
-    return;
-  }
-
-  if(stat(name, &file_stats) == 0)
-    ROS_DEBUG("The size of the file read is %d kb.", int(file_stats.st_size)/1024);
-  else
-    ROS_DEBUG("An error occurred when retrieving size of file read.");
-
-  fin.close();
+  df.setNumThreads(num_propagation_threads_ > 0 ? num_propagation_threads_ : 1);
+  df.addObstacleCells(cells);
+  return df.saveSnapshot(filename);
 }
 
-bool OccupancyGrid::saveGridToBinaryFile(std::string filename)
+bool OccupancyGrid::loadGridFromBinaryFile(std::string filename)
 {
-  ofstream fout;
-  int dimx,dimy,dimz;
-  unsigned char val = 0;
-  struct stat file_stats;
-
-  getGridSize(dimx, dimy, dimz);
-
-  const char *name  = filename.c_str();
-  fout.open(name, ios_base::out | ios_base::binary | ios_base::trunc);
-
-  if (fout.is_open())
+  if(!compact_grid_)
   {
-    fout.write( (char *) &dimx, sizeof(int));
-    fout.write( (char *) &dimy, sizeof(int));
-    fout.write( (char *) &dimz, sizeof(int));
-
-    for(int x = 0; x < dimx; x++)
-    {
-      for(int y = 0; y < dimy; y++)
-      {
-        for(int z = 0; z < dimz; z++)
-        {
-          val = getCell(x,y,z);
-          fout.write( (char *) &val, sizeof(unsigned char));
-        }
-      }
-    }
-  }
-  else
-  {
-    ROS_ERROR("[saveGridToBinaryFile] Failed to open file for writing.\n");
+    ROS_ERROR("[grid] Grid snapshots can only be loaded into the compact distance field.");
     return false;
   }
 
-  fout.close();
+  CompactDistanceField *df = CompactDistanceField::mapSnapshot(filename);
+  if(df == NULL)
+    return false;
 
-  //verify writing to file was successful
-  if(stat(name, &file_stats) == 0)
-  {
-    ROS_INFO("[saveGridToBinaryFile] The size of the file created is %d kb.\n", int(file_stats.st_size)/1024);
-    if(file_stats.st_size == 0)
-    {
-      ROS_ERROR("[saveGridToBinaryFile] File created is empty. Exiting.\n");
-      return false;
-    }
-  }
-  else
+  if(df->getNumCellsX() != compact_grid_->getNumCellsX() ||
+     df->getNumCellsY() != compact_grid_->getNumCellsY() ||
+     df->getNumCellsZ() != compact_grid_->getNumCellsZ() ||
+     fabs(df->getResolution() - compact_grid_->getResolution()) > 1e-9 ||
+     fabs(df->getOriginX() - compact_grid_->getOriginX()) > 1e-9 ||
+     fabs(df->getOriginY() - compact_grid_->getOriginY()) > 1e-9 ||
+     fabs(df->getOriginZ() - compact_grid_->getOriginZ()) > 1e-9)
   {
-    ROS_ERROR("[saveGridToBinaryFile] An error occurred when retrieving size of file created. Exiting.\n");
+    ROS_ERROR("[grid] The grid in %s doesn't match the dimensions of this one. {%d %d %d} at %0.3fm", filename.c_str(), df->getNumCellsX(), df->getNumCellsY(), df->getNumCellsZ(), df->getResolution());
+    delete df;
     return false;
   }
 
+  df->setNumThreads(num_propagation_threads_);
+  delete compact_grid_;
+  compact_grid_ = df;
+  revision_++;
   return true;
 }
-*/
 
 }
@@ -87,34 +87,106 @@ void RobotModel::getKinematicsFrame(std::string &name)
   name = kinematics_frame_;
 }
 
-bool RobotModel::computeFK(const std::vector<double> &angles, std::string name, KDL::Frame &f)
+RobotModelContext* RobotModel::createContext() const
+{
+  return new RobotModelContext();
+}
+
+RobotModelContext& RobotModel::getContext()
+{
+  if(!ctx_)
+    ctx_.reset(createContext());
+  return *ctx_;
+}
+
+bool RobotModel::computeFK(const std::vector<double> &angles, const std::string &name, KDL::Frame &f, RobotModelContext &ctx) const
 {
   ROS_ERROR("Function not filled in.");  
   return false;
 }
 
-bool RobotModel::computeFK(const std::vector<double> &angles, std::string name, std::vector<double> &pose)
+bool RobotModel::computeFK(const std::vector<double> &angles, const std::string &name, std::vector<double> &pose, RobotModelContext &ctx) const
 {
-  ROS_ERROR("Function not filled in.");  
+  KDL::Frame f;
+  if(!computeFK(angles, name, f, ctx))
+    return false;
+
+  pose.resize(6,0);
+  pose[0] = f.p[0];
+  pose[1] = f.p[1];
+  pose[2] = f.p[2];
+  f.M.GetRPY(pose[3], pose[4], pose[5]);
+  return true;
+}
+
+bool RobotModel::computePlanningLinkFK(const std::vector<double> &angles, std::vector<double> &pose, RobotModelContext &ctx) const
+{
+  return computeFK(angles, planning_link_, pose, ctx);
+}
+
+bool RobotModel::computePlanningLinkFKs(const double *angles, size_t n, double *poses, RobotModelContext &ctx, std::vector<std::vector<KDL::Frame> > *frames) const
+{
+  if(frames != NULL)
+  {
+    ROS_ERROR("Function not filled in.");
+    return false;
+  }
+
+  bool all_valid = true;
+  std::vector<double> a(planning_joints_.size()), pose(6,0);
+  for(size_t i = 0; i < n; ++i)
+  {
+    for(size_t j = 0; j < a.size(); ++j)
+      a[j] = angles[j*n + i];
+
+    if(!computePlanningLinkFK(a, pose, ctx))
+      all_valid = false;
+    for(size_t k = 0; k < 6; ++k)
+      poses[k*n + i] = pose[k];
+  }
+  return all_valid;
+}
+
+bool RobotModel::computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option, RobotModelContext &ctx) const
+{
+  ROS_ERROR("Function not filled in."); 
   return false;
 }
 
-bool RobotModel::computePlanningLinkFK(const std::vector<double> &angles, std::vector<double> &pose)
+bool RobotModel::computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, RobotModelContext &ctx) const
 {
   ROS_ERROR("Function not filled in.");  
   return false;
 }
 
+bool RobotModel::computeFK(const std::vector<double> &angles, std::string name, KDL::Frame &f)
+{
+  return computeFK(angles, name, f, getContext());
+}
+
+bool RobotModel::computeFK(const std::vector<double> &angles, std::string name, std::vector<double> &pose)
+{
+  return computeFK(angles, name, pose, getContext());
+}
+
+bool RobotModel::computePlanningLinkFK(const std::vector<double> &angles, std::vector<double> &pose)
+{
+  return computePlanningLinkFK(angles, pose, getContext());
+}
+
+bool RobotModel::computePlanningLinkFKs(const double *angles, size_t n, double *poses, std::vector<std::vector<KDL::Frame> > *frames)
+{
+  return computePlanningLinkFKs(angles, n, poses, getContext(), frames);
+}
+
 bool RobotModel::computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option)
 {
-  ROS_ERROR("Function not filled in."); 
-  return false;
+  return computeIK(pose, start, solution, option, getContext());
 }
 
 bool RobotModel::computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution)
 {
-  ROS_ERROR("Function not filled in.");  
-  return false;
+  return computeFastIK(pose, start, solution, getContext());
 }
 
 void RobotModel::printRobotModelInformation()
@@ -122,12 +194,47 @@ void RobotModel::printRobotModelInformation()
   ROS_ERROR("Function not filled in.");  
 }
 
-bool RobotModel::checkJointLimits(const std::vector<double> &angles)
+bool RobotModel::checkJointLimits(const std::vector<double> &angles) const
+{
+  ROS_ERROR("Function not filled in.");  
+  return false;
+}
+
+bool RobotModel::getPlanningJointLimits(const std::string &name, double &min_limit, double &max_limit, bool &continuous) const
 {
   ROS_ERROR("Function not filled in.");  
   return false;
 }
 
+int RobotModel::getRedundantJointIndex() const
+{
+  return -1;
+}
+
+double RobotModel::getMaxJointLimit(std::string name)
+{
+  double min_limit = 0, max_limit = 0;
+  bool continuous = false;
+  getPlanningJointLimits(name, min_limit, max_limit, continuous);
+  return max_limit;
+}
+
+double RobotModel::getMinJointLimit(std::string name)
+{
+  double min_limit = 0, max_limit = 0;
+  bool continuous = false;
+  getPlanningJointLimits(name, min_limit, max_limit, continuous);
+  return min_limit;
+}
+
+bool RobotModel::isJointContinuous(std::string name)
+{
+  double min_limit = 0, max_limit = 0;
+  bool continuous = false;
+  getPlanningJointLimits(name, min_limit, max_limit, continuous);
+  return continuous;
+}
+
 void RobotModel::setKinematicsToPlanningTransform(const KDL::Frame &f, std::string name)
 {
   T_kinematics_to_planning_ = f;
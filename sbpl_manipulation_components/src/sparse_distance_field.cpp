@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2010, Maxim Likhachev
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the University of Pennsylvania nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sbpl_manipulation_components/sparse_distance_field.h>
+
+namespace sbpl_arm_planner
+{
+
+SparseDistanceField::SparseDistanceField(int num_cells_x, int num_cells_y, int num_cells_z, double resolution, double origin_x, double origin_y, double origin_z, double max_distance)
+{
+  dims_[0] = num_cells_x;
+  dims_[1] = num_cells_y;
+  dims_[2] = num_cells_z;
+  for(int i = 0; i < 3; ++i)
+    block_dims_[i] = (dims_[i] + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+  resolution_ = resolution;
+  inv_resolution_ = 1.0 / resolution;
+  origin_[0] = origin_x;
+  origin_[1] = origin_y;
+  origin_[2] = origin_z;
+
+  // the distance in whole cells has to fit in an unsigned char
+  int max_cells = int(max_distance * inv_resolution_ + 0.5);
+  if(max_cells > 255)
+    max_cells = 255;
+  if(max_cells < 1)
+    max_cells = 1;
+  max_dsq_ = max_cells * max_cells;
+
+  dist_table_.resize(max_dsq_ + 1);
+  cell_dist_table_.resize(max_dsq_ + 1);
+  for(int d = 0; d <= max_dsq_; ++d)
+  {
+    dist_table_[d] = sqrt(double(d)) * resolution_;
+    cell_dist_table_[d] = (unsigned char)(sqrt(double(d)));
+  }
+  buckets_.resize(max_dsq_ + 1);
+
+  int n = 0;
+  for(int dx = -1; dx <= 1; ++dx)
+  {
+    for(int dy = -1; dy <= 1; ++dy)
+    {
+      for(int dz = -1; dz <= 1; ++dz)
+      {
+        if(dx == 0 && dy == 0 && dz == 0)
+          continue;
+        neighbor_dirs_[n][0] = dx;
+        neighbor_dirs_[n][1] = dy;
+        neighbor_dirs_[n][2] = dz;
+        n++;
+      }
+    }
+  }
+}
+
+SparseDistanceField::~SparseDistanceField()
+{
+  reset();
+}
+
+void SparseDistanceField::reset()
+{
+  for(BlockMap::iterator it = blocks_.begin(); it != blocks_.end(); ++it)
+    delete it->second;
+  blocks_.clear();
+}
+
+size_t SparseDistanceField::getMemoryUsage() const
+{
+  return blocks_.size() * (sizeof(Block) + sizeof(int64_t) + sizeof(Block*));
+}
+
+SparseDistanceField::Block* SparseDistanceField::getBlock(int x, int y, int z)
+{
+  Block *&b = blocks_[getBlockKey(x, y, z)];
+  if(b == NULL)
+  {
+    b = new Block;
+    for(int i = 0; i < BLOCK_CELLS; ++i)
+    {
+      b->dsq[i] = max_dsq_;
+      b->nearest[i][0] = -1;
+    }
+  }
+  return b;
+}
+
+bool SparseDistanceField::isObstacle(int x, int y, int z) const
+{
+  const Block *b = findBlock(x, y, z);
+  if(b == NULL)
+    return false;
+  const short *n = b->nearest[getBlockCell(x, y, z)];
+  return n[0] == x && n[1] == y && n[2] == z;
+}
+
+void SparseDistanceField::addObstacleCells(const std::vector<int> &cells)
+{
+  addObstacles(cells);
+  propagate();
+}
+
+void SparseDistanceField::removeObstacleCells(const std::vector<int> &cells)
+{
+  removeObstacles(cells);
+  propagate();
+}
+
+void SparseDistanceField::updateObstacleCells(const std::vector<int> &old_cells, const std::vector<int> &new_cells)
+{
+  removeObstacles(old_cells);
+  addObstacles(new_cells);
+  propagate();
+}
+
+void SparseDistanceField::addObstacles(const std::vector<int> &cells)
+{
+  Cell c;
+  for(size_t i = 0; i + 2 < cells.size(); i += 3)
+  {
+    c.x = cells[i];
+    c.y = cells[i+1];
+    c.z = cells[i+2];
+    Block *b = getBlock(c.x, c.y, c.z);
+    int bc = getBlockCell(c.x, c.y, c.z);
+    if(b->nearest[bc][0] == c.x && b->nearest[bc][1] == c.y && b->nearest[bc][2] == c.z)
+      continue;
+    b->dsq[bc] = 0;
+    b->nearest[bc][0] = c.x;
+    b->nearest[bc][1] = c.y;
+    b->nearest[bc][2] = c.z;
+    buckets_[0].push_back(c);
+  }
+}
+
+void SparseDistanceField::removeObstacles(const std::vector<int> &cells)
+{
+  std::vector<Cell> removed;
+  Cell c;
+  for(size_t i = 0; i + 2 < cells.size(); i += 3)
+  {
+    c.x = cells[i];
+    c.y = cells[i+1];
+    c.z = cells[i+2];
+    if(!isObstacle(c.x, c.y, c.z))
+      continue;
+    Block *b = getBlock(c.x, c.y, c.z);
+    int bc = getBlockCell(c.x, c.y, c.z);
+    b->nearest[bc][0] = -1;
+    b->dsq[bc] = max_dsq_;
+    removed.push_back(c);
+  }
+
+  if(removed.empty())
+    return;
+
+  // clear every cell whose nearest obstacle is gone, only the allocated
+  // blocks can have one
+  std::vector<Cell> cleared(removed);
+  for(BlockMap::iterator it = blocks_.begin(); it != blocks_.end(); ++it)
+  {
+    Block *b = it->second;
+    int64_t key = it->first;
+    int bx = int(key / (int64_t(block_dims_[1]) * block_dims_[2]));
+    int by = int((key / block_dims_[2]) % block_dims_[1]);
+    int bz = int(key % block_dims_[2]);
+    for(int i = 0; i < BLOCK_CELLS; ++i)
+    {
+      if(b->nearest[i][0] < 0 || isObstacle(b->nearest[i][0], b->nearest[i][1], b->nearest[i][2]))
+        continue;
+      b->nearest[i][0] = -1;
+      b->dsq[i] = max_dsq_;
+      c.x = (bx << BLOCK_BITS) + (i >> (2*BLOCK_BITS));
+      c.y = (by << BLOCK_BITS) + ((i >> BLOCK_BITS) & BLOCK_MASK);
+      c.z = (bz << BLOCK_BITS) + (i & BLOCK_MASK);
+      cleared.push_back(c);
+    }
+  }
+
+  // repropagate into the cleared cells from the cells around them
+  Cell nc;
+  for(size_t i = 0; i < cleared.size(); ++i)
+  {
+    for(int n = 0; n < 26; ++n)
+    {
+      nc.x = cleared[i].x + neighbor_dirs_[n][0];
+      nc.y = cleared[i].y + neighbor_dirs_[n][1];
+      nc.z = cleared[i].z + neighbor_dirs_[n][2];
+      if(!isInBounds(nc.x, nc.y, nc.z))
+        continue;
+      const Block *b = findBlock(nc.x, nc.y, nc.z);
+      if(b == NULL)
+        continue;
+      int bc = getBlockCell(nc.x, nc.y, nc.z);
+      if(b->nearest[bc][0] >= 0)
+        buckets_[b->dsq[bc]].push_back(nc);
+    }
+  }
+}
+
+void SparseDistanceField::propagate()
+{
+  int dx, dy, dz, nd, next;
+  Cell nc;
+
+  int d = 0;
+  while(d <= max_dsq_)
+  {
+    next = d + 1;
+
+    // the bucket can grow while it's being expanded
+    for(size_t i = 0; i < buckets_[d].size(); ++i)
+    {
+      Cell c = buckets_[d][i];
+      const Block *cb = findBlock(c.x, c.y, c.z);
+      int cbc = getBlockCell(c.x, c.y, c.z);
+      if(cb->dsq[cbc] != d)
+        continue;
+
+      int ox = cb->nearest[cbc][0];
+      int oy = cb->nearest[cbc][1];
+      int oz = cb->nearest[cbc][2];
+
+      for(int n = 0; n < 26; ++n)
+      {
+        nc.x = c.x + neighbor_dirs_[n][0];
+        nc.y = c.y + neighbor_dirs_[n][1];
+        nc.z = c.z + neighbor_dirs_[n][2];
+        dx = nc.x - ox;
+        dy = nc.y - oy;
+        dz = nc.z - oz;
+        nd = dx*dx + dy*dy + dz*dz;
+
+        // don't allocate blocks that would only hold the max distance
+        if(nd >= max_dsq_ || !isInBounds(nc.x, nc.y, nc.z))
+          continue;
+
+        Block *b = getBlock(nc.x, nc.y, nc.z);
+        int bc = getBlockCell(nc.x, nc.y, nc.z);
+        if(nd < b->dsq[bc])
+        {
+          b->dsq[bc] = nd;
+          b->nearest[bc][0] = ox;
+          b->nearest[bc][1] = oy;
+          b->nearest[bc][2] = oz;
+          buckets_[nd].push_back(nc);
+
+          if(nd < next && nd < d)
+            next = nd;
+        }
+      }
+    }
+    buckets_[d].clear();
+    d = next;
+  }
+}
+
+}
@@ -0,0 +1,133 @@
+#include <ros/ros.h>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <sbpl_manipulation_components/kdl_robot_model.h>
+#include <sbpl_manipulation_components/generated_fk_robot_model.h>
+
+/* Compares every frame of the generated FK against the KDLRobotModel at
+ * random joint angles. Needs the robot_description and the chain has to be
+ * one of the GENERATED_FK_SOURCES built into the library, see
+ * launch/test_generated_fk.launch for the PR2's right arm. */
+int main(int argc, char **argv)
+{
+  ros::init (argc, argv, "test_generated_fk");
+  ros::NodeHandle nh, ph("~");
+
+  std::string root, tip, urdf;
+  int num_samples;
+  ph.param<std::string>("chain_root_link", root, "torso_lift_link");
+  ph.param<std::string>("chain_tip_link", tip, "r_gripper_palm_link");
+  ph.param("num_samples", num_samples, 10000);
+  nh.param<std::string>("robot_description", urdf, " ");
+
+  std::vector<std::string> pj;
+  pj.push_back("r_shoulder_pan_joint");
+  pj.push_back("r_shoulder_lift_joint");
+  pj.push_back("r_upper_arm_roll_joint");
+  pj.push_back("r_elbow_flex_joint");
+  pj.push_back("r_forearm_roll_joint");
+  pj.push_back("r_wrist_flex_joint");
+  pj.push_back("r_wrist_roll_joint");
+
+  sbpl_arm_planner::KDLRobotModel kdl(root, tip);
+  sbpl_arm_planner::GeneratedFKRobotModel gen(root, tip);
+  if(!kdl.init(urdf, pj) || !gen.init(urdf, pj))
+  {
+    ROS_ERROR("Failed to initialize the robot models. Exiting.");
+    return 1;
+  }
+
+  // the same transform on both, it has to be applied too
+  KDL::Frame f(KDL::Rotation::RPY(0.1, -0.2, 0.3), KDL::Vector(-0.05, 0.0, 0.801));
+  kdl.setKinematicsToPlanningTransform(f, "map");
+  gen.setKinematicsToPlanningTransform(f, "map");
+
+  const sbpl_arm_planner::GeneratedFK *g = sbpl_arm_planner::findGeneratedFK(root, tip);
+  std::vector<std::vector<double> > samples(num_samples, std::vector<double>(g->num_joints, 0));
+  srand(1);
+  for(int i = 0; i < num_samples; ++i)
+    for(int j = 0; j < g->num_joints; ++j)
+      samples[i][j] = M_PI * (2.0 * rand() / double(RAND_MAX) - 1.0);
+
+  // frames[i] is what the KDLRobotModel returns for link_map_ index i, so
+  // compare it with the link of segment i
+  KDL::Tree tree;
+  KDL::Chain chain;
+  urdf::Model model;
+  model.initString(urdf);
+  kdl_parser::treeFromUrdfModel(model, tree);
+  tree.getChain(root, tip, chain);
+
+  double max_error = 0;
+  std::vector<KDL::Frame> frames;
+  KDL::Frame fk;
+  for(int i = 0; i < num_samples; ++i)
+  {
+    gen.computeFK(samples[i], frames);
+    for(size_t j = 0; j < chain.getNrOfSegments(); ++j)
+    {
+      if(!kdl.computeFK(samples[i], chain.getSegment(j).getName(), fk))
+      {
+        ROS_ERROR("KDL failed to compute the FK of %s.", chain.getSegment(j).getName().c_str());
+        return 1;
+      }
+      for(int k = 0; k < 3; ++k)
+      {
+        max_error = std::max(max_error, fabs(fk.p(k) - frames[j].p(k)));
+        for(int l = 0; l < 3; ++l)
+          max_error = std::max(max_error, fabs(fk.M(k,l) - frames[j].M(k,l)));
+      }
+    }
+  }
+  ROS_INFO("%d samples of %d frames, max difference: %g", num_samples, int(chain.getNrOfSegments()), max_error);
+
+  // batch FK of both models against the single configuration frames
+  std::vector<double> soa(num_samples * g->num_joints), kdl_poses(6 * num_samples), gen_poses(6 * num_samples);
+  for(int i = 0; i < num_samples; ++i)
+    for(int j = 0; j < g->num_joints; ++j)
+      soa[j*num_samples + i] = samples[i][j];
+  kdl.setPlanningLink(tip);
+  gen.setPlanningLink(tip);
+  std::vector<std::vector<KDL::Frame> > batch_frames;
+  double max_batch_error = 0;
+  if(!kdl.computePlanningLinkFKs(&soa[0], num_samples, &kdl_poses[0]) || !gen.computePlanningLinkFKs(&soa[0], num_samples, &gen_poses[0], &batch_frames))
+  {
+    ROS_ERROR("Batch FK failed.");
+    return 1;
+  }
+  for(int i = 0; i < num_samples; ++i)
+  {
+    gen.computeFK(samples[i], frames);
+    for(size_t j = 0; j < frames.size(); ++j)
+      for(int k = 0; k < 3; ++k)
+        max_batch_error = std::max(max_batch_error, fabs(frames[j].p(k) - batch_frames[i][j].p(k)));
+  }
+  for(int i = 0; i < 6 * num_samples; ++i)
+    max_batch_error = std::max(max_batch_error, fabs(kdl_poses[i] - gen_poses[i]));
+  ROS_INFO("batch FK, max difference: %g", max_batch_error);
+  max_error = std::max(max_error, max_batch_error);
+
+  // planning link timing
+  std::vector<double> pose;
+  ros::WallTime start = ros::WallTime::now();
+  for(int i = 0; i < num_samples; ++i)
+    kdl.computePlanningLinkFK(samples[i], pose);
+  double kdl_time = (ros::WallTime::now() - start).toSec();
+  start = ros::WallTime::now();
+  for(int i = 0; i < num_samples; ++i)
+    gen.computePlanningLinkFK(samples[i], pose);
+  double gen_time = (ros::WallTime::now() - start).toSec();
+  start = ros::WallTime::now();
+  gen.computePlanningLinkFKs(&soa[0], num_samples, &gen_poses[0]);
+  double batch_time = (ros::WallTime::now() - start).toSec();
+  ROS_INFO("planning link FK  KDL: %0.3fus  generated: %0.3fus  generated batch: %0.3fus", kdl_time * 1e6 / num_samples, gen_time * 1e6 / num_samples, batch_time * 1e6 / num_samples);
+
+  if(max_error > 1e-9)
+  {
+    ROS_ERROR("The generated FK doesn't match KDL.");
+    return 1;
+  }
+  ROS_INFO("done");
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include <ros/ros.h>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <set>
+#include <sbpl_manipulation_components/occupancy_grid.h>
+
+using namespace sbpl_arm_planner;
+
+double randomRange(double lo, double hi)
+{
+  return lo + (hi - lo) * (rand() / double(RAND_MAX));
+}
+
+/* distance from the world point p to the box */
+double boxDistance(const Eigen::Matrix3d &rot, const Eigen::Vector3d &center, const std::vector<double> &dim, const Eigen::Vector3d &p)
+{
+  Eigen::Vector3d q = rot.transpose() * (p - center);
+  Eigen::Vector3d d;
+  for(int a = 0; a < 3; ++a)
+    d(a) = std::max(fabs(q(a)) - 0.5*dim[a], 0.0);
+  return d.norm();
+}
+
+/* Rasterizes randomly placed boxes thinner than a cell and checks that every
+ * cell holding a point of the box is returned, and that every returned cell
+ * overlaps the box. */
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "test_rasterize");
+  double size = 1.0, resolution = 0.02;
+  int num_boxes = 200, num_samples = 2000;
+
+  OccupancyGrid grid(size, size, size, resolution, 0.0, 0.0, 0.0, OccupancyGrid::COMPACT_DISTANCE_FIELD);
+
+  srand(1);
+  int num_missed = 0, num_extra = 0;
+  for(int i = 0; i < num_boxes; ++i)
+  {
+    geometry_msgs::Pose pose;
+    pose.position.x = randomRange(0.3, 0.7);
+    pose.position.y = randomRange(0.3, 0.7);
+    pose.position.z = randomRange(0.3, 0.7);
+    Eigen::Quaterniond q(randomRange(-1,1), randomRange(-1,1), randomRange(-1,1), randomRange(-1,1));
+    q.normalize();
+    pose.orientation.w = q.w();
+    pose.orientation.x = q.x();
+    pose.orientation.y = q.y();
+    pose.orientation.z = q.z();
+
+    // a plate a fraction of a cell thick
+    std::vector<double> dim(3);
+    dim[0] = randomRange(0.05, 0.2);
+    dim[1] = randomRange(0.05, 0.2);
+    dim[2] = randomRange(0.1, 0.5) * resolution;
+
+    std::vector<Eigen::Vector3d> voxels;
+    grid.getOccupiedVoxels(pose, dim, voxels);
+    if(voxels.empty())
+    {
+      ROS_ERROR("Box %d (%0.3f x %0.3f x %0.4f) has no cells.", i, dim[0], dim[1], dim[2]);
+      ++num_missed;
+      continue;
+    }
+
+    std::set<std::vector<int> > cells;
+    std::vector<int> c(3);
+    for(size_t j = 0; j < voxels.size(); ++j)
+    {
+      grid.worldToGrid(voxels[j](0), voxels[j](1), voxels[j](2), c[0], c[1], c[2]);
+      cells.insert(c);
+    }
+
+    Eigen::Matrix3d rot(q);
+    Eigen::Vector3d center(pose.position.x, pose.position.y, pose.position.z);
+    for(int j = 0; j < num_samples; ++j)
+    {
+      Eigen::Vector3d p = center + rot * Eigen::Vector3d(randomRange(-0.5,0.5)*dim[0], randomRange(-0.5,0.5)*dim[1], randomRange(-0.5,0.5)*dim[2]);
+      grid.worldToGrid(p(0), p(1), p(2), c[0], c[1], c[2]);
+      if(cells.find(c) == cells.end())
+      {
+        ROS_ERROR("Box %d: cell {%d %d %d} holds the point {%0.4f %0.4f %0.4f} but wasn't returned.", i, c[0], c[1], c[2], p(0), p(1), p(2));
+        ++num_missed;
+        break;
+      }
+    }
+
+    // a returned cell overlaps the box if some point of a fine lattice over
+    // the cell is within half a lattice diagonal of it
+    int steps = 8;
+    double spacing = resolution / steps, slack = 0.5 * sqrt(3.0) * spacing + 1e-9;
+    for(std::set<std::vector<int> >::const_iterator it = cells.begin(); it != cells.end(); ++it)
+    {
+      double x, y, z;
+      grid.gridToWorld((*it)[0], (*it)[1], (*it)[2], x, y, z);
+      Eigen::Vector3d corner(x - 0.5*resolution, y - 0.5*resolution, z - 0.5*resolution);
+      bool overlaps = false;
+      for(int a = 0; a <= steps && !overlaps; ++a)
+      {
+        for(int b = 0; b <= steps && !overlaps; ++b)
+        {
+          for(int d = 0; d <= steps && !overlaps; ++d)
+          {
+            if(boxDistance(rot, center, dim, corner + spacing*Eigen::Vector3d(a, b, d)) <= slack)
+              overlaps = true;
+          }
+        }
+      }
+      if(!overlaps)
+      {
+        ROS_ERROR("Box %d: cell {%d %d %d} was returned but doesn't overlap the box.", i, (*it)[0], (*it)[1], (*it)[2]);
+        ++num_extra;
+        break;
+      }
+    }
+  }
+
+  if(num_missed > 0 || num_extra > 0)
+  {
+    ROS_ERROR("%d of %d boxes were missing cells, %d had cells they don't overlap.", num_missed, num_boxes, num_extra);
+    return 1;
+  }
+  ROS_INFO("All %d boxes covered exactly the cells they overlap.", num_boxes);
+  return 0;
+}
@@ -27,7 +27,7 @@ class RPYSolver
 
     ~RPYSolver(){};
 
-    bool computeRPYOnly(const std::vector<double> &rpy, const std::vector<double> &start, const std::vector<double> &forearm_roll_link_pose, const std::vector<double> &endeff_link_pose, int solution_num, std::vector<double> &solution);
+    bool computeRPYOnly(const std::vector<double> &rpy, const std::vector<double> &start, const std::vector<double> &forearm_roll_link_pose, const std::vector<double> &endeff_link_pose, int solution_num, std::vector<double> &solution) const;
 
   private:
 
@@ -41,7 +41,7 @@ class RPYSolver
     * the joints are of the same nature and the reference frame conventions
     * are the same.
     */
-    void orientationSolver(double*, double, double, double, double, double, double, double, double, double, int);
+    void orientationSolver(double*, double, double, double, double, double, double, double, double, double, int) const;
 };
 
 }
@@ -52,6 +52,12 @@ using namespace std;
 
 namespace sbpl_arm_planner {
 
+/** @brief the PR2 IK solver keeps its last solutions, one per context */
+struct PR2KDLRobotModelContext : public KDLRobotModelContext
+{
+  boost::shared_ptr<pr2_arm_kinematics::PR2ArmIKSolver> pr2_ik_solver;
+};
+
 class PR2KDLRobotModel : public KDLRobotModel {
 
   public:
@@ -63,18 +69,22 @@ class PR2KDLRobotModel : public KDLRobotModel {
     /* Initialization */
     virtual bool init(std::string robot_description, std::vector<std::string> &planning_joints);
 
+    virtual RobotModelContext* createContext() const;
+
     /* Inverse Kinematics */
-    virtual bool computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option=0);
+    using KDLRobotModel::computeIK;
+    using KDLRobotModel::computeFastIK;
+
+    virtual bool computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option, RobotModelContext &ctx) const;
     
-    virtual bool computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution);
+    virtual bool computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, RobotModelContext &ctx) const;
 
     /* Debug Output */
     virtual void printRobotModelInformation();
 
   private:
 
-    pr2_arm_kinematics::PR2ArmIKSolver* pr2_ik_solver_;
-    
+    /* doesn't keep any state, shared by all of the contexts */
     sbpl_arm_planner::RPYSolver* rpy_solver_;
 
     std::string forearm_roll_link_name_;
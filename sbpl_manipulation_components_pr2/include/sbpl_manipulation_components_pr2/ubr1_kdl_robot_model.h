@@ -60,10 +60,13 @@ class UBR1KDLRobotModel : public KDLRobotModel {
     ~UBR1KDLRobotModel();
    
     /* Inverse Kinematics */
-    virtual bool computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option=0);
+    using KDLRobotModel::computeIK;
+
+    virtual bool computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option, RobotModelContext &ctx) const;
     
   private:
 
+    /* doesn't keep any state, shared by all of the contexts */
     sbpl_arm_planner::RPYSolver* rpy_solver_;
 
     std::string forearm_roll_link_name_;
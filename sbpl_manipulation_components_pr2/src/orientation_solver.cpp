@@ -29,7 +29,7 @@ RPYSolver::RPYSolver(double wrist_pitch_min_limit, double wrist_pitch_max_limit)
   //printf("[rpy-solver] wrist_pitch_limits: {min: %0.3f  max: %0.3f}\n", wrist_pitch_min_limit, wrist_pitch_max_limit);
 }
 
-bool RPYSolver::computeRPYOnly(const std::vector<double> &rpy, const std::vector<double> &start, const std::vector<double> &forearm_roll_link_pose, const std::vector<double> &endeff_link_pose, int solution_num, std::vector<double> &solution)
+bool RPYSolver::computeRPYOnly(const std::vector<double> &rpy, const std::vector<double> &start, const std::vector<double> &forearm_roll_link_pose, const std::vector<double> &endeff_link_pose, int solution_num, std::vector<double> &solution) const
 {
   double hand_rotations[4];
 
@@ -45,7 +45,7 @@ bool RPYSolver::computeRPYOnly(const std::vector<double> &rpy, const std::vector
   return true;
 }
 
-void RPYSolver::orientationSolver(double* output, double phi, double theta, double psi, double yaw1, double pitch1, double roll1, double yaw2, double pitch2, double roll2, int attempt) 
+void RPYSolver::orientationSolver(double* output, double phi, double theta, double psi, double yaw1, double pitch1, double roll1, double yaw2, double pitch2, double roll2, int attempt) const
 {
   /**************************************************************************/
   //Is the desired orientation possible to attain with the given joint limits?
@@ -38,7 +38,7 @@ using namespace std;
 
 namespace sbpl_arm_planner {
 
-PR2KDLRobotModel::PR2KDLRobotModel() : pr2_ik_solver_(NULL), rpy_solver_(NULL)
+PR2KDLRobotModel::PR2KDLRobotModel() : rpy_solver_(NULL)
 {
   chain_root_name_ = "torso_lift_link";
   chain_tip_name_ = "r_gripper_palm_link";
@@ -49,9 +49,6 @@ PR2KDLRobotModel::PR2KDLRobotModel() : pr2_ik_solver_(NULL), rpy_solver_(NULL)
 
 PR2KDLRobotModel::~PR2KDLRobotModel()
 {
-  if(pr2_ik_solver_)
-    delete pr2_ik_solver_;
-
   if(rpy_solver_)
     delete rpy_solver_;
 }
@@ -120,29 +117,14 @@ bool PR2KDLRobotModel::init(std::string robot_description, std::vector<std::stri
     return false;
   }
 
-  // FK solver
-  fk_solver_ = new KDL::ChainFkSolverPos_recursive(kchain_);
-  jnt_pos_in_.resize(kchain_.getNrOfJoints());
-  jnt_pos_out_.resize(kchain_.getNrOfJoints());
-
-  // IK solver
-  KDL::JntArray q_min(planning_joints_.size());
-  KDL::JntArray q_max(planning_joints_.size());
-  for(size_t i = 0; i < planning_joints_.size(); ++i)
-  {
-    q_min(i) = min_limits_[i];
-    q_max(i) = max_limits_[i];
-  }
-  ik_vel_solver_ = new KDL::ChainIkSolverVel_pinv(kchain_);
-  ik_solver_ = new KDL::ChainIkSolverPos_NR_JL(kchain_, q_min, q_max, *fk_solver_, *ik_vel_solver_, 200, 0.001);
-
-  // PR2 Specific IK Solver
-  pr2_ik_solver_ = new pr2_arm_kinematics::PR2ArmIKSolver(*urdf_, chain_root_name_, chain_tip_name_, 0.02, 2);
-  if(!pr2_ik_solver_->active_)
+  // PR2 Specific IK Solver, the contexts each make their own
+  pr2_arm_kinematics::PR2ArmIKSolver pr2_ik_solver(*urdf_, chain_root_name_, chain_tip_name_, 0.02, 2);
+  if(!pr2_ik_solver.active_)
   {
     ROS_ERROR("The pr2 IK solver is NOT active. Exiting.");
     return false;
   }
+  ctx_.reset();
 
   // joint name -> index mapping
   for(size_t i = 0; i < planning_joints_.size(); ++i)
@@ -161,14 +143,25 @@ bool PR2KDLRobotModel::init(std::string robot_description, std::vector<std::stri
   bool wrist_continuous;
   if(!getJointLimits(wrist_pitch_joint_name_, wrist_min_limit, wrist_max_limit, wrist_continuous, false))
     return false;
+  if(rpy_solver_)
+    delete rpy_solver_;
   rpy_solver_ = new sbpl_arm_planner::RPYSolver(wrist_min_limit, wrist_max_limit);
 
   initialized_ = true;
   return true;
 }
 
-bool PR2KDLRobotModel::computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option)
+RobotModelContext* PR2KDLRobotModel::createContext() const
+{
+  PR2KDLRobotModelContext *ctx = new PR2KDLRobotModelContext();
+  initContext(*ctx);
+  ctx->pr2_ik_solver.reset(new pr2_arm_kinematics::PR2ArmIKSolver(*urdf_, chain_root_name_, chain_tip_name_, 0.02, 2));
+  return ctx;
+}
+
+bool PR2KDLRobotModel::computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option, RobotModelContext &ctx) const
 {
+  PR2KDLRobotModelContext &pctx = static_cast<PR2KDLRobotModelContext&>(ctx);
   //pose: {x,y,z,r,p,y} or {x,y,z,qx,qy,qz,qw}
   KDL::Frame frame_des;
   frame_des.p.x(pose[0]);
@@ -187,7 +180,7 @@ bool PR2KDLRobotModel::computeIK(const std::vector<double> &pose, const std::vec
 
   // seed configuration
   for(size_t i = 0; i < start.size(); i++)
-    jnt_pos_in_(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
+    pctx.jnt_pos_in(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
 
   solution.resize(start.size());
 
@@ -199,14 +192,14 @@ bool PR2KDLRobotModel::computeIK(const std::vector<double> &pose, const std::vec
     std::vector<double> const rpy2(rpy);
 
     // get pose of forearm link
-    if(!computeFK(start, forearm_roll_link_name_, fpose))
+    if(!computeFK(start, forearm_roll_link_name_, fpose, ctx))
     {
       ROS_ERROR("[rm] computeFK failed on forearm pose.");
       return false;
     }
 
     // get pose of end-effector link
-    if(!computeFK(start, end_effector_link_name_, epose))
+    if(!computeFK(start, end_effector_link_name_, epose, ctx))
     {
       ROS_ERROR("[rm] computeFK failed on end_eff pose.");
       return false;
@@ -216,18 +209,19 @@ bool PR2KDLRobotModel::computeIK(const std::vector<double> &pose, const std::vec
   }
   else
   {
-    if(pr2_ik_solver_->CartToJntSearch(jnt_pos_in_, frame_des, jnt_pos_out_, 0.2) < 0)
+    if(pctx.pr2_ik_solver->CartToJntSearch(pctx.jnt_pos_in, frame_des, pctx.jnt_pos_out, 0.2) < 0)
       return false;
     
     for(size_t i = 0; i < solution.size(); ++i)
-      solution[i] = jnt_pos_out_(i);
+      solution[i] = pctx.jnt_pos_out(i);
   }
 
   return true;
 }
 
-bool PR2KDLRobotModel::computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution)
+bool PR2KDLRobotModel::computeFastIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, RobotModelContext &ctx) const
 {
+  PR2KDLRobotModelContext &pctx = static_cast<PR2KDLRobotModelContext&>(ctx);
   //pose: {x,y,z,r,p,y} or {x,y,z,qx,qy,qz,qw}
   KDL::Frame frame_des;
   frame_des.p.x(pose[0]);
@@ -246,14 +240,14 @@ bool PR2KDLRobotModel::computeFastIK(const std::vector<double> &pose, const std:
 
   // seed configuration
   for(size_t i = 0; i < start.size(); i++)
-    jnt_pos_in_(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
+    pctx.jnt_pos_in(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
 
-  if(pr2_ik_solver_->CartToJnt(jnt_pos_in_, frame_des, jnt_pos_out_) < 0)
+  if(pctx.pr2_ik_solver->CartToJnt(pctx.jnt_pos_in, frame_des, pctx.jnt_pos_out) < 0)
     return false;
 
   solution.resize(start.size());
   for(size_t i = 0; i < solution.size(); ++i)
-    solution[i] = jnt_pos_out_(i);
+    solution[i] = pctx.jnt_pos_out(i);
 
   return true;
 }
@@ -70,8 +70,9 @@ bool UBR1KDLRobotModel::init(std::string robot_description, std::vector<std::str
 }
 */
 
-bool UBR1KDLRobotModel::computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option)
+bool UBR1KDLRobotModel::computeIK(const std::vector<double> &pose, const std::vector<double> &start, std::vector<double> &solution, int option, RobotModelContext &ctx) const
 {
+  KDLRobotModelContext &kctx = static_cast<KDLRobotModelContext&>(ctx);
   //pose: {x,y,z,r,p,y} or {x,y,z,qx,qy,qz,qw}
   KDL::Frame frame_des;
   frame_des.p.x(pose[0]);
@@ -90,7 +91,7 @@ bool UBR1KDLRobotModel::computeIK(const std::vector<double> &pose, const std::ve
 
   // seed configuration
   for(size_t i = 0; i < start.size(); i++)
-    jnt_pos_in_(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
+    kctx.jnt_pos_in(i) = angles::normalize_angle(start[i]); // must be normalized for CartToJntSearch
 
   solution.resize(start.size());
 
@@ -102,14 +103,14 @@ bool UBR1KDLRobotModel::computeIK(const std::vector<double> &pose, const std::ve
     std::vector<double> const rpy2(rpy);
 
     // get pose of forearm link
-    if(!computeFK(start, forearm_roll_link_name_, fpose))
+    if(!computeFK(start, forearm_roll_link_name_, fpose, ctx))
     {
       ROS_ERROR("[rm] computeFK failed on forearm pose.");
       return false;
     }
 
     // get pose of end-effector link
-    if(!computeFK(start, end_effector_link_name_, epose))
+    if(!computeFK(start, end_effector_link_name_, epose, ctx))
     {
       ROS_ERROR("[rm] computeFK failed on end_eff pose.");
       return false;
@@ -119,11 +120,11 @@ bool UBR1KDLRobotModel::computeIK(const std::vector<double> &pose, const std::ve
   }
   else
   {
-    if(computeIKSearch(pose, start, solution, 0.01) < 0)
+    if(!computeIKSearch(pose, start, solution, 0.01, kctx))
       return false;
     
     for(size_t i = 0; i < solution.size(); ++i)
-      solution[i] = jnt_pos_out_(i);
+      solution[i] = kctx.jnt_pos_out(i);
   }
 
   return true;